@@ -4,6 +4,8 @@
 #include "hash.h"
 #define HASH_IMPLEMENTATION
 #include "hash2.h"
+#include "hashg.h"
+#include "hashs.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
@@ -19,57 +21,168 @@ static double now() {
 	return d;
 }
 
-static size_t hashii_hash(int i) { return (unsigned)i; }
-HASH_DECLARE(hashii, int, int, hashii_hash)
+static void report(const char *name, double start, double put, double get, double del) {
+	if(del) printf("%-8s put=%f get=%f del=%f total=%f\n", name, put - start, get - put, del - get, del - start);
+	else printf("%-8s put=%f get=%f total=%f\n", name, put - start, get - put, get - start);
+}
+
+HASH_DECLARE(hashii, int, int, hash1_int)
+HASHG_DECLARE(hashgii, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHS_DECLARE(hashsii, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+
+/* slowest single put. a whole table rehash lands on one put unless incremental */
+/* lookups in a table bigger than the cache one at a time and batched */
+#define JOIN (1 << 22)
+static void join(void) {
+	int *keys = (int*)malloc(JOIN * sizeof(int)), *probes = (int*)malloc(JOIN * sizeof(int));
+	int *values = (int*)malloc(JOIN * sizeof(int)), *found = (int*)malloc(JOIN * sizeof(int));
+	int **pvalues = (int**)malloc(JOIN * sizeof(int*));
+	size_t sum = 0;
+	for(int i=0;i<JOIN;i++) keys[i] = i + 1;
+	for(int i=0;i<JOIN;i++) probes[i] = rand() % (JOIN * 2) + 1;
+
+	hashii hash = {0};
+	hashii_put_many(&hash, keys, keys, JOIN);
+	double t = now();
+	for(int i=0;i<JOIN;i++) sum += hashii_get(&hash, probes[i], &values[i]);
+	double one = now() - t;
+	t = now();
+	sum -= hashii_get_many(&hash, probes, JOIN, values, found);
+	printf("%-8s join get=%f get_many=%f\n", "hash.h", one, now() - t);
+	hashii_destroy(&hash);
+
+	hashgii g;
+	hashgii_init(&g, JOIN);
+	hashgii_put_many(&g, keys, keys, JOIN);
+	t = now();
+	for(int i=0;i<JOIN;i++) sum += hashgii_get(&g, probes[i]) != 0;
+	one = now() - t;
+	t = now();
+	sum -= hashgii_get_many(&g, probes, JOIN, pvalues);
+	printf("%-8s join get=%f get_many=%f\n", "hashg.h", one, now() - t);
+	hashgii_destroy(&g);
+
+	assert(sum == 0);
+	free(keys);
+	free(probes);
+	free(values);
+	free(found);
+	free(pvalues);
+}
+
+static void latency(int *keys, int incremental) {
+	double t = now(), max = 0;
+	hashii hash = {0};
+	hash.incremental = incremental;
+	for(int i=0;i<SIZE;i++) {
+		double s = now();
+		hashii_put(&hash, keys[i], keys[i]);
+		if((s = now() - s) > max) max = s;
+	}
+	printf("%-8s %-11s put=%f max=%fms\n", "hash.h", incremental ? "incremental" : "grow", now() - t, max * 1000);
+	hashii_destroy(&hash);
+
+	t = now(), max = 0;
+	hashgii g;
+	hashgii_init(&g, 0);
+	g.incremental = incremental;
+	for(int i=0;i<SIZE;i++) {
+		double s = now();
+		hashgii_put(&g, keys[i], keys[i]);
+		if((s = now() - s) > max) max = s;
+	}
+	printf("%-8s %-11s put=%f max=%fms\n", "hashg.h", incremental ? "incremental" : "grow", now() - t, max * 1000);
+	hashgii_destroy(&g);
+}
+
 int main(int argc, char **argv) {
 	int *keys = (int*)malloc(SIZE * sizeof(int));
 	for(int i=0;i<SIZE;i++) while(!(keys[i] = rand())) {}
 	for(int k=0;k<3;k++) {
 		{
-			double t = now();
+			double t = now(), put, get;
 			hashii hash = {0};
 			int j;
 			for(int i=0;i<SIZE;i++) hashii_put(&hash, keys[i], keys[i]);
+			put = now();
 			for(int i=0;i<SIZE;i++) {
 				assert(hashii_get(&hash, keys[i], &j));
 				assert(j == keys[i]);
 			}
+			get = now();
 			for(int i=0;i<SIZE;i++) hashii_del(&hash, keys[i]);
 			for(int i=0;i<SIZE;i++)
 				assert(!hashii_get(&hash, keys[i], &j));
 
 			hashii_destroy(&hash);
-			printf("C=%f\n", now() - t);
+			report("hash.h", t, put, get, now());
 		}
 		{
-			double t = now();
+			double t = now(), put, get;
 			Hash hash;
 			hash_init(&hash, sizeof(int), sizeof(int), hash_i32, hash_equals_i32);
 
 			for(int i=0;i<SIZE;i++) hash_put(&hash, &keys[i], &keys[i]);
+			put = now();
 			for(int i=0;i<SIZE;i++) {
 				int j;
 				assert(hash_get_copy(&hash, &keys[i], &j));
 				assert(j == keys[i]);
 			}
+			get = now();
 			for(int i=0;i<SIZE;i++) hash_del(&hash, &keys[i]);
 			for(int i=0;i<SIZE;i++) {
 				int j;
 				assert(!hash_get_copy(&hash, &keys[i], &j));
 			}
-			printf("C2=%f\n", now() - t);
+			hash_destroy(&hash);
+			report("hash2.h", t, put, get, now());
+		}
+		{
+			/* no delete */
+			double t = now(), put;
+			hashgii hash;
+			hashgii_init(&hash, 0);
+			for(int i=0;i<SIZE;i++) hashgii_put(&hash, keys[i], keys[i]);
+			put = now();
+			for(int i=0;i<SIZE;i++) {
+				int *j = hashgii_get(&hash, keys[i]);
+				assert(j && *j == keys[i]);
+			}
+			report("hashg.h", t, put, now(), 0);
+			hashgii_destroy(&hash);
 		}
 		{
-			double t = now();
+			double t = now(), put, get;
+			hashsii hash;
+			hashsii_init(&hash, 0);
+			for(int i=0;i<SIZE;i++) hashsii_put(&hash, keys[i], keys[i]);
+			put = now();
+			for(int i=0;i<SIZE;i++) {
+				int *j = hashsii_get(&hash, keys[i]);
+				assert(j && *j == keys[i]);
+			}
+			get = now();
+			for(int i=0;i<SIZE;i++) hashsii_del(&hash, keys[i]);
+			for(int i=0;i<SIZE;i++) assert(!hashsii_get(&hash, keys[i]));
+			report("hashs.h", t, put, get, now());
+			hashsii_destroy(&hash);
+		}
+		{
+			double t = now(), put, get;
 			std::unordered_map<int, int> hash;
 
 			for(int i=0;i<SIZE;i++) hash[keys[i]] = keys[i];
+			put = now();
 			for(int i=0;i<SIZE;i++) assert(hash[keys[i]] == keys[i]);
+			get = now();
 			for(int i=0;i<SIZE;i++) hash.erase(keys[i]);
 			for(int i=0;i<SIZE;i++) assert(hash.find(keys[i]) == hash.end());
-			printf("C++=%f\n", now() - t);
+			report("C++", t, put, get, now());
 		}
 	}
+	latency(keys, 0);
+	latency(keys, 1);
+	join();
 	return 0;
 }
-
@@ -4,85 +4,181 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include "hashfn.h"
 
-/* FNV-1a */
 static size_t hash1_string(const char *key) {
-	unsigned long long hash = 14695981039346656037ULL;
-	while(*key) {
-		hash ^= (unsigned char)*key;
-		hash *= 1099511628211ULL;
-	}
-	return (size_t)hash;
+	return (size_t)hashfn_string(key, HASHFN_SEED);
+}
+
+static size_t hash1_int(int key) {
+	return (size_t)hashfn_u64((unsigned)key, HASHFN_SEED);
 }
 
+/* the old slots of an incremental grow are not visited. name##_migrate(t, SIZE_MAX) first */
 #define HASH_FOREACH(name, var, t) \
 	for(name##_kvp *var=(t)->table;var != (t)->table+(t)->n;++var)
 
+#ifndef HASH_MIGRATE
+/* old slots moved per operation while an incremental grow is in progress */
+#define HASH_MIGRATE 16
+#endif
+
+#ifndef HASH_BATCH
+/* keys in flight per group of the _many functions */
+#define HASH_BATCH 16
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define HASH_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HASH_PREFETCH(p) ((void)0)
+#endif
+
+/* set incremental to move slots to a grown table a few at a time
+   instead of all at once. old holds the slots from migrate on */
 #define HASH_DECLARE(name, key, value, hash) \
 	struct name##_kvp { key k; value v; };\
-	typedef struct name { struct name##_kvp *table; size_t n_table, n; } name;\
+	typedef struct name { struct name##_kvp *table; size_t n_table, n;\
+		int incremental; struct name##_kvp *old; size_t n_old, migrate; } name;\
 	static char name##_zero[sizeof(key)];\
 	static void name##_put(name *t, key k, value v);\
 	static size_t name##_hashmod(name* t, key k) { return hash(k) & (t->n_table-1); }\
 	static size_t name##_empty(key k) { return !memcmp(&k, name##_zero, sizeof(k)); }\
-	static size_t name##_find(name* t, key k) { \
-		size_t h = name##_hashmod(t, k);\
-		while(!name##_empty(t->table[h].k) && memcmp(&t->table[h].k, &k, sizeof(key)))\
-			if(++h == t->n_table) h = 0;\
+	static size_t name##_probe(struct name##_kvp *table, size_t n_table, key k) { \
+		size_t h = hash(k) & (n_table-1);\
+		while(!name##_empty(table[h].k) && memcmp(&table[h].k, &k, sizeof(key)))\
+			if(++h == n_table) h = 0;\
 		return h;\
 	}\
-	static void name##_grow(name *t) {\
-		if(t->n >= t->n_table * 70 / 100) {\
-			struct name x;\
-			size_t i,n = t->n_table * 2;\
-			if(!n) n = 1024;\
-			x.table = (struct name##_kvp*)calloc(sizeof(struct name##_kvp), n);\
-			if(!x.table) return;\
-			x.n_table = n;x.n = 0;\
-			for(i=0;i<t->n_table;i++) {\
-				struct name##_kvp *kvp = &t->table[i]; \
-				if(!name##_empty(kvp->k)) name##_put(&x, kvp->k, kvp->v);\
-			}\
-			free(t->table);\
-			*t = x;\
+	static size_t name##_find(name* t, key k) { return name##_probe(t->table, t->n_table, k); }\
+	/* delete algorithm from wikipedia open addressing */ \
+	static void name##_remove(struct name##_kvp *table, size_t n_table, size_t i) {\
+		size_t j = i, h;\
+		for(;;) {\
+			memset(&table[i].k, 0, sizeof(key));\
+		next: \
+			if(++j == n_table) j = 0;\
+			if(name##_empty(table[j].k)) break; \
+			h = hash(table[j].k) & (n_table-1);\
+			/* check if h in (i, j]. if so skip. it is in correct position */\
+			if((i<=j) ? (i<h && h<=j) : (i<h || h<=j)) goto next;\
+			table[i] = table[j];\
+			i = j;\
 		}\
 	}\
+	/* every old slot below migrate is empty so old probes still work. \
+	   a removal can shift a later entry into migrate so it is rechecked */ \
+	static void name##_migrate(name *t, size_t count) {\
+		while(count && t->migrate < t->n_old) {\
+			struct name##_kvp *kvp = &t->old[t->migrate];\
+			if(name##_empty(kvp->k)) { t->migrate++; continue; }\
+			t->table[name##_find(t, kvp->k)] = *kvp;\
+			name##_remove(t->old, t->n_old, t->migrate);\
+			count--;\
+		}\
+		if(t->migrate == t->n_old) { free(t->old); t->old = 0; }\
+	}\
+	static void name##_resize(name *t, size_t n) {\
+		struct name##_kvp *table = (struct name##_kvp*)calloc(sizeof(struct name##_kvp), n);\
+		if(!table) return;\
+		if(t->old) name##_migrate(t, SIZE_MAX);\
+		t->old = t->table;\
+		t->n_old = t->n_table;\
+		t->migrate = 0;\
+		t->table = table;\
+		t->n_table = n;\
+		if(!t->incremental) name##_migrate(t, SIZE_MAX);\
+	}\
+	static void name##_grow(name *t) {\
+		if(t->n >= t->n_table * 70 / 100) name##_resize(t, t->n_table ? t->n_table * 2 : 1024);\
+		else if(t->old) name##_migrate(t, HASH_MIGRATE);\
+	}\
+	/* presize for n keys so puts up to n never grow */ \
+	static void name##_reserve(name *t, size_t n) {\
+		size_t size = t->n_table ? t->n_table : 1024;\
+		while(n >= size * 70 / 100) size *= 2;\
+		if(size == t->n_table) return;\
+		int incremental = t->incremental;\
+		t->incremental = 0;\
+		name##_resize(t, size);\
+		t->incremental = incremental;\
+	}\
 	static void name##_put(name *t, key k, value v) {\
 		size_t h;\
 		name##_grow(t); \
-		h = name##_hashmod(t, k);\
-		for(;;) {\
-			if(name##_empty(t->table[h].k)) { ++t->n; break; }\
-			if(!memcmp(&t->table[h].k, &k, sizeof(key))) break;\
-			if(++h == t->n_table) h = 0;\
+		h = name##_find(t, k);\
+		if(name##_empty(t->table[h].k)) {\
+			/* update in place if the key has not moved yet */\
+			if(t->old) {\
+				size_t o = name##_probe(t->old, t->n_old, k);\
+				if(!name##_empty(t->old[o].k)) { t->old[o].v = v; return; }\
+			}\
+			++t->n;\
 		}\
 		struct name##_kvp *kvp = &t->table[h];\
 		kvp->k = k; kvp->v = v;\
 	}\
-	/* delete algorithm from wikipedia open addressing */ \
 	static void name##_del(name *t, key k) {\
-		size_t i,j,h; \
+		size_t i; \
+		if(!t->table) return;\
 		i = name##_find(t, k); \
-		j = i;\
-		for(;;) {\
-			memset(&t->table[i].k, 0, sizeof(key));\
-		next: \
-			if(++j == t->n_table) j = 0;\
-			if(name##_empty(t->table[j].k)) break; \
-			h = name##_hashmod(t, t->table[j].k);\
-			/* check if h in (i, j]. if so skip. it is in correct position */\
-			if((i<=j) ? (i<h && h<=j) : (i<h || h<=j)) goto next;\
-			t->table[i] = t->table[j];\
-			i = j;\
+		if(!name##_empty(t->table[i].k)) {\
+			name##_remove(t->table, t->n_table, i);\
+			t->n--;\
+		} else if(t->old) {\
+			i = name##_probe(t->old, t->n_old, k);\
+			if(name##_empty(t->old[i].k)) return;\
+			name##_remove(t->old, t->n_old, i);\
+			t->n--;\
 		}\
 	}\
 	static int name##_get(name *t, key k, value *v) {\
-		struct name##_kvp *kvp = &t->table[name##_find(t, k)];\
+		struct name##_kvp *kvp;\
+		if(!t->table) return 0;\
+		if(t->old) name##_migrate(t, HASH_MIGRATE);\
+		kvp = &t->table[name##_find(t, k)];\
+		if(name##_empty(kvp->k) && t->old) kvp = &t->old[name##_probe(t->old, t->n_old, k)];\
 		*v = kvp->v;\
 		return !name##_empty(kvp->k);\
 	}\
+	/* found[i] is 1 and values[i] set if keys[i] is in t. each group of keys \
+	   prefetches its slots before probing so the cache misses overlap. \
+	   return the number found */ \
+	static size_t name##_get_many(name *t, key const *keys, size_t n, value *values, int *found) {\
+		size_t count = 0, slot[HASH_BATCH];\
+		if(!t->table) { memset(found, 0, n * sizeof(int)); return 0; }\
+		for(size_t g=0;g<n;g+=HASH_BATCH) {\
+			size_t m = n - g < HASH_BATCH ? n - g : HASH_BATCH;\
+			if(t->old) name##_migrate(t, HASH_MIGRATE);\
+			for(size_t i=0;i<m;i++) {\
+				slot[i] = name##_hashmod(t, keys[g + i]);\
+				HASH_PREFETCH(&t->table[slot[i]]);\
+			}\
+			for(size_t i=0;i<m;i++) {\
+				size_t h = slot[i];\
+				struct name##_kvp *kvp;\
+				while(!name##_empty(t->table[h].k) && memcmp(&t->table[h].k, &keys[g + i], sizeof(key)))\
+					if(++h == t->n_table) h = 0;\
+				kvp = &t->table[h];\
+				if(name##_empty(kvp->k) && t->old) kvp = &t->old[name##_probe(t->old, t->n_old, keys[g + i])];\
+				found[g + i] = !name##_empty(kvp->k);\
+				if(found[g + i]) { values[g + i] = kvp->v; count++; }\
+			}\
+		}\
+		return count;\
+	}\
+	static void name##_put_many(name *t, key const *keys, value const *values, size_t n) {\
+		for(size_t g=0;g<n;g+=HASH_BATCH) {\
+			size_t m = n - g < HASH_BATCH ? n - g : HASH_BATCH;\
+			/* grow first so the prefetched slots are the ones put uses */\
+			if(t->n + m >= t->n_table * 70 / 100) name##_resize(t, t->n_table ? t->n_table * 2 : 1024);\
+			for(size_t i=0;i<m;i++) HASH_PREFETCH(&t->table[name##_hashmod(t, keys[g + i])]);\
+			for(size_t i=0;i<m;i++) name##_put(t, keys[g + i], values[g + i]);\
+		}\
+	}\
 	static void name##_destroy(name *t) {\
 		free(t->table); \
+		free(t->old); \
 	}
 
 #endif
@@ -93,8 +189,7 @@ static size_t hash1_string(const char *key) {
 #include <stdio.h>
 #include <time.h>
 #define SIZE 1000000
-static size_t hashii_hash(int i) { return (unsigned)i; }
-HASH_DECLARE(hashii, int, int, hashii_hash)
+HASH_DECLARE(hashii, int, int, hash1_int)
 
 int main(int argc, char **argv) {
 	hashii hash = {0};
@@ -109,8 +204,70 @@ int main(int argc, char **argv) {
 	for(int i=0;i<SIZE /2;i++) hashii_del(&hash, keys[i]);
 	for(int i=0;i<SIZE / 2;i++)
 		assert(!hashii_get(&hash, keys[i], &j));
+	assert(hash.n == 0);
+	hashii_destroy(&hash);
 
+	/* incremental grow with deletes and updates. every live key has its
+	   latest value while split over both tables and once the grow ends */
+	int *live = (int*)malloc(SIZE * sizeof(int)), *latest = (int*)malloc(SIZE * sizeof(int));
+	int started = 0, halfway = 0, checks = 0;
+	for(int i=0;i<SIZE;i++) keys[i] = i * 2 + 1; /* distinct so a delete removes one key */
+	memset(&hash, 0, sizeof hash);
+	hash.incremental = 1;
+	for(int i=0;i<SIZE;i++) {
+		hashii_put(&hash, keys[i], latest[i] = i);
+		live[i] = 1;
+		if(i % 3 == 0) {
+			hashii_del(&hash, keys[i / 2]);
+			live[i / 2] = 0;
+		}
+		if(i % 5 == 0 && live[i / 4]) hashii_put(&hash, keys[i / 4], latest[i / 4] = -i);
+		if(!hash.old) started = halfway = 0;
+		else if(!started || (!halfway && hash.migrate >= hash.n_old / 2)) {
+			halfway = started;
+			started = 1;
+			checks++;
+			for(int k=0;k<=i;k++) {
+				assert(hashii_get(&hash, keys[k], &j) == live[k]);
+				if(live[k]) assert(j == latest[k]);
+			}
+		}
+	}
+	assert(checks > 2);
+	hashii_migrate(&hash, SIZE_MAX);
+	size_t nlive = 0;
+	for(int i=0;i<SIZE;i++) {
+		assert(hashii_get(&hash, keys[i], &j) == live[i]);
+		if(live[i]) assert(j == latest[i]);
+		nlive += live[i];
+	}
+	assert(!hash.old && hash.n == nlive);
+	free(live);
+	free(latest);
+	hashii_destroy(&hash);
+
+	memset(&hash, 0, sizeof hash);
+	hashii_reserve(&hash, SIZE);
+	size_t n_table = hash.n_table;
+	for(int i=0;i<SIZE;i++) hashii_put(&hash, keys[i], keys[i]);
+	assert(hash.n_table == n_table);
+	hashii_destroy(&hash);
+
+	/* batched. odd keys are missing */
+	memset(&hash, 0, sizeof hash);
+	int *values = (int*)malloc(SIZE * sizeof(int)), *found = (int*)malloc(SIZE * sizeof(int));
+	for(int i=0;i<SIZE;i++) keys[i] = i * 2 + 2 - (i & 1);
+	hashii_put_many(&hash, keys, keys, SIZE);
+	for(int i=1;i<SIZE;i+=2) hashii_del(&hash, keys[i]);
+	assert(hashii_get_many(&hash, keys, SIZE, values, found) == SIZE / 2);
+	for(int i=0;i<SIZE;i++) {
+		assert(found[i] == !(i & 1));
+		if(found[i]) assert(values[i] == keys[i]);
+	}
 	hashii_destroy(&hash);
+	free(values);
+	free(found);
+	free(keys);
 	return 0;
 }
 
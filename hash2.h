@@ -9,6 +9,7 @@
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -20,19 +21,28 @@ extern "C" {
 typedef size_t (*hash_func)(const void *key, size_t n);
 /* return 0 on not equal and non-0 on equals */
 typedef int (*hash_equals)(const void *key1, const void *key2, size_t n);
+/* every slot keeps 32 bits of its hash (0 for empty) so probes skip slots whose
+   hash differs without calling equals and grow never calls hash. 4 and 8
+   byte keys with the default or i32 functions are hashed and compared
+   inline instead of through the function pointers */
 typedef struct Hash {
-	unsigned char *keys, *values, *set;
+	unsigned char *keys, *values;
+	uint32_t *hashes;
 	hash_func hash;
 	hash_equals equals;
 	size_t n, n_table, n_key, n_value;
+	int shift; /* hash >> shift is the home slot */
+	int kind;  /* HASH_KIND_ */
 } Hash;
 
+enum { HASH_KIND_FUNC, HASH_KIND_BYTES, HASH_KIND_U32, HASH_KIND_U64 };
+
 HASH_API void hash_init(Hash *h, size_t n_key, size_t n_value, hash_func hash, hash_equals equals);
 HASH_API void* hash_get(Hash *h, const void *key);
 HASH_API int hash_get_copy(Hash *h, const void *key, void *value);
 HASH_API void hash_put(Hash *h, const void *key, const void *value);
-HASH_API void hash_destroy(Hash *h);
 HASH_API int hash_del(Hash *h, const void *key);
+/* slot i for i < n_table. 0 if empty */
 HASH_API void* hash_value(Hash *h, size_t i);
 HASH_API void* hash_key(Hash *h, size_t i);
 HASH_API void hash_destroy(Hash *h);
@@ -49,31 +59,23 @@ HASH_API int hash_equals_default(const void *a, const void *b, size_t n);
 #endif
 
 #ifdef HASH_IMPLEMENTATION
+#include "hashfn.h"
 
-/* FNV-1a */
 HASH_API size_t hash_string(const void *key, size_t n) {
-	unsigned long long hash = 14695981039346656037ULL;
-	unsigned char *k = *(unsigned char**)key;
-	while(*k) {
-		hash ^= *k++;
-		hash *= 1099511628211ULL;
-	}
-	return (size_t)hash;
+	return (size_t)hashfn_string(*(const char**)key, HASHFN_SEED);
 }
 HASH_API int hash_equals_string(const void *a, const void *b, size_t n) {
 	return !strcmp(*(const char**)a, *(const char**)b);
 }
 HASH_API size_t hash_i32(const void *k, size_t n) {
-	return *(unsigned*)k;
+	return (size_t)hashfn_u64(*(unsigned*)k, HASHFN_SEED);
 }
 
 HASH_API int hash_equals_i32(const void *k, const void *k2, size_t n) {
 	return *(int*)k == *(int*)k2;
 }
 HASH_API size_t hash_default(const void *key, size_t n) {
-	size_t h = 0;
-	memcpy(&h, key, n < sizeof h ? n : h);
-	return h;
+	return (size_t)hashfn_bytes(key, n, HASHFN_SEED);
 }
 HASH_API int hash_equals_default(const void *a, const void *b, size_t n) {
 	return !memcmp(a, b, n);
@@ -82,85 +84,140 @@ HASH_API int hash_equals_default(const void *a, const void *b, size_t n) {
 
 HASH_API void
 hash_init(Hash *h, size_t n_key, size_t n_value, hash_func hash, hash_equals equals) {
-	h->keys = h->values = h->set = 0;
+	h->keys = h->values = 0;
+	h->hashes = 0;
 	h->n = h->n_table = 0;
+	h->shift = 0;
 	h->hash = hash ? hash : hash_default;
 	h->equals = equals ? equals : hash_equals_default;
 	h->n_key = n_key;
 	h->n_value = n_value;
+	h->kind = HASH_KIND_FUNC;
+	if(h->equals == hash_equals_default || (h->equals == hash_equals_i32 && n_key == 4)) {
+		if(n_key == 4 && (h->hash == hash_default || h->hash == hash_i32)) h->kind = HASH_KIND_U32;
+		else if(n_key == 8 && h->hash == hash_default) h->kind = HASH_KIND_U64;
+		else if(h->equals == hash_equals_default) h->kind = HASH_KIND_BYTES;
+	}
+}
+
+/* never 0 so 0 marks empty slots. multiplied so the top bits used for
+   the slot depend on every bit of weak hashes */
+static uint32_t
+hash_hash(Hash *h, const void *key) {
+	size_t x;
+	if(h->kind == HASH_KIND_U32) {
+		uint32_t k;
+		memcpy(&k, key, 4);
+		x = (size_t)hashfn_u64(k, HASHFN_SEED);
+	} else if(h->kind == HASH_KIND_U64) {
+		uint64_t k;
+		memcpy(&k, key, 8);
+		x = (size_t)hashfn_u64(k, HASHFN_SEED);
+	} else {
+		x = h->hash(key, h->n_key);
+	}
+	return (uint32_t)((uint64_t)x * 0x9E3779B97F4A7C15ull >> 32) | 1;
 }
 
-/* returns 0 on success */
 static int
-hash_grow(Hash *h) {
-	size_t i, n;
-	Hash h2;
+hash_same(Hash *h, const void *key, size_t i) {
+	const unsigned char *k = &h->keys[i*h->n_key];
+	if(h->kind == HASH_KIND_U32) {
+		uint32_t a, b;
+		memcpy(&a, key, 4);
+		memcpy(&b, k, 4);
+		return a == b;
+	}
+	if(h->kind == HASH_KIND_U64) {
+		uint64_t a, b;
+		memcpy(&a, key, 8);
+		memcpy(&b, k, 8);
+		return a == b;
+	}
+	if(h->kind == HASH_KIND_BYTES) return !memcmp(key, k, h->n_key);
+	return h->equals(key, k, h->n_key);
+}
 
-	hash_init(&h2, h->n_key, h->n_value, h->hash, h->equals);
+/* slot of key or the empty slot where it would go */
+static size_t
+hash_find(Hash *h, const void *key, uint32_t hash) {
+	size_t i = hash >> h->shift;
+	for(;;) {
+		if(!h->hashes[i]) return i;
+		if(h->hashes[i] == hash && hash_same(h, key, i)) return i;
+		if(++i == h->n_table) i = 0;
+	}
+}
 
-	n = h->n_table * 2;
-	if(!n) n = 64;
+/* returns 0 on success. moves every slot with its stored hash so keys are
+   never hashed or compared again. at most 2^32 slots */
+static int
+hash_grow(Hash *h) {
+	size_t i, j, n = h->n_table ? h->n_table * 2 : 64;
+	int shift = 32;
+	unsigned char *keys, *values;
+	uint32_t *hashes;
 
-	h2.keys = (unsigned char*)malloc(n * h->n_key);
-	h2.values = (unsigned char*)malloc(n * h->n_value);
-	h2.set = (unsigned char*)calloc(1, (n + 7) / 8);
+	if((uint64_t)n > (uint64_t)1 << 32) return -1;
+	keys = (unsigned char*)malloc(n * h->n_key);
+	values = (unsigned char*)malloc(h->n_value ? n * h->n_value : 1);
+	hashes = (uint32_t*)calloc(n, sizeof(uint32_t));
 
-	if(!h2.keys || !h2.values || !h2.set) {
-		hash_destroy(&h2);
+	if(!keys || !values || !hashes) {
+		free(keys);
+		free(values);
+		free(hashes);
 		return -1;
 	}
-	h2.n_table = n;
-
+	for(j=n;j>1;j>>=1) shift--;
 	for(i=0;i<h->n_table;i++) {
-		if(h->set[i/8] & (1<<(i % 8)))
-			hash_put(&h2, &h->keys[i*h->n_key], &h->values[i*h->n_value]);
+		if(!h->hashes[i]) continue;
+		for(j=h->hashes[i]>>shift;hashes[j];) if(++j == n) j = 0;
+		hashes[j] = h->hashes[i];
+		memcpy(&keys[j*h->n_key], &h->keys[i*h->n_key], h->n_key);
+		memcpy(&values[j*h->n_value], &h->values[i*h->n_value], h->n_value);
 	}
-	hash_destroy(h);
-	*h = h2;
+	free(h->keys);
+	free(h->values);
+	free(h->hashes);
+	h->keys = keys;
+	h->values = values;
+	h->hashes = hashes;
+	h->n_table = n;
+	h->shift = shift;
 	return 0;
 }
 
-
-static size_t
-hash_mod(Hash *h, const void *key) {
-	return h->hash(key, h->n_key) & (h->n_table - 1);
-}
 HASH_API void
 hash_put(Hash *h, const void *key, const void *value) {
 	size_t i;
+	uint32_t hash = hash_hash(h, key);
 	if(h->n >= h->n_table * 70 / 100 && hash_grow(h)) return;
-	i = hash_mod(h, key);
-	for(;;) {
-		if(!(h->set[i/8] & (1<<(i % 8)))) { ++h->n; break; }
-		if(h->equals(key, &h->keys[i*h->n_key], h->n_key)) break;
-		if(++i == h->n_table) i = 0;
+	i = hash_find(h, key, hash);
+	if(!h->hashes[i]) {
+		++h->n;
+		h->hashes[i] = hash;
+		memcpy(&h->keys[i*h->n_key], key, h->n_key);
 	}
-	memcpy(&h->keys[i*h->n_key], key, h->n_key);
 	memcpy(&h->values[i*h->n_value], value, h->n_value);
-	h->set[i/8] |= 1 << (i % 8);
 }
 
 HASH_API void*
 hash_get(Hash *h, const void *key) {
 	size_t i;
 	if(!h->n) return 0;
-	i = hash_mod(h, key);
-	for(;;) {
-		if(!(h->set[i/8] & (1<<(i % 8)))) return 0;
-		if(h->equals(key, &h->keys[i*h->n_key], h->n_key))
-			return &h->values[i*h->n_value];
-		if(++i == h->n_table) i = 0;
-	}
+	i = hash_find(h, key, hash_hash(h, key));
+	return h->hashes[i] ? &h->values[i*h->n_value] : 0;
 }
 
 HASH_API void*
 hash_value(Hash *h, size_t i) {
-	if(h->set[i/8] & (1<<(i%8))) return &h->values[i*h->n_value];
+	if(h->hashes[i]) return &h->values[i*h->n_value];
 	return 0;
 }
 HASH_API void*
 hash_key(Hash *h, size_t i) {
-	if(h->set[i/8] & (1<<(i%8))) return &h->values[i*h->n_key];
+	if(h->hashes[i]) return &h->keys[i*h->n_key];
 	return 0;
 }
 
@@ -176,25 +233,25 @@ hash_get_copy(Hash *h, const void *key, void *value) {
 
 HASH_API int
 hash_del(Hash *h, const void *key) {
-	size_t j,w,i = hash_mod(h, key);
-	for(;;) {
-		if(!(h->set[i/8] & (1<<(i % 8)))) return 0;
-		if(h->equals(key, &h->keys[i*h->n_key], h->n_key)) break;
-		if(++i == h->n_table) i = 0;
-	}
-	j=i;
+	size_t j, w, i;
+	if(!h->n) return 0;
+	i = hash_find(h, key, hash_hash(h, key));
+	if(!h->hashes[i]) return 0;
+	j = i;
 	for(;;) {
-		memset(&h->keys[i*h->n_key], 0, h->n_key);
-		h->set[i/8] &= ~(1 << (i%8));
+		h->hashes[i] = 0;
 	next:
 		if(++j == h->n_table) j = 0;
-		if(!(h->set[j/8] & (1<<(j % 8)))) break;
-		w = hash_mod(h, &h->keys[j*h->n_key]);
+		if(!h->hashes[j]) break;
+		w = h->hashes[j] >> h->shift;
 		/* check if w already in (i, j]. if so skip moving it */
 		if((i<=j) ? (i<w && w<=j) : (i<w || w<=j)) goto next;
+		h->hashes[i] = h->hashes[j];
 		memcpy(&h->keys[i*h->n_key], &h->keys[j*h->n_key], h->n_key);
+		memcpy(&h->values[i*h->n_value], &h->values[j*h->n_value], h->n_value);
 		i = j;
 	}
+	--h->n;
 	return 1;
 }
 
@@ -202,7 +259,7 @@ HASH_API void
 hash_destroy(Hash *h) {
 	free(h->keys);
 	free(h->values);
-	free(h->set);
+	free(h->hashes);
 }
 
 #endif
@@ -220,22 +277,49 @@ int main(int argc, char **argv) {
 	hash_init(&hash, sizeof(int), sizeof(int), hash_i32, hash_equals_i32);
 	int j, found, *keys = (int*)malloc(SIZE * sizeof(int));
 	for(int i=0;i<SIZE;i++) keys[i] = rand();
+	/* rand repeats so count distinct keys by what the table holds */
 	for(int i=0;i<SIZE;i++) hash_put(&hash, &keys[i], &keys[i]);
 	for(int i=0;i<SIZE;i++) {
 		assert(hash_get_copy(&hash, &keys[i], &j));
 		assert(j == keys[i]);
 	}
+	found = 0;
+	for(size_t i=0;i<hash.n_table;i++) {
+		int *k = (int*)hash_key(&hash, i), *v = (int*)hash_value(&hash, i);
+		if(!k) continue;
+		assert(*k == *v);
+		++found;
+	}
+	assert((size_t)found == hash.n);
+	/* deletes half then the rest still have their values */
+	for(int i=0;i<SIZE;i+=2) hash_del(&hash, &keys[i]);
+	for(int i=1;i<SIZE;i+=2) {
+		int k = 0;
+		if(hash_get_copy(&hash, &keys[i], &j)) {
+			assert(j == keys[i]);
+			continue;
+		}
+		/* only missing if it was a repeat of a deleted key */
+		while(k < SIZE && keys[k] != keys[i]) k += 2;
+		assert(k < SIZE);
+	}
 	for(int i=0;i<SIZE;i++) hash_del(&hash, &keys[i]);
 	for(int i=0;i<SIZE;i++)
 		assert(!hash_get_copy(&hash, &keys[i], &j));
-
-	found = 0;
-	for(size_t i=0;i<hash.n;i++) {
-		int *p = hash_value(&hash, i);
-		if(p) ++found;
-	}
+	assert(hash.n == 0);
 	printf("found %d\n", found);
 	hash_destroy(&hash);
+
+	/* runtime sized keys through the function pointers */
+	const char *words[] = {"one", "two", "three"};
+	hash_init(&hash, sizeof(char*), sizeof(int), hash_string, hash_equals_string);
+	for(int i=0;i<3;i++) hash_put(&hash, &words[i], &i);
+	char two[] = "two";
+	const char *key = two;
+	assert(hash_get_copy(&hash, &key, &j) && j == 1);
+	assert(hash_del(&hash, &key) && !hash_get(&hash, &key) && hash.n == 2);
+	hash_destroy(&hash);
+	free(keys);
 	return 0;
 }
 
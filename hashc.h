@@ -0,0 +1,397 @@
+#ifndef HASHC_H
+#define HASHC_H
+
+/* Concurrent generic hashmap. Same array chained layout as hashg.h split
+ * into lock striped shards picked by the top bits of the hash.
+ *
+ * get never locks or writes shared memory. entries are published with a
+ * release store of the chain head and never change after that, and a grow
+ * builds a new table then swaps a pointer to it. a reader holding the old
+ * table keeps reading valid memory because replaced tables are kept until
+ * hashc_reclaim or destroy (less than the live table since each doubles).
+ * put takes the shard spinlock. keys cannot be removed or values replaced,
+ * put returns 0 if the key exists like hashg.h.
+ *
+ * name##_build inserts many keys at once on the threadpool.h pool: hashes
+ * and a counting sort by shard in parallel, then one task fills each shard.
+ * needs gcc or clang for __atomic builtins */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+#include "hashg.h"
+#ifdef HASHC_EXAMPLE
+#define THREADPOOL_STATIC
+#endif
+#include "threadpool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* spins before a waiting put yields the cpu */
+#define HASHC_SPIN 64
+/* tasks for the hash and scatter passes of name##_build */
+#define HASHC_CHUNKS 64
+
+static void hashc_lock(int *lock) {
+	for(;;) {
+		for(int i=0;i<HASHC_SPIN;i++)
+			if(!__atomic_load_n(lock, __ATOMIC_RELAXED) && !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+				return;
+#ifdef _WIN32
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+}
+
+static void hashc_unlock(int *lock) {
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#define HASHC_DECLARE(name, TKEY, TVALUE, HASH, EQUALS) \
+typedef struct { \
+	TKEY key; \
+	TVALUE value; \
+	size_t next; /* entry index + 1. 0 ends the chain */ \
+} name##Entry;\
+typedef struct name##Table { \
+	size_t *buckets; /* entry index + 1. 0 for none */ \
+	name##Entry *entries; \
+	size_t mask; /* buckets - 1. power of 2 */ \
+	struct name##Table *retired; /* replaced by this one */ \
+} name##Table; \
+typedef struct { \
+	name##Table *table; \
+	size_t n; \
+	int lock; \
+	char pad[64 - sizeof(void*) - sizeof(size_t) - sizeof(int)]; \
+} name##Shard; \
+typedef struct { \
+	name##Shard *shards; \
+	size_t nshards; \
+	int shift; /* hash >> shift is the shard */ \
+} name; \
+static name##Table* \
+name##_table(size_t capacity) { \
+	size_t size = 16; \
+	while(size * 90 / 128 < capacity) size *= 2; \
+	name##Table *t = (name##Table*)calloc(1, sizeof *t); \
+	t->entries = (name##Entry*)malloc(size * 90 / 128 * sizeof(name##Entry)); \
+	t->buckets = (size_t*)calloc(size, sizeof(size_t)); \
+	t->mask = size - 1; \
+	return t; \
+} \
+static void \
+name##_free_tables(name##Table *t) { \
+	while(t) { \
+		name##Table *next = t->retired; \
+		free(t->buckets); \
+		free(t->entries); \
+		free(t); \
+		t = next; \
+	} \
+} \
+/* shards is rounded up to a power of 2. 0 for 64. n is the expected count */ \
+static void \
+name##_init(name *h, size_t shards, size_t n) { \
+	size_t bits = 0; \
+	if(!shards) shards = 64; \
+	while(((size_t)1 << bits) < shards) bits++; \
+	h->nshards = (size_t)1 << bits; \
+	h->shift = (int)(sizeof(size_t) * 8 - bits); \
+	h->shards = (name##Shard*)calloc(h->nshards, sizeof(name##Shard)); \
+	for(size_t i=0;i<h->nshards;i++) \
+		h->shards[i].table = name##_table(n / h->nshards); \
+} \
+static void \
+name##_destroy(name *h) { \
+	for(size_t i=0;i<h->nshards;i++) name##_free_tables(h->shards[i].table); \
+	free(h->shards); \
+	memset(h, 0, sizeof *h); \
+} \
+/* free replaced tables. only while no other thread is in get */ \
+static void \
+name##_reclaim(name *h) { \
+	for(size_t i=0;i<h->nshards;i++) { \
+		name##Table *t = h->shards[i].table; \
+		name##_free_tables(t->retired); \
+		t->retired = 0; \
+	} \
+} \
+static name##Shard* \
+name##_shard(name *h, size_t hash) { \
+	return &h->shards[h->nshards > 1 ? hash >> h->shift : 0]; \
+} \
+/* called with the lock held. builds the bigger table before publishing it */ \
+static void \
+name##_grow(name##Shard *s, size_t capacity) { \
+	name##Table *old = s->table; \
+	if(capacity <= (old->mask + 1) * 90 / 128) return; \
+	name##Table *t = name##_table(capacity); \
+	memcpy(t->entries, old->entries, s->n * sizeof(name##Entry)); \
+	for(size_t i=0;i<s->n;i++) { \
+		size_t *b = &t->buckets[HASH(t->entries[i].key) & t->mask]; \
+		t->entries[i].next = *b; \
+		*b = i + 1; \
+	} \
+	t->retired = old; \
+	__atomic_store_n(&s->table, t, __ATOMIC_RELEASE); \
+} \
+static int \
+name##_insert(name##Shard *s, size_t hash, TKEY key, TVALUE value) { \
+	name##Table *t = s->table; \
+	size_t idx = t->buckets[hash & t->mask]; \
+	while(idx) { \
+		name##Entry *e = &t->entries[idx - 1]; \
+		if(EQUALS(e->key, key)) return 0; \
+		idx = e->next; \
+	} \
+	if(s->n >= (t->mask + 1) * 90 / 128) { \
+		name##_grow(s, s->n * 2); \
+		t = s->table; \
+	} \
+	size_t *b = &t->buckets[hash & t->mask], n = s->n; \
+	name##Entry *e = &t->entries[n]; \
+	e->key = key; \
+	e->value = value; \
+	e->next = *b; \
+	__atomic_store_n(b, n + 1, __ATOMIC_RELEASE); \
+	__atomic_store_n(&s->n, n + 1, __ATOMIC_RELAXED); \
+	return 1; \
+} \
+/* return 0 on already exists. 1 on added */ \
+static int \
+name##_put(name *h, TKEY key, TVALUE value) { \
+	size_t hash = HASH(key); \
+	name##Shard *s = name##_shard(h, hash); \
+	hashc_lock(&s->lock); \
+	int rc = name##_insert(s, hash, key, value); \
+	hashc_unlock(&s->lock); \
+	return rc; \
+} \
+/* return 0 on missing. copies the value to *value if not null */ \
+static int \
+name##_get(name *h, TKEY key, TVALUE *value) { \
+	size_t hash = HASH(key); \
+	name##Table *t = __atomic_load_n(&name##_shard(h, hash)->table, __ATOMIC_ACQUIRE); \
+	size_t idx = __atomic_load_n(&t->buckets[hash & t->mask], __ATOMIC_ACQUIRE); \
+	while(idx) { \
+		name##Entry *e = &t->entries[idx - 1]; \
+		if(EQUALS(e->key, key)) { \
+			if(value) *value = e->value; \
+			return 1; \
+		} \
+		idx = e->next; \
+	} \
+	return 0; \
+} \
+/* approximate while puts run */ \
+static size_t \
+name##_count(name *h) { \
+	size_t n = 0; \
+	for(size_t i=0;i<h->nshards;i++) n += __atomic_load_n(&h->shards[i].n, __ATOMIC_RELAXED); \
+	return n; \
+} \
+typedef struct { \
+	name *h; \
+	TKEY const *keys; \
+	TVALUE const *values; \
+	size_t n, chunks; \
+	size_t *hashes, *counts, *order; /* counts is chunks per shard */ \
+	size_t added; \
+} name##Build; \
+static void \
+name##_build_hash(void *ctx, size_t begin, size_t end) { \
+	name##Build *b = (name##Build*)ctx; \
+	for(size_t c=begin;c<end;c++) { \
+		size_t *counts = &b->counts[c * b->h->nshards]; \
+		for(size_t i=c*b->n/b->chunks;i<(c+1)*b->n/b->chunks;i++) { \
+			b->hashes[i] = HASH(b->keys[i]); \
+			counts[name##_shard(b->h, b->hashes[i]) - b->h->shards]++; \
+		} \
+	} \
+} \
+static void \
+name##_build_scatter(void *ctx, size_t begin, size_t end) { \
+	name##Build *b = (name##Build*)ctx; \
+	for(size_t c=begin;c<end;c++) { \
+		size_t *offsets = &b->counts[c * b->h->nshards]; \
+		for(size_t i=c*b->n/b->chunks;i<(c+1)*b->n/b->chunks;i++) \
+			b->order[offsets[name##_shard(b->h, b->hashes[i]) - b->h->shards]++] = i; \
+	} \
+} \
+static void \
+name##_build_shards(void *ctx, size_t begin, size_t end) { \
+	name##Build *b = (name##Build*)ctx; \
+	size_t added = 0, shards = b->h->nshards; \
+	TVALUE zero; \
+	memset(&zero, 0, sizeof zero); \
+	for(size_t s=begin;s<end;s++) { \
+		/* scatter left offsets at the end of each chunk's run */ \
+		size_t first = s ? b->counts[(b->chunks - 1) * shards + s - 1] : 0; \
+		size_t last = b->counts[(b->chunks - 1) * shards + s]; \
+		name##Shard *shard = &b->h->shards[s]; \
+		hashc_lock(&shard->lock); \
+		name##_grow(shard, shard->n + last - first); \
+		for(size_t i=first;i<last;i++) { \
+			size_t k = b->order[i]; \
+			added += name##_insert(shard, b->hashes[k], b->keys[k], b->values ? b->values[k] : zero); \
+		} \
+		hashc_unlock(&shard->lock); \
+	} \
+	__atomic_fetch_add(&b->added, added, __ATOMIC_RELAXED); \
+} \
+/* put n keys on the threadpool.h pool. values may be null for zeroed values. \
+   safe with concurrent puts and gets. return the number added */ \
+static size_t \
+name##_build(name *h, TKEY const *keys, TVALUE const *values, size_t n) { \
+	name##Build b; \
+	size_t shards = h->nshards, sum = 0; \
+	memset(&b, 0, sizeof b); \
+	b.h = h; \
+	b.keys = keys; \
+	b.values = values; \
+	b.n = n; \
+	b.chunks = n < HASHC_CHUNKS * 1024 ? 1 : HASHC_CHUNKS; \
+	b.hashes = (size_t*)malloc(n * sizeof(size_t)); \
+	b.order = (size_t*)malloc(n * sizeof(size_t)); \
+	b.counts = (size_t*)calloc(b.chunks * shards, sizeof(size_t)); \
+	threadpool_for(0, b.chunks, 1, name##_build_hash, &b); \
+	/* counts become where each chunk starts writing each shard */ \
+	for(size_t s=0;s<shards;s++) \
+		for(size_t c=0;c<b.chunks;c++) { \
+			size_t count = b.counts[c * shards + s]; \
+			b.counts[c * shards + s] = sum; \
+			sum += count; \
+		} \
+	threadpool_for(0, b.chunks, 1, name##_build_scatter, &b); \
+	threadpool_for(0, shards, 1, name##_build_shards, &b); \
+	free(b.hashes); \
+	free(b.order); \
+	free(b.counts); \
+	return b.added; \
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef HASHC_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+#include "thread.h"
+#include "now.h"
+
+HASHC_DECLARE(inthash, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHG_DECLARE(lockhash, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+
+#define KEYS (1 << 20)
+#define OPS (1 << 22)
+
+/* what workers did before: hashg behind one mutex */
+static lockhash locked;
+static mtx_t lock;
+static inthash map;
+static int *keys;
+
+typedef struct Bench {
+	thrd_t thread;
+	int id, threads, concurrent;
+	size_t found;
+} Bench;
+
+/* read mostly. 1 in 16 operations puts a new key */
+static int bench(void *ctx) {
+	Bench *b = (Bench*)ctx;
+	size_t ops = OPS / b->threads, seed = (size_t)b->id * 7919 + 1;
+	for(size_t i=0;i<ops;i++) {
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		int k = keys[(seed >> 33) % KEYS], v;
+		if((i & 15) == 15) {
+			k = -(int)(b->id * ops + i) - 1;
+			if(b->concurrent) inthash_put(&map, k, k);
+			else {
+				mtx_lock(&lock);
+				lockhash_put(&locked, k, k);
+				mtx_unlock(&lock);
+			}
+		} else if(b->concurrent) {
+			b->found += inthash_get(&map, k, &v) && v == k;
+		} else {
+			mtx_lock(&lock);
+			int *p = lockhash_get(&locked, k);
+			b->found += p && *p == k;
+			mtx_unlock(&lock);
+		}
+	}
+	return 0;
+}
+
+static double run(int threads, int concurrent) {
+	Bench b[64];
+	size_t found = 0;
+	double t = now();
+	for(int i=0;i<threads;i++) {
+		b[i].id = i;
+		b[i].threads = threads;
+		b[i].concurrent = concurrent;
+		b[i].found = 0;
+		thrd_create(&b[i].thread, bench, &b[i]);
+	}
+	for(int i=0;i<threads;i++) {
+		thrd_join(b[i].thread, 0);
+		found += b[i].found;
+	}
+	t = now() - t;
+	assert(found == (size_t)(OPS / threads) * threads / 16 * 15);
+	return OPS / t / 1e6;
+}
+
+int main(int argc, char **argv) {
+	keys = (int*)malloc(KEYS * sizeof(int));
+	for(int i=0;i<KEYS;i++) keys[i] = i * 2654435761u & 0x7FFFFFFF;
+
+	/* bulk build then every key reads back */
+	inthash_init(&map, 0, 0);
+	double t = now();
+	assert(inthash_build(&map, keys, keys, KEYS) == KEYS);
+	printf("build %d keys in %f\n", KEYS, now() - t);
+	assert(inthash_count(&map) == KEYS);
+	assert(inthash_build(&map, keys, 0, 1000) == 0);
+	for(int i=0;i<KEYS;i++) {
+		int v;
+		assert(inthash_get(&map, keys[i], &v) && v == keys[i]);
+	}
+	assert(!inthash_get(&map, -1, 0));
+	assert(inthash_put(&map, -1, 5) && !inthash_put(&map, -1, 6));
+	inthash_reclaim(&map);
+
+	lockhash_init(&locked, KEYS);
+	for(int i=0;i<KEYS;i++) lockhash_put(&locked, keys[i], keys[i]);
+	mtx_init(&lock, mtx_plain);
+
+	printf("threads  mutex+hashg Mops/s  hashc Mops/s\n");
+	for(int threads=1;threads<=64;threads*=2) {
+		double a = run(threads, 0), b = run(threads, 1);
+		printf("%7d  %18.1f  %12.1f\n", threads, a, b);
+	}
+	assert(inthash_count(&map) > KEYS);
+
+	inthash_destroy(&map);
+	lockhash_destroy(&locked);
+	mtx_destroy(&lock);
+	free(keys);
+	return 0;
+}
+#endif
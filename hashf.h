@@ -0,0 +1,576 @@
+#ifndef HASHF_H
+#define HASHF_H
+
+/* Frozen read-only images of hashg.h maps. save writes the buckets and
+ * entries of a map as they are (hashg links entries by index so nothing
+ * needs fixing up) plus a string arena for string keys. open maps the file
+ * and gets probe it in place, so loading costs one mmap however big the map
+ * is. pages are read in on first touch.
+ *
+ * images hold the hashg entry structs byte for byte. they can be opened
+ * by builds with the same key and value layout, byte order and HASH (so a
+ * fixed HASHFN_SEED). open checks the layout and that the first key still
+ * hashes the same. keys and values must not hold pointers except string
+ * keys through HASHF_STRING_DECLARE.
+ *
+ * load and open check that the header fits the image but do not read the
+ * buckets or entries, which would touch every page. an image from
+ * anywhere untrusted must pass fname##_verify before the first get, or a
+ * bad index can read outside it or a looped chain never end.
+ *
+ * HASHF_DECLARE(fname, gname, TKEY, TVALUE, HASH, EQUALS) for a map made
+ * with HASHG_DECLARE(gname, TKEY, TVALUE, HASH, EQUALS).
+ * HASHF_STRING_DECLARE(fname, gname, TVALUE, HASH, EQUALS) for one with
+ * const char* keys, given the same HASH and EQUALS. see example and license (public domain) at end of file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "hashg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HASHF_MAGIC "HASHF01"
+#define HASHF_ORDER 0x0102030405060708ull
+
+/* offsets are from the start of the image and 64 byte aligned */
+typedef struct HashfHeader {
+	char magic[8];
+	uint64_t order; /* HASHF_ORDER in the writer's byte order */
+	uint64_t entry_size, key_size, value_size;
+	uint64_t capacity, n;
+	uint64_t buckets, entries, arena, size;
+	uint64_t check; /* HASH of the first key */
+} HashfHeader;
+
+/* a mapped file or a caller owned buffer */
+typedef struct HashfImage {
+	const char *base;
+	size_t size;
+	int mapped;
+} HashfImage;
+
+/* writes to a file or grows a malloc buffer */
+typedef struct HashfOut {
+	FILE *f;
+	char *buf;
+	size_t n, cap;
+	int err;
+} HashfOut;
+
+static void hashf_out(HashfOut *o, const void *p, size_t n) {
+	if(o->err || !n) return;
+	if(o->f) {
+		o->err = fwrite(p, 1, n, o->f) != n;
+		o->n += n;
+		return;
+	}
+	if(o->n + n > o->cap) {
+		size_t cap = o->cap ? o->cap : 4096;
+		while(cap < o->n + n) cap *= 2;
+		char *buf = (char*)realloc(o->buf, cap);
+		if(!buf) {
+			o->err = 1;
+			return;
+		}
+		o->buf = buf;
+		o->cap = cap;
+	}
+	memcpy(o->buf + o->n, p, n);
+	o->n += n;
+}
+
+/* zero fill up to offset */
+static void hashf_pad(HashfOut *o, size_t offset) {
+	static const char zero[64] = {0};
+	while(!o->err && o->n < offset) hashf_out(o, zero, offset - o->n < 64 ? offset - o->n : 64);
+}
+
+static size_t hashf_align(size_t n) {
+	return (n + 63) & ~(size_t)63;
+}
+
+/* fills offsets and size of h from its counts and sizes */
+static void hashf_layout(HashfHeader *h, size_t arena_size) {
+	memcpy(h->magic, HASHF_MAGIC, 8);
+	h->order = HASHF_ORDER;
+	h->buckets = hashf_align(sizeof *h);
+	h->entries = hashf_align(h->buckets + h->capacity * sizeof(size_t));
+	h->arena = hashf_align(h->entries + h->n * h->entry_size);
+	h->size = h->arena + arena_size;
+}
+
+/* header if image has the given layout else 0. sizes are compared by
+   dividing what is left so no product can wrap */
+static const HashfHeader* hashf_header(const HashfImage *image, size_t entry_size, size_t key_size, size_t value_size) {
+	const HashfHeader *h = (const HashfHeader*)image->base;
+	if(!h || image->size < sizeof *h || ((uintptr_t)h & 7)) return 0;
+	if(memcmp(h->magic, HASHF_MAGIC, 8) || h->order != HASHF_ORDER) return 0;
+	if(h->entry_size != entry_size || h->key_size != key_size || h->value_size != value_size) return 0;
+	if(h->size > image->size || !h->capacity || h->n > h->capacity) return 0;
+	if((h->buckets | h->entries | h->arena) & 63 || h->buckets < sizeof *h) return 0;
+	if(h->buckets > h->size || h->capacity > (h->size - h->buckets) / sizeof(size_t)) return 0;
+	if(h->entries < h->buckets + h->capacity * sizeof(size_t) || h->entries > h->size) return 0;
+	if(h->n > (h->size - h->entries) / entry_size) return 0;
+	if(h->arena < h->entries + h->n * entry_size || h->arena > h->size) return 0;
+	return h;
+}
+
+/* return 0 on success. < 0 if the file cannot be mapped */
+static int hashf_map(HashfImage *image, const char *path) {
+	memset(image, 0, sizeof *image);
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	LARGE_INTEGER size;
+	if(file == INVALID_HANDLE_VALUE) return -1;
+	if(!GetFileSizeEx(file, &size) || !size.QuadPart) {
+		CloseHandle(file);
+		return -1;
+	}
+	HANDLE map = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+	if(!map) return -1;
+	/* the view keeps the mapping alive */
+	image->base = (const char*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(map);
+	if(!image->base) return -1;
+	image->size = (size_t)size.QuadPart;
+#else
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return -1;
+	if(fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+	void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return -1;
+	image->base = (const char*)p;
+	image->size = (size_t)st.st_size;
+#endif
+	image->mapped = 1;
+	return 0;
+}
+
+static void hashf_unmap(HashfImage *image) {
+	if(image->mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(image->base);
+#else
+		munmap((void*)image->base, image->size);
+#endif
+	}
+	memset(image, 0, sizeof *image);
+}
+
+#define HASHF_DECLARE(fname, gname, TKEY, TVALUE, HASH, EQUALS) \
+typedef struct { \
+	HashfImage image; \
+	const size_t *buckets; /* entry index + 1. 0 for none */ \
+	const gname##Entry *entries; \
+	size_t capacity, n; \
+} fname; \
+static int \
+fname##_write(gname *h, HashfOut *out) { \
+	HashfHeader header; \
+	if(h->old) gname##_migrate(h, SIZE_MAX); \
+	memset(&header, 0, sizeof header); \
+	header.entry_size = sizeof(gname##Entry); \
+	header.key_size = sizeof(TKEY); \
+	header.value_size = sizeof(TVALUE); \
+	header.capacity = h->capacity; \
+	header.n = h->n; \
+	header.check = h->n ? (uint64_t)HASH(h->entries[0].key) : 0; \
+	hashf_layout(&header, 0); \
+	hashf_out(out, &header, sizeof header); \
+	hashf_pad(out, header.buckets); \
+	hashf_out(out, h->buckets, h->capacity * sizeof(size_t)); \
+	hashf_pad(out, header.entries); \
+	hashf_out(out, h->entries, h->n * sizeof(gname##Entry)); \
+	hashf_pad(out, header.size); \
+	return out->err ? -1 : 0; \
+} \
+/* return 0 on success. < 0 on write error */ \
+static int \
+fname##_save(gname *h, const char *path) { \
+	HashfOut out; \
+	memset(&out, 0, sizeof out); \
+	if(!(out.f = fopen(path, "wb"))) return -1; \
+	int rc = fname##_write(h, &out); \
+	if(fclose(out.f)) rc = -1; \
+	return rc; \
+} \
+/* image in memory for fname##_load. free result */ \
+static void* \
+fname##_freeze(gname *h, size_t *size) { \
+	HashfOut out; \
+	memset(&out, 0, sizeof out); \
+	if(fname##_write(h, &out)) { \
+		free(out.buf); \
+		return 0; \
+	} \
+	*size = out.n; \
+	return out.buf; \
+} \
+/* use image in place. it must stay alive and 8 byte aligned. \
+   return 0 on success. < 0 if it is not an image of this map */ \
+static int \
+fname##_load(fname *f, const void *image, size_t size) { \
+	const HashfHeader *h; \
+	memset(f, 0, sizeof *f); \
+	f->image.base = (const char*)image; \
+	f->image.size = size; \
+	if(!(h = hashf_header(&f->image, sizeof(gname##Entry), sizeof(TKEY), sizeof(TVALUE)))) return -1; \
+	f->buckets = (const size_t*)(f->image.base + h->buckets); \
+	f->entries = (const gname##Entry*)(f->image.base + h->entries); \
+	f->capacity = (size_t)h->capacity; \
+	f->n = (size_t)h->n; \
+	if(f->n && (uint64_t)HASH(f->entries[0].key) != h->check) return -1; \
+	return 0; \
+} \
+/* return 0 on success. < 0 on error */ \
+static int \
+fname##_open(fname *f, const char *path) { \
+	HashfImage image; \
+	if(hashf_map(&image, path)) return -1; \
+	if(fname##_load(f, image.base, image.size)) { \
+		hashf_unmap(&image); \
+		memset(f, 0, sizeof *f); \
+		return -2; \
+	} \
+	f->image.mapped = 1; \
+	return 0; \
+} \
+static void \
+fname##_close(fname *f) { \
+	hashf_unmap(&f->image); \
+	memset(f, 0, sizeof *f); \
+} \
+/* return 0 on missing */ \
+static const TVALUE* \
+fname##_get(const fname *f, TKEY key) { \
+	if(!f->capacity) return 0; \
+	size_t idx = f->buckets[HASH(key) % f->capacity]; \
+	while(idx) { \
+		const gname##Entry *e = &f->entries[idx - 1]; \
+		if(EQUALS(e->key, key)) return &e->value; \
+		idx = e->next; \
+	} \
+	return 0; \
+} \
+/* walk every chain of an untrusted image. each entry must be reached \
+   once, from the bucket its key hashes to. return 0 if it is sound */ \
+static int \
+fname##_verify(const fname *f) { \
+	size_t seen = 0; \
+	for(size_t b=0;b<f->capacity;b++) \
+		for(size_t idx=f->buckets[b];idx;idx=f->entries[idx - 1].next) \
+			if(idx > f->n || ++seen > f->n || (size_t)(HASH(f->entries[idx - 1].key) % f->capacity) != b) return -1; \
+	return seen == f->n ? 0 : -1; \
+}
+
+/* keys are offsets into the arena of zero terminated strings */
+#define HASHF_STRING_DECLARE(fname, gname, TVALUE, HASH, EQUALS) \
+typedef struct { \
+	TVALUE value; \
+	size_t next; /* entry index + 1. 0 ends the chain */ \
+	uint64_t key, len; \
+} fname##Entry; \
+typedef struct { \
+	HashfImage image; \
+	const size_t *buckets; \
+	const fname##Entry *entries; \
+	const char *arena; \
+	size_t capacity, n, narena; \
+} fname; \
+/* key of entry i lies in the arena and ends at its terminator. 0 if so */ \
+static int \
+fname##_span(const fname *f, size_t i) { \
+	const fname##Entry *e = &f->entries[i]; \
+	if(e->key >= f->narena || e->len >= f->narena - e->key) return -1; \
+	return f->arena[e->key + e->len] || memchr(f->arena + e->key, 0, (size_t)e->len) ? -1 : 0; \
+} \
+static int \
+fname##_write(gname *h, HashfOut *out) { \
+	HashfHeader header; \
+	fname##Entry batch[256]; \
+	size_t arena = 0, i, j; \
+	if(h->old) gname##_migrate(h, SIZE_MAX); \
+	for(i=0;i<h->n;i++) arena += strlen(h->entries[i].key) + 1; \
+	memset(&header, 0, sizeof header); \
+	header.entry_size = sizeof(fname##Entry); \
+	header.value_size = sizeof(TVALUE); \
+	header.capacity = h->capacity; \
+	header.n = h->n; \
+	header.check = h->n ? (uint64_t)HASH(h->entries[0].key) : 0; \
+	hashf_layout(&header, arena); \
+	hashf_out(out, &header, sizeof header); \
+	hashf_pad(out, header.buckets); \
+	hashf_out(out, h->buckets, h->capacity * sizeof(size_t)); \
+	hashf_pad(out, header.entries); \
+	memset(batch, 0, sizeof batch); \
+	for(i=0,arena=0;i<h->n;) { \
+		for(j=0;j<256 && i<h->n;j++,i++) { \
+			batch[j].value = h->entries[i].value; \
+			batch[j].next = h->entries[i].next; \
+			batch[j].key = arena; \
+			batch[j].len = strlen(h->entries[i].key); \
+			arena += batch[j].len + 1; \
+		} \
+		hashf_out(out, batch, j * sizeof(fname##Entry)); \
+	} \
+	hashf_pad(out, header.arena); \
+	for(i=0;i<h->n;i++) hashf_out(out, h->entries[i].key, strlen(h->entries[i].key) + 1); \
+	return out->err ? -1 : 0; \
+} \
+static int \
+fname##_save(gname *h, const char *path) { \
+	HashfOut out; \
+	memset(&out, 0, sizeof out); \
+	if(!(out.f = fopen(path, "wb"))) return -1; \
+	int rc = fname##_write(h, &out); \
+	if(fclose(out.f)) rc = -1; \
+	return rc; \
+} \
+static void* \
+fname##_freeze(gname *h, size_t *size) { \
+	HashfOut out; \
+	memset(&out, 0, sizeof out); \
+	if(fname##_write(h, &out)) { \
+		free(out.buf); \
+		return 0; \
+	} \
+	*size = out.n; \
+	return out.buf; \
+} \
+static int \
+fname##_load(fname *f, const void *image, size_t size) { \
+	const HashfHeader *h; \
+	memset(f, 0, sizeof *f); \
+	f->image.base = (const char*)image; \
+	f->image.size = size; \
+	if(!(h = hashf_header(&f->image, sizeof(fname##Entry), 0, sizeof(TVALUE)))) return -1; \
+	f->buckets = (const size_t*)(f->image.base + h->buckets); \
+	f->entries = (const fname##Entry*)(f->image.base + h->entries); \
+	f->arena = f->image.base + h->arena; \
+	f->capacity = (size_t)h->capacity; \
+	f->n = (size_t)h->n; \
+	f->narena = (size_t)(h->size - h->arena); \
+	if(f->n && (fname##_span(f, 0) || (uint64_t)HASH(f->arena + f->entries[0].key) != h->check)) return -1; \
+	return 0; \
+} \
+static int \
+fname##_open(fname *f, const char *path) { \
+	HashfImage image; \
+	if(hashf_map(&image, path)) return -1; \
+	if(fname##_load(f, image.base, image.size)) { \
+		hashf_unmap(&image); \
+		memset(f, 0, sizeof *f); \
+		return -2; \
+	} \
+	f->image.mapped = 1; \
+	return 0; \
+} \
+static void \
+fname##_close(fname *f) { \
+	hashf_unmap(&f->image); \
+	memset(f, 0, sizeof *f); \
+} \
+/* key of entry i. points into the image */ \
+static const char* \
+fname##_key(const fname *f, size_t i) { \
+	return f->arena + f->entries[i].key; \
+} \
+static const TVALUE* \
+fname##_get(const fname *f, const char *key) { \
+	if(!f->capacity) return 0; \
+	size_t idx = f->buckets[HASH(key) % f->capacity]; \
+	while(idx) { \
+		const fname##Entry *e = &f->entries[idx - 1]; \
+		if(EQUALS(f->arena + e->key, key)) return &e->value; \
+		idx = e->next; \
+	} \
+	return 0; \
+} \
+/* fname##_verify of HASHF_DECLARE plus every key span */ \
+static int \
+fname##_verify(const fname *f) { \
+	size_t seen = 0; \
+	for(size_t i=0;i<f->n;i++) if(fname##_span(f, i)) return -1; \
+	for(size_t b=0;b<f->capacity;b++) \
+		for(size_t idx=f->buckets[b];idx;idx=f->entries[idx - 1].next) \
+			if(idx > f->n || ++seen > f->n || (size_t)(HASH(f->arena + f->entries[idx - 1].key) % f->capacity) != b) return -1; \
+	return seen == f->n ? 0 : -1; \
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef HASHF_EXAMPLE
+#include <assert.h>
+#include "now.h"
+#define SIZE (4*1000*1000)
+
+HASHG_DECLARE(inthash, int, double, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHF_DECLARE(intfrozen, inthash, int, double, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHG_DECLARE(strhash, const char*, int, HASHG_STRING_HASH, HASHG_STRING_EQUALS)
+HASHF_STRING_DECLARE(strfrozen, strhash, int, HASHG_STRING_HASH, HASHG_STRING_EQUALS)
+HASHG_DECLARE(casehash, const char*, int, HASHG_STRING_LOWER_HASH, HASHG_STRING_LOWER_EQUALS)
+HASHF_STRING_DECLARE(casefrozen, casehash, int, HASHG_STRING_LOWER_HASH, HASHG_STRING_LOWER_EQUALS)
+
+int main(int argc, char **argv) {
+	const char *path = "hashf_example.bin";
+	inthash h;
+	intfrozen f;
+	double t = now();
+	inthash_init(&h, 0);
+	for(int i=0;i<SIZE;i++) inthash_put(&h, i * 7, i * 0.5);
+	printf("build %d in %f\n", SIZE, now() - t);
+	t = now();
+	assert(!intfrozen_save(&h, path));
+	printf("save in %f\n", now() - t);
+
+	t = now();
+	assert(!intfrozen_open(&f, path));
+	printf("open in %f\n", now() - t);
+	t = now();
+	for(int i=0;i<SIZE;i++) {
+		const double *v = intfrozen_get(&f, i * 7);
+		assert(v && *v == i * 0.5);
+	}
+	assert(!intfrozen_get(&f, 1) && !intfrozen_get(&f, -7));
+	printf("get from image in %f\n", now() - t);
+	intfrozen_close(&f);
+
+	/* in memory. a different layout does not load */
+	size_t size;
+	void *image = intfrozen_freeze(&h, &size);
+	assert(image && !intfrozen_load(&f, image, size));
+	assert(*intfrozen_get(&f, 70) == 5);
+	assert(!intfrozen_verify(&f));
+
+	/* corrupt images. a capacity whose bucket bytes wrap to 8 */
+	HashfHeader *hd = (HashfHeader*)image;
+	uint64_t capacity = hd->capacity;
+	hd->capacity = ((uint64_t)1 << 61) + 1;
+	assert(intfrozen_load(&f, image, size) < 0);
+	hd->capacity = capacity;
+	hd->entries += 8;
+	assert(intfrozen_load(&f, image, size) < 0);
+	hd->entries -= 8;
+	/* loads but an index or chain is bad */
+	size_t *buckets = (size_t*)((char*)image + hd->buckets), b = 0;
+	inthashEntry *entries = (inthashEntry*)((char*)image + hd->entries);
+	while(!buckets[b]) b++;
+	size_t head = buckets[b];
+	buckets[b] = (size_t)hd->n + 1;
+	assert(!intfrozen_load(&f, image, size) && intfrozen_verify(&f));
+	buckets[b] = head;
+	size_t next = entries[head - 1].next;
+	entries[head - 1].next = head;
+	assert(!intfrozen_load(&f, image, size) && intfrozen_verify(&f));
+	entries[head - 1].next = next;
+	buckets[b] = 0;
+	assert(!intfrozen_load(&f, image, size) && intfrozen_verify(&f));
+	buckets[b] = head;
+	size_t empty = 0;
+	while(buckets[empty]) empty++;
+	buckets[empty] = head;
+	assert(!intfrozen_load(&f, image, size) && intfrozen_verify(&f));
+	buckets[empty] = 0;
+	assert(!intfrozen_load(&f, image, size) && !intfrozen_verify(&f));
+	strfrozen s;
+	assert(strfrozen_load(&s, image, size) < 0);
+	free(image);
+	inthash_destroy(&h);
+
+	/* string keys go to the arena */
+	strhash sh;
+	char buf[32];
+	strhash_init(&sh, 0);
+	for(int i=0;i<1000;i++) {
+		snprintf(buf, sizeof buf, "key%d", i);
+		strhash_put(&sh, strdup(buf), i);
+	}
+	assert(!strfrozen_save(&sh, path));
+	image = strfrozen_freeze(&sh, &size);
+	for(size_t i=0;i<sh.n;i++) free((char*)sh.entries[i].key);
+	strhash_destroy(&sh);
+	assert(!strfrozen_open(&s, path));
+	assert(s.n == 1000);
+	for(int i=0;i<1000;i++) {
+		snprintf(buf, sizeof buf, "key%d", i);
+		const int *v = strfrozen_get(&s, buf);
+		assert(v && *v == i);
+		assert(!strcmp(strfrozen_key(&s, (size_t)i), buf));
+	}
+	assert(!strfrozen_get(&s, "key") && !strfrozen_get(&s, "key1000"));
+	assert(!strfrozen_verify(&s));
+	strfrozen_close(&s);
+
+	/* key spans past the arena, or without a terminator */
+	assert(image && !strfrozen_load(&s, image, size) && !strfrozen_verify(&s));
+	strfrozenEntry *se = (strfrozenEntry*)((char*)image + ((HashfHeader*)image)->entries);
+	se[999].len = UINT64_MAX - se[999].key + 1;
+	assert(!strfrozen_load(&s, image, size) && strfrozen_verify(&s));
+	se[999].len = s.narena - se[999].key;
+	assert(strfrozen_verify(&s));
+	se[999].len = 1;
+	assert(strfrozen_verify(&s));
+	se[0].key = s.narena;
+	assert(strfrozen_load(&s, image, size) < 0);
+	free(image);
+	assert(intfrozen_open(&f, path) < 0);
+	remove(path);
+	assert(intfrozen_open(&f, path) < 0);
+
+	/* lookups use the map's own equality */
+	casehash ch;
+	casefrozen c;
+	casehash_init(&ch, 0);
+	casehash_put(&ch, "Content-Type", 1);
+	casehash_put(&ch, "HOST", 2);
+	image = casefrozen_freeze(&ch, &size);
+	casehash_destroy(&ch);
+	assert(image && !casefrozen_load(&c, image, size) && !casefrozen_verify(&c));
+	assert(*casefrozen_get(&c, "content-type") == 1 && *casefrozen_get(&c, "CONTENT-TYPE") == 1);
+	assert(*casefrozen_get(&c, "host") == 2 && !casefrozen_get(&c, "hosts"));
+	free(image);
+	return 0;
+}
+#endif
+/*
+Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
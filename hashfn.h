@@ -0,0 +1,261 @@
+#ifndef HASHFN_H
+#define HASHFN_H
+
+/* Fast 64 bit hash functions shared by hash.h, hash2.h and hashg.h.
+ * hashfn_bytes is wyhash (public domain, Wang Yi): 16 bytes per step
+ * and 48 per step with 3 lanes on long keys, one 64x64->128 multiply each.
+ * hashfn_u64 mixes integer keys so identity-like keys spread over buckets.
+ * _lower variants hash as if ASCII A-Z were a-z without copying the key.
+ *
+ * Every function takes a seed. the table macros pass HASHFN_SEED which is 0
+ * unless defined before including to something like a global set from
+ * hashfn_random_seed() at startup, to keep untrusted keys from flooding
+ * a bucket */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#ifndef HASHFN_SEED
+#define HASHFN_SEED 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HASHFN_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define HASHFN_INLINE static __forceinline
+#else
+#define HASHFN_INLINE static
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const uint64_t hashfn_secret[4] = {
+	0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/* 128 bit product of a and b. low half in a, high in b */
+static void hashfn_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128(*a, *b, b);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t hashfn_mix(uint64_t a, uint64_t b) {
+	hashfn_mum(&a, &b);
+	return a ^ b;
+}
+
+/* ASCII A-Z to a-z in each byte of w */
+static uint64_t hashfn_lower8(uint64_t w) {
+	const uint64_t ones = 0x0101010101010101ull;
+	uint64_t low7 = w & (ones * 0x7F);
+	uint64_t upper = ((low7 + ones * (0x80 - 'A')) ^ (low7 + ones * (0x80 - 'Z' - 1))) & ~w & (ones * 0x80);
+	return w | (upper >> 2);
+}
+
+static uint64_t hashfn_r8(const uint8_t *p, int lower) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return lower ? hashfn_lower8(v) : v;
+}
+
+static uint64_t hashfn_r4(const uint8_t *p, int lower) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return lower ? (uint32_t)hashfn_lower8(v) : v;
+}
+
+/* 1 to 3 bytes */
+static uint64_t hashfn_r3(const uint8_t *p, size_t k, int lower) {
+	uint64_t v = ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+	return lower ? hashfn_lower8(v) : v;
+}
+
+/* inlined so lower is a constant at each call and the unused path drops */
+HASHFN_INLINE uint64_t hashfn_wyhash(const void *key, size_t len, uint64_t seed, int lower) {
+	const uint8_t *p = (const uint8_t*)key;
+	const uint64_t *s = hashfn_secret;
+	uint64_t a, b;
+	seed ^= hashfn_mix(seed ^ s[0], s[1]);
+	if(len <= 16) {
+		if(len >= 4) {
+			a = (hashfn_r4(p, lower) << 32) | hashfn_r4(p + ((len >> 3) << 2), lower);
+			b = (hashfn_r4(p + len - 4, lower) << 32) | hashfn_r4(p + len - 4 - ((len >> 3) << 2), lower);
+		} else if(len > 0) {
+			a = hashfn_r3(p, len, lower);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if(i >= 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = hashfn_mix(hashfn_r8(p, lower) ^ s[1], hashfn_r8(p + 8, lower) ^ seed);
+				see1 = hashfn_mix(hashfn_r8(p + 16, lower) ^ s[2], hashfn_r8(p + 24, lower) ^ see1);
+				see2 = hashfn_mix(hashfn_r8(p + 32, lower) ^ s[3], hashfn_r8(p + 40, lower) ^ see2);
+				p += 48;
+				i -= 48;
+			} while(i >= 48);
+			seed ^= see1 ^ see2;
+		}
+		while(i > 16) {
+			seed = hashfn_mix(hashfn_r8(p, lower) ^ s[1], hashfn_r8(p + 8, lower) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		/* last 16 bytes, overlapping what was already hashed */
+		a = hashfn_r8(p + i - 16, lower);
+		b = hashfn_r8(p + i - 8, lower);
+	}
+	a ^= s[1];
+	b ^= seed;
+	hashfn_mum(&a, &b);
+	return hashfn_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+static uint64_t hashfn_bytes(const void *key, size_t n, uint64_t seed) {
+	return hashfn_wyhash(key, n, seed, 0);
+}
+
+static uint64_t hashfn_bytes_lower(const void *key, size_t n, uint64_t seed) {
+	return hashfn_wyhash(key, n, seed, 1);
+}
+
+/* same as hashfn_bytes(s, strlen(s), seed). null hashes as "" */
+static uint64_t hashfn_string(const char *s, uint64_t seed) {
+	return hashfn_wyhash(s ? s : "", s ? strlen(s) : 0, seed, 0);
+}
+
+static uint64_t hashfn_string_lower(const char *s, uint64_t seed) {
+	return hashfn_wyhash(s ? s : "", s ? strlen(s) : 0, seed, 1);
+}
+
+/* two multiplies so every input bit reaches the low bits used for buckets */
+static uint64_t hashfn_u64(uint64_t x, uint64_t seed) {
+	return hashfn_mix(hashfn_mix(x ^ hashfn_secret[0], seed ^ hashfn_secret[1]) ^ hashfn_secret[2], hashfn_secret[3]);
+}
+
+/* for HASHFN_SEED. falls back to the clock and an address without /dev/urandom */
+static uint64_t hashfn_random_seed(void) {
+	uint64_t seed = 0;
+	FILE *f = fopen("/dev/urandom", "rb");
+	if(f) {
+		if(fread(&seed, sizeof seed, 1, f) != 1) seed = 0;
+		fclose(f);
+	}
+	if(!seed) seed = hashfn_u64((uint64_t)time(0) ^ (uint64_t)(uintptr_t)&seed, (uint64_t)clock());
+	return seed;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef HASHFN_EXAMPLE
+#include <assert.h>
+#include <stdlib.h>
+#include "now.h"
+
+static uint64_t fnv1a(const void *key, size_t n) {
+	const uint8_t *p = (const uint8_t*)key;
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i=0;i<n;i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+int main(int argc, char **argv) {
+	const char *s = "https://example.com/Some/Path?Query=1";
+	assert(hashfn_string(s, 0) == hashfn_bytes(s, strlen(s), 0));
+	assert(hashfn_string(s, 0) != hashfn_string(s, 1));
+	assert(hashfn_string_lower("Column_NAME", 0) == hashfn_string("column_name", 0));
+	assert(hashfn_string_lower(s, 7) == hashfn_string_lower("HTTPS://EXAMPLE.COM/SOME/PATH?QUERY=1", 7));
+	/* only ASCII letters fold. '@' and '[' sit next to A and Z */
+	assert(hashfn_string_lower("@[", 0) == hashfn_string("@[", 0));
+	assert(hashfn_string(0, 0) == hashfn_string("", 0));
+	/* every length through the short, 16 and 48 byte paths */
+	char buf[256], upper[256];
+	for(size_t n=0;n<sizeof buf;n++) {
+		buf[n] = (char)('a' + n % 26);
+		upper[n] = (char)('A' + n % 26);
+	}
+	for(size_t n=0;n<sizeof buf;n++) {
+		assert(hashfn_bytes_lower(upper, n, 3) == hashfn_bytes(buf, n, 3));
+		if(n) assert(hashfn_bytes(buf, n, 3) != hashfn_bytes(buf, n - 1, 3));
+	}
+	/* sequential ints land in different buckets of a small table */
+	int used[64] = {0}, distinct = 0;
+	for(uint64_t i=0;i<64;i++) used[hashfn_u64(i * 64, 0) & 63] = 1;
+	for(int i=0;i<64;i++) distinct += used[i];
+	assert(distinct > 32);
+
+	size_t lens[] = {8, 32, 128, 1024};
+	char *data = (char*)malloc(1 << 20);
+	for(int i=0;i<1<<20;i++) data[i] = (char)rand();
+	for(int l=0;l<4;l++) {
+		size_t n = lens[l], iters = (64 << 20) / n;
+		uint64_t sum = 0;
+		double t = now();
+		for(size_t i=0;i<iters;i++) sum += fnv1a(data + (i * 64 & 0xFFFF), n);
+		double fnv = now() - t;
+		t = now();
+		for(size_t i=0;i<iters;i++) sum += hashfn_bytes(data + (i * 64 & 0xFFFF), n, 0);
+		double wy = now() - t;
+		printf("%4zu bytes: fnv1a %.2f GB/s hashfn %.2f GB/s (%llu)\n", n, 64 / 1024.0 / fnv, 64 / 1024.0 / wy,
+			(unsigned long long)(sum & 1));
+	}
+	free(data);
+	return 0;
+}
+#endif
+/*
+Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include "hashfn.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,7 +24,7 @@ typedef struct HashgView {
 
 
 #define HASHG_INT_EQUALS(x, y) ((x) == (y))
-#define HASHG_INT_HASH(x) ((size_t)x)
+#define HASHG_INT_HASH(x) ((size_t)hashfn_u64((uint64_t)(x), HASHFN_SEED))
 #define HASHG_STRING_EQUALS(x, y) (!strcmp(x, y))
 #define HASHG_STRING_HASH(x) hashg_string(x)
 #define HASHG_STRING_LOWER_EQUALS(x, y) hashg_string_lower_equals(x, y)
@@ -31,50 +32,106 @@ typedef struct HashgView {
 #define HASHG_VIEW_EQUALS(x, y) ((x).n == (y).n && !memcmp((x).p, (y).p, (x).n))
 #define HASHG_VIEW_HASH(x) hashg_bytes((uint8_t*)(x).p, (x).n)
 
+#ifndef HASHG_BATCH
+/* keys in flight per group of the _many functions. enough misses to cover memory latency */
+#define HASHG_BATCH 16
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define HASHG_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HASHG_PREFETCH(p) ((void)0)
+#endif
+
+#ifndef HASHG_MIGRATE
+/* old buckets moved per operation while an incremental grow is in progress */
+#define HASHG_MIGRATE 8
+#endif
+
 #define HASHG_DECLARE(name, TKEY, TVALUE, HASH, EQUALS) \
 typedef struct { \
 	TKEY key; \
 	TVALUE value; \
-	size_t next;	\
+	size_t next; /* entry index + 1. 0 ends the chain */ \
 } name##Entry;\
 typedef struct { \
-	size_t *buckets; \
+	size_t *buckets; /* entry index + 1. 0 for none */ \
 	name##Entry *entries;\
 	size_t capacity, n; \
+	/* set to move buckets to a grown table a few at a time instead of all at once */ \
+	int incremental; \
+	size_t *old, old_capacity, migrated; /* old buckets below migrated are moved */ \
 } name; \
 static void \
 name##_init(name*h, size_t n) { \
 	memset(h, 0, sizeof *h); \
 	if(!n) n = 16; /* n cannot be zero otherwise errors happen on get before put */\
 	n = (n * 128 + 89) / 90; \
-	h->entries = (name##Entry*)calloc(n, sizeof(name##Entry)); \
-	h->buckets = (size_t*)malloc(n * sizeof(size_t)); \
-	memset(h->buckets, 255, n * sizeof(size_t)); \
+	h->entries = (name##Entry*)malloc(n * sizeof(name##Entry)); \
+	/* calloc hands back untouched zero pages so huge tables cost nothing up front */ \
+	h->buckets = (size_t*)calloc(n, sizeof(size_t)); \
 	h->capacity = n; \
 } \
 static void \
 name##_destroy(name*h) { \
 	free(h->buckets); \
 	free(h->entries); \
+	free(h->old); \
 	memset(h, 0, sizeof *h); \
 } \
-static int name##_put(name*, TKEY, TVALUE); \
+/* head of the chain for hash in whichever table holds it */ \
+static size_t* \
+name##_bucket(name*h, size_t hash) { \
+	if(h->old) { \
+		size_t i = hash % h->old_capacity; \
+		if(i >= h->migrated) return &h->old[i]; \
+	} \
+	return &h->buckets[hash % h->capacity]; \
+} \
+/* relink the chains of up to count old buckets into the new ones */ \
+static void \
+name##_migrate(name*h, size_t count) { \
+	for(;count && h->migrated < h->old_capacity;count--) { \
+		size_t idx = h->old[h->migrated++]; \
+		while(idx) { \
+			name##Entry *e = &h->entries[idx - 1]; \
+			size_t next = e->next, *b = &h->buckets[HASH(e->key) % h->capacity]; \
+			e->next = *b; \
+			*b = idx; \
+			idx = next; \
+		} \
+	} \
+	if(h->migrated == h->old_capacity) { \
+		free(h->old); \
+		h->old = 0; \
+	} \
+} \
+/* room for n entries. entries keep their place so only chains are rebuilt */ \
 static void \
 name##_grow(name*h, size_t n) { \
-	size_t i; \
-	name h2; \
-	name##_init(&h2, n); \
-	if(n) \
-		for(i=0;i<h->n;i++) { \
-			name##Entry *e = &h->entries[i]; \
-			name##_put(&h2, e->key, e->value); \
-		}\
-	name##_destroy(h); \
-	*h = h2; \
+	if(h->old) name##_migrate(h, SIZE_MAX); \
+	n = (n * 128 + 89) / 90; \
+	if(n <= h->capacity) return; \
+	h->entries = (name##Entry*)realloc(h->entries, n * sizeof(name##Entry)); \
+	h->old = h->buckets; \
+	h->old_capacity = h->capacity; \
+	h->migrated = 0; \
+	h->buckets = (size_t*)calloc(n, sizeof(size_t)); \
+	h->capacity = n; \
+	if(!h->incremental) name##_migrate(h, SIZE_MAX); \
+}\
+/* presize for n entries so puts up to n never grow */ \
+static void \
+name##_reserve(name*h, size_t n) { \
+	int incremental = h->incremental; \
+	h->incremental = 0; \
+	name##_grow(h, n); \
+	h->incremental = incremental; \
 }\
 static void \
 name##_clear(name*h) { \
-	if(h->buckets) memset(h->buckets, 255, h->capacity * sizeof(size_t)); \
+	if(h->buckets) memset(h->buckets, 0, h->capacity * sizeof(size_t)); \
+	free(h->old); \
+	h->old = 0; \
 	h->n = 0; \
 }\
 /* return 0 on already exists. 1 on added */ \
@@ -82,10 +139,12 @@ static int \
 name##_put(name*h, TKEY key, TVALUE value) { \
 	if(h->n >= h->capacity * 90 / 128) \
 		name##_grow(h, h->capacity ? h->capacity * 2 : 65536); \
-	size_t i = HASH(key) % h->capacity; \
-	size_t idx = h->buckets[i]; \
-	while(idx != SIZE_MAX) { \
-		name##Entry *e = &h->entries[idx]; \
+	else if(h->old) \
+		name##_migrate(h, HASHG_MIGRATE); \
+	size_t *b = name##_bucket(h, HASH(key)); \
+	size_t idx = *b; \
+	while(idx) { \
+		name##Entry *e = &h->entries[idx - 1]; \
 		/* key matches */ \
 		if(EQUALS(e->key, key)) return 0; \
 		idx = e->next; \
@@ -93,66 +152,154 @@ name##_put(name*h, TKEY key, TVALUE value) { \
 	name##Entry *kp = &h->entries[h->n]; \
 	kp->key = key; \
 	kp->value = value; \
-	kp->next = h->buckets[i]; \
-	h->buckets[i] = h->n++; \
+	kp->next = *b; \
+	*b = ++h->n; \
 	return 1; \
 }\
-/* return 0 on missing, 1 on found */ \
+/* return 0 on missing */ \
 static TVALUE* \
 name##_get(name*h, TKEY key) { \
-	size_t i = HASH(key) % h->capacity; \
-	size_t idx = h->buckets[i]; \
-	while(idx != SIZE_MAX) { \
-		name##Entry *e = &h->entries[idx]; \
+	if(h->old) name##_migrate(h, HASHG_MIGRATE); \
+	size_t idx = *name##_bucket(h, HASH(key)); \
+	while(idx) { \
+		name##Entry *e = &h->entries[idx - 1]; \
 		if(EQUALS(e->key, key)) return &e->value; \
 		idx = e->next; \
 	} \
 	return 0; \
+} \
+/* out[i] is the value of keys[i] or 0. a group of keys is hashed and its \
+   buckets prefetched, then its entries, then the chains are walked, so the \
+   cache misses of the group overlap. return the number found */ \
+static size_t \
+name##_get_many(name*h, TKEY const *keys, size_t n, TVALUE **out) { \
+	size_t found = 0, *b[HASHG_BATCH], heads[HASHG_BATCH]; \
+	for(size_t g=0;g<n;g+=HASHG_BATCH) { \
+		size_t m = n - g < HASHG_BATCH ? n - g : HASHG_BATCH; \
+		if(h->old) name##_migrate(h, HASHG_MIGRATE); \
+		for(size_t i=0;i<m;i++) { \
+			b[i] = name##_bucket(h, HASH(keys[g + i])); \
+			HASHG_PREFETCH(b[i]); \
+		} \
+		for(size_t i=0;i<m;i++) { \
+			heads[i] = *b[i]; \
+			if(heads[i]) HASHG_PREFETCH(&h->entries[heads[i] - 1]); \
+		} \
+		for(size_t i=0;i<m;i++) { \
+			size_t idx = heads[i]; \
+			out[g + i] = 0; \
+			while(idx) { \
+				name##Entry *e = &h->entries[idx - 1]; \
+				if(EQUALS(e->key, keys[g + i])) { \
+					out[g + i] = &e->value; \
+					found++; \
+					break; \
+				} \
+				idx = e->next; \
+			} \
+		} \
+	} \
+	return found; \
+} \
+/* put for each key with its bucket prefetched a group ahead. return the number added */ \
+static size_t \
+name##_put_many(name*h, TKEY const *keys, TVALUE const *values, size_t n) { \
+	size_t added = 0; \
+	for(size_t g=0;g<n;g+=HASHG_BATCH) { \
+		size_t m = n - g < HASHG_BATCH ? n - g : HASHG_BATCH; \
+		/* grow first so the prefetched buckets are the ones put uses */ \
+		if(h->n + m > h->capacity * 90 / 128) \
+			name##_grow(h, h->capacity * 2); \
+		for(size_t i=0;i<m;i++) HASHG_PREFETCH(name##_bucket(h, HASH(keys[g + i]))); \
+		for(size_t i=0;i<m;i++) added += name##_put(h, keys[g + i], values[g + i]); \
+	} \
+	return added; \
 }
 
 #define HASHSETG_DECLARE(name, TKEY, HASH, EQUALS) \
 typedef struct { \
 	TKEY key; \
-	size_t next;	\
+	size_t next; /* entry index + 1. 0 ends the chain */ \
 } name##Entry;\
 typedef struct { \
-	size_t *buckets; \
+	size_t *buckets; /* entry index + 1. 0 for none */ \
 	name##Entry *entries;\
 	size_t capacity, n; \
+	/* set to move buckets to a grown table a few at a time instead of all at once */ \
+	int incremental; \
+	size_t *old, old_capacity, migrated; /* old buckets below migrated are moved */ \
 } name; \
 static void \
 name##_init(name*h, size_t n) { \
 	memset(h, 0, sizeof *h); \
 	if(!n) n = 16; /* n cannot be zero otherwise errors happen on get before put */\
 	n = (n * 128 + 89) / 90; \
-	h->entries = (name##Entry*)calloc(n, sizeof(name##Entry)); \
-	h->buckets = (size_t*)malloc(n * sizeof(size_t)); \
-	memset(h->buckets, 255, n * sizeof(size_t)); \
+	h->entries = (name##Entry*)malloc(n * sizeof(name##Entry)); \
+	/* calloc hands back untouched zero pages so huge tables cost nothing up front */ \
+	h->buckets = (size_t*)calloc(n, sizeof(size_t)); \
 	h->capacity = n; \
 } \
 static void \
 name##_destroy(name*h) { \
 	free(h->buckets); \
 	free(h->entries); \
+	free(h->old); \
 	memset(h, 0, sizeof *h); \
 } \
-static int name##_put(name*, TKEY); \
+/* head of the chain for hash in whichever table holds it */ \
+static size_t* \
+name##_bucket(name*h, size_t hash) { \
+	if(h->old) { \
+		size_t i = hash % h->old_capacity; \
+		if(i >= h->migrated) return &h->old[i]; \
+	} \
+	return &h->buckets[hash % h->capacity]; \
+} \
+/* relink the chains of up to count old buckets into the new ones */ \
+static void \
+name##_migrate(name*h, size_t count) { \
+	for(;count && h->migrated < h->old_capacity;count--) { \
+		size_t idx = h->old[h->migrated++]; \
+		while(idx) { \
+			name##Entry *e = &h->entries[idx - 1]; \
+			size_t next = e->next, *b = &h->buckets[HASH(e->key) % h->capacity]; \
+			e->next = *b; \
+			*b = idx; \
+			idx = next; \
+		} \
+	} \
+	if(h->migrated == h->old_capacity) { \
+		free(h->old); \
+		h->old = 0; \
+	} \
+} \
+/* room for n entries. entries keep their place so only chains are rebuilt */ \
 static void \
 name##_grow(name*h, size_t n) { \
-	size_t i; \
-	name h2; \
-	name##_init(&h2, n); \
-	if(n) \
-		for(i=0;i<h->n;i++) { \
-			name##Entry *e = &h->entries[i]; \
-			name##_put(&h2, e->key); \
-		}\
-	name##_destroy(h); \
-	*h = h2; \
+	if(h->old) name##_migrate(h, SIZE_MAX); \
+	n = (n * 128 + 89) / 90; \
+	if(n <= h->capacity) return; \
+	h->entries = (name##Entry*)realloc(h->entries, n * sizeof(name##Entry)); \
+	h->old = h->buckets; \
+	h->old_capacity = h->capacity; \
+	h->migrated = 0; \
+	h->buckets = (size_t*)calloc(n, sizeof(size_t)); \
+	h->capacity = n; \
+	if(!h->incremental) name##_migrate(h, SIZE_MAX); \
+}\
+/* presize for n entries so puts up to n never grow */ \
+static void \
+name##_reserve(name*h, size_t n) { \
+	int incremental = h->incremental; \
+	h->incremental = 0; \
+	name##_grow(h, n); \
+	h->incremental = incremental; \
 }\
 static void \
 name##_clear(name*h) { \
-	if(h->buckets) memset(h->buckets, 255, h->capacity * sizeof(size_t)); \
+	if(h->buckets) memset(h->buckets, 0, h->capacity * sizeof(size_t)); \
+	free(h->old); \
+	h->old = 0; \
 	h->n = 0; \
 }\
 /* return 0 on already exists. 1 on added */ \
@@ -160,73 +307,95 @@ static int \
 name##_put(name*h, TKEY key) { \
 	if(h->n >= h->capacity * 90 / 128) \
 		name##_grow(h, h->capacity ? h->capacity * 2 : 65536); \
-	size_t i = HASH(key) % h->capacity; \
-	size_t idx = h->buckets[i]; \
-	while(idx != SIZE_MAX) { \
-		name##Entry *e = &h->entries[idx]; \
+	else if(h->old) \
+		name##_migrate(h, HASHG_MIGRATE); \
+	size_t *b = name##_bucket(h, HASH(key)); \
+	size_t idx = *b; \
+	while(idx) { \
+		name##Entry *e = &h->entries[idx - 1]; \
 		/* key matches */ \
 		if(EQUALS(e->key, key)) return 0; \
 		idx = e->next; \
 	} \
 	name##Entry *kp = &h->entries[h->n]; \
 	kp->key = key; \
-	kp->next = h->buckets[i]; \
-	h->buckets[i] = h->n++; \
+	kp->next = *b; \
+	*b = ++h->n; \
 	return 1; \
 }\
 /* return 0 on missing, 1 on found */ \
 static int \
 name##_contains(name*h, TKEY key) { \
-	size_t i = HASH(key) % h->capacity; \
-	size_t idx = h->buckets[i]; \
-	while(idx != SIZE_MAX) { \
-		name##Entry *e = &h->entries[idx]; \
+	if(h->old) name##_migrate(h, HASHG_MIGRATE); \
+	size_t idx = *name##_bucket(h, HASH(key)); \
+	while(idx) { \
+		name##Entry *e = &h->entries[idx - 1]; \
 		if(EQUALS(e->key, key)) return 1; \
 		idx = e->next; \
 	} \
 	return 0; \
+} \
+/* out[i] is 1 if keys[i] is in the set else 0. see the hashg map get_many. \
+   return the number found */ \
+static size_t \
+name##_contains_many(name*h, TKEY const *keys, size_t n, int *out) { \
+	size_t found = 0, *b[HASHG_BATCH], heads[HASHG_BATCH]; \
+	for(size_t g=0;g<n;g+=HASHG_BATCH) { \
+		size_t m = n - g < HASHG_BATCH ? n - g : HASHG_BATCH; \
+		if(h->old) name##_migrate(h, HASHG_MIGRATE); \
+		for(size_t i=0;i<m;i++) { \
+			b[i] = name##_bucket(h, HASH(keys[g + i])); \
+			HASHG_PREFETCH(b[i]); \
+		} \
+		for(size_t i=0;i<m;i++) { \
+			heads[i] = *b[i]; \
+			if(heads[i]) HASHG_PREFETCH(&h->entries[heads[i] - 1]); \
+		} \
+		for(size_t i=0;i<m;i++) { \
+			size_t idx = heads[i]; \
+			out[g + i] = 0; \
+			while(idx) { \
+				name##Entry *e = &h->entries[idx - 1]; \
+				if(EQUALS(e->key, keys[g + i])) { \
+					out[g + i] = 1; \
+					found++; \
+					break; \
+				} \
+				idx = e->next; \
+			} \
+		} \
+	} \
+	return found; \
+} \
+/* return the number added */ \
+static size_t \
+name##_put_many(name*h, TKEY const *keys, size_t n) { \
+	size_t added = 0; \
+	for(size_t g=0;g<n;g+=HASHG_BATCH) { \
+		size_t m = n - g < HASHG_BATCH ? n - g : HASHG_BATCH; \
+		if(h->n + m > h->capacity * 90 / 128) \
+			name##_grow(h, h->capacity * 2); \
+		for(size_t i=0;i<m;i++) HASHG_PREFETCH(name##_bucket(h, HASH(keys[g + i]))); \
+		for(size_t i=0;i<m;i++) added += name##_put(h, keys[g + i]); \
+	} \
+	return added; \
 }
 
 static size_t hashg_bytes(const uint8_t *bytes, size_t nbytes) {
-	/* fnv1a64 */
-    uint64_t hash = (uint64_t)14695981039346656037ULL;
-    for(size_t i=0;i<nbytes;i++) {
-        hash ^= bytes[i];
-        hash *= 1099511628211;
-    }
-    return (size_t)hash;
+	return (size_t)hashfn_bytes(bytes, nbytes, HASHFN_SEED);
 }
 
 static size_t hashg_string(const char *str) {
-	/* fnv1a64 */
-    uint64_t hash = (uint64_t)14695981039346656037ULL;
-	if(!str) return hash;
-    for(;*str;++str) {
-        hash ^= (uint8_t)*str;
-        hash *= 1099511628211;
-    }
-    return (size_t)hash;
+	return (size_t)hashfn_string(str, HASHFN_SEED);
 }
 
 static size_t hashg_bytes_lower(const char *str, size_t n) {
-	/* fnv1a64 */
-    uint64_t hash = (uint64_t)14695981039346656037ULL;
-    for(size_t i=0;i<n;i++) {
-        hash ^= (uint8_t)tolower(str[i]);
-        hash *= 1099511628211;
-    }
-    return (size_t)hash;
+	return (size_t)hashfn_bytes_lower(str, n, HASHFN_SEED);
 }
 
+/* folds ASCII only like hashg_string_lower_equals in the C locale */
 static size_t hashg_string_lower(const char *str) {
-	/* fnv1a64 */
-    uint64_t hash = (uint64_t)14695981039346656037ULL;
-	if(!str) return hash;
-    for(;*str;++str) {
-        hash ^= (uint8_t)tolower(*str);
-        hash *= 1099511628211;
-    }
-    return (size_t)hash;
+	return (size_t)hashfn_string_lower(str, HASHFN_SEED);
 }
 
 static int hashg_string_lower_equals(const char *x, const char *y) {
@@ -251,10 +420,9 @@ static int hashg_string_lower_equals(const char *x, const char *y) {
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
-#include <sys/random.h>
 #define SIZE 10*1000*1000
 
-HASH_DECLARE(inthash, int, size_t, INT_HASH, INT_EQUALS)
+HASHG_DECLARE(inthash, int, size_t, HASHG_INT_HASH, HASHG_INT_EQUALS)
 
 static double now() {
 	struct timespec t;
@@ -280,34 +448,92 @@ static int* genkeys() {
 	return k;
 }
 
+/* slowest single put in ms. a full rehash shows up here, not in the average */
+static void put_all(inthash *hash, int *k, const char *name) {
+	double t = now(), max = 0;
+	for(size_t i=0;i<SIZE;i++) {
+		double s = now();
+		int rc = inthash_put(hash, k[i], k[i]);
+		assert(rc);
+		s = now() - s;
+		if(s > max) max = s;
+	}
+	printf("%s hash in %f max put %fms\n", name, now() - t, max * 1000);
+}
+
 int main(int argc, char **argv) {
 	double t = now();
 	int *k = genkeys();
 	printf("generate in %f\n", now() - t);
 
 	inthash hash;
-	inthash_init(&hash, SIZE);
+	inthash_init(&hash, 0);
+	put_all(&hash, k, "grow");
+	printf("nhash=%zu\n", hash.n);
+	inthash_destroy(&hash);
 
-	t = now();
-	for(size_t i=0;i<SIZE;i++) {
-		int rc = inthash_put(&hash, k[i], k[i]);
-		assert(rc);
+	inthash_init(&hash, 0);
+	hash.incremental = 1;
+	put_all(&hash, k, "incremental");
+	assert(!inthash_put(&hash, k[0], 0));
+	inthash_destroy(&hash);
+
+	/* every key put so far has its latest value while chains are split
+	   over both bucket arrays and once the grow ends */
+	size_t nsplit = SIZE / 10, *latest = (size_t*)malloc(nsplit * sizeof(size_t));
+	int started = 0, halfway = 0, checks = 0;
+	inthash_init(&hash, 0);
+	hash.incremental = 1;
+	for(size_t i=0;i<nsplit;i++) {
+		assert(inthash_put(&hash, k[i], latest[i] = k[i]));
+		if(i % 7 == 0) *inthash_get(&hash, k[i / 2]) = latest[i / 2] = SIZE + i;
+		if(!hash.old) started = halfway = 0;
+		else if(!started || (!halfway && hash.migrated >= hash.old_capacity / 2)) {
+			halfway = started;
+			started = 1;
+			checks++;
+			for(size_t j=0;j<=i;j++) {
+				size_t *v = inthash_get(&hash, k[j]);
+				assert(v && *v == latest[j]);
+			}
+			for(size_t j=i+1;j<i+100 && j<nsplit;j++) assert(!inthash_get(&hash, k[j]));
+		}
 	}
-	printf("hash in %f\n", now() - t);
-	printf("nhash=%zu\n", hash.n);
+	assert(checks > 2);
+	inthash_migrate(&hash, SIZE_MAX);
+	assert(!hash.old && hash.n == nsplit);
+	for(size_t i=0;i<nsplit;i++) assert(*inthash_get(&hash, k[i]) == latest[i]);
+	free(latest);
+	inthash_destroy(&hash);
+
+	inthash_init(&hash, 0);
+	inthash_reserve(&hash, SIZE);
+	put_all(&hash, k, "reserve");
 
 	shuffle(k, SIZE);
 
 	t = now();
 	for(size_t i=0;i<SIZE;i++) {
-		size_t v;
-		int rc = inthash_get(&hash, k[i], &v);
-		assert(rc);
-		assert(v == k[i]);
+		size_t *v = inthash_get(&hash, k[i]);
+		assert(v);
+		assert(*v == (size_t)k[i]);
 	}
 	printf("hash find in %f\n", now() - t);
 	printf("nhash=%zu\n", hash.n);
 
+	/* same lookups a group at a time with prefetching */
+	size_t **values = (size_t**)malloc(SIZE * sizeof(size_t*));
+	t = now();
+	size_t found = inthash_get_many(&hash, k, SIZE, values);
+	printf("hash find many in %f\n", now() - t);
+	assert(found == SIZE);
+	for(size_t i=0;i<SIZE;i++) assert(*values[i] == (size_t)k[i]);
+	int missing[] = {-1, 5, SIZE};
+	assert(inthash_get_many(&hash, missing, 3, values) == 1 && !values[0] && *values[1] == 5 && !values[2]);
+	free(values);
+	inthash_destroy(&hash);
+	free(k);
+
 	return 0;
 }
 
@@ -0,0 +1,430 @@
+#ifndef HASHP_H
+#define HASHP_H
+
+/* Minimal perfect hash for fixed key sets. maps each of n distinct 64 bit
+ * key hashes to its own index in [0, n) with a pilot table (CHD, Belazzougui
+ * et al 2009, with the search order and remapping of PTHash, Pibiri and
+ * Trani 2021).
+ *
+ * keys are split into partitions by the low hash bits. in a partition the
+ * top bits pick a bucket of about lambda keys. buckets are placed largest
+ * first by trying pilots 0, 1, 2... until every key of the bucket hashes
+ * with the pilot to a free slot of a table 1% bigger than the partition.
+ * slots past the end are remapped to the free ones below it. a lookup is
+ * one hash, one 16 bit pilot read and rarely one remap read. lambda 5
+ * takes about 3.5 bits per key. lambda 7, the most 16 bit pilots reliably
+ * place, takes about 2.6 bits per key and builds 5-20 times slower.
+ *
+ * partitions are built in parallel on the threadpool.h pool. keys not in
+ * the set get an arbitrary index so HASHP_DECLARE stores keys to check */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "hashg.h"
+#ifdef HASHP_EXAMPLE
+#define THREADPOOL_STATIC
+#endif
+#include "threadpool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* keys per partition. each is built by one task */
+#define HASHP_PARTITION (1 << 20)
+/* seeds tried per partition before giving up. only duplicate hashes fail
+   with lambda up to HASHP_LAMBDA_MAX */
+#define HASHP_SEEDS 16
+/* bigger buckets run out of 16 bit pilots in 1M key partitions */
+#define HASHP_LAMBDA_MAX 7
+
+typedef struct HashpPartition {
+	size_t offset;  /* first index */
+	size_t n, size; /* keys and table slots */
+	size_t buckets, pilots, remap; /* bucket count and where its pilots and remap start */
+	uint64_t seed;
+} HashpPartition;
+
+typedef struct Hashp {
+	HashpPartition *parts;
+	uint16_t *pilots;
+	uint32_t *remap; /* slot - n to a free slot below n */
+	size_t n, nparts, npilots, nremap;
+} Hashp;
+
+/* high 64 bits of x * n. maps x to [0, n) without a division */
+static size_t hashp_range(uint64_t x, size_t n) {
+	uint64_t b = n;
+	hashfn_mum(&x, &b);
+	return (size_t)b;
+}
+
+/* 60% of keys go to the first 30% of buckets so the big buckets are
+   placed while the table is mostly empty */
+static size_t hashp_bucket(uint64_t hash, size_t buckets) {
+	size_t dense = buckets * 3 / 10;
+	uint64_t x = hash * 0x9E3779B97F4A7C15ull;
+	if(hash < 0x9999999999999999ull) return hashp_range(x, dense ? dense : 1);
+	return dense + hashp_range(x, buckets - dense);
+}
+
+static size_t hashp_slot(uint64_t hash, uint64_t seed, unsigned pilot, size_t size) {
+	return hashp_range(hashfn_mix(hash ^ seed, hashfn_secret[1] + pilot * 0x9E3779B97F4A7C15ull), size);
+}
+
+/* index in [0, n) of a hash given to hashp_build. others get any index
+   below n. SIZE_MAX if n is 0 */
+static size_t hashp_index(const Hashp *p, uint64_t hash) {
+	if(!p->n) return SIZE_MAX;
+	const HashpPartition *part = &p->parts[hash & (p->nparts - 1)];
+	unsigned pilot = p->pilots[part->pilots + hashp_bucket(hash, part->buckets)];
+	size_t slot = hashp_slot(hash, part->seed, pilot, part->size);
+	if(slot >= part->n) slot = p->remap[part->remap + slot - part->n];
+	return part->offset + slot;
+}
+
+typedef struct HashpBuild {
+	Hashp *p;
+	uint64_t *hashes; /* grouped by partition */
+	int rc;
+} HashpBuild;
+
+static int hashp_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* return 0 on success. -1 on allocation failure. -2 if no pilot fits */
+static int hashp_partition(Hashp *p, HashpPartition *part, uint64_t *hashes) {
+	size_t nb = part->buckets, *start = (size_t*)calloc(nb + 1, sizeof(size_t));
+	uint64_t *sorted = (uint64_t*)malloc((part->n ? part->n : 1) * sizeof(uint64_t));
+	uint64_t *taken = (uint64_t*)calloc(part->size / 64 + 1, sizeof(uint64_t));
+	size_t *order = (size_t*)malloc(nb * sizeof(size_t)), slots[64], max = 0;
+	int rc = 0;
+	if(!start || !sorted || !taken || !order) rc = -1;
+	/* keys by bucket */
+	for(size_t i=0;!rc && i<part->n;i++) start[hashp_bucket(hashes[i], nb) + 1]++;
+	for(size_t b=0;!rc && b<nb;b++) {
+		if(start[b + 1] > max) max = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	if(!rc && max > 64) rc = -2;
+	if(!rc) {
+		size_t *fill = order; /* borrowed until buckets are sorted */
+		memcpy(fill, start, nb * sizeof(size_t));
+		for(size_t i=0;i<part->n;i++) sorted[fill[hashp_bucket(hashes[i], nb)]++] = hashes[i];
+		/* biggest buckets first while the table is empty */
+		size_t counts[66] = {0};
+		for(size_t b=0;b<nb;b++) counts[max - (start[b + 1] - start[b]) + 1]++;
+		for(size_t k=1;k<=max+1;k++) counts[k] += counts[k - 1];
+		for(size_t b=0;b<nb;b++) order[counts[max - (start[b + 1] - start[b])]++] = b;
+	}
+	for(size_t o=0;!rc && o<nb;o++) {
+		size_t b = order[o], k = start[b + 1] - start[b];
+		const uint64_t *keys = sorted + start[b];
+		unsigned pilot;
+		if(!k) break;
+		if(k > 1) {
+			qsort((void*)keys, k, sizeof(uint64_t), hashp_cmp);
+			for(size_t i=1;i<k;i++) if(keys[i] == keys[i - 1]) rc = -2;
+		}
+		for(pilot=0;!rc && pilot<=0xFFFF;pilot++) {
+			size_t i, j;
+			for(i=0;i<k;i++) {
+				slots[i] = hashp_slot(keys[i], part->seed, pilot, part->size);
+				if(taken[slots[i] >> 6] >> (slots[i] & 63) & 1) break;
+				for(j=0;j<i && slots[j] != slots[i];j++) {}
+				if(j < i) break;
+			}
+			if(i < k) continue;
+			for(i=0;i<k;i++) taken[slots[i] >> 6] |= 1ull << (slots[i] & 63);
+			p->pilots[part->pilots + b] = (uint16_t)pilot;
+			break;
+		}
+		if(pilot > 0xFFFF) rc = -2;
+	}
+	if(!rc) {
+		/* used slots past n take the free slots below n in order */
+		size_t free_slot = 0;
+		for(size_t s=part->n;s<part->size;s++) {
+			uint32_t to = 0;
+			if(taken[s >> 6] >> (s & 63) & 1) {
+				while(taken[free_slot >> 6] >> (free_slot & 63) & 1) free_slot++;
+				to = (uint32_t)free_slot++;
+			}
+			p->remap[part->remap + s - part->n] = to;
+		}
+	}
+	free(start);
+	free(sorted);
+	free(taken);
+	free(order);
+	return rc;
+}
+
+static void hashp_build_parts(void *ctx, size_t begin, size_t end) {
+	HashpBuild *b = (HashpBuild*)ctx;
+	for(size_t i=begin;i<end;i++) {
+		HashpPartition *part = &b->p->parts[i];
+		int rc = -2;
+		for(int s=0;s<HASHP_SEEDS && rc == -2;s++) {
+			part->seed = hashfn_u64(i * HASHP_SEEDS + s, 0);
+			memset(b->p->pilots + part->pilots, 0, part->buckets * sizeof(uint16_t));
+			rc = hashp_partition(b->p, part, b->hashes + part->offset);
+		}
+		if(rc) __atomic_store_n(&b->rc, rc, __ATOMIC_RELAXED);
+	}
+}
+
+static void hashp_free(Hashp *p) {
+	free(p->parts);
+	free(p->pilots);
+	free(p->remap);
+	memset(p, 0, sizeof *p);
+}
+
+/* hashes must be distinct. lambda is keys per bucket, 0 for 5. bigger is
+   smaller and slower to build up to HASHP_LAMBDA_MAX. return 0 on success.
+   -1 on allocation failure. -2 if hashes repeat. -3 if lambda is too big */
+static int hashp_build(Hashp *p, const uint64_t *hashes, size_t n, double lambda) {
+	HashpBuild b;
+	memset(p, 0, sizeof *p);
+	memset(&b, 0, sizeof b);
+	if(lambda > HASHP_LAMBDA_MAX) return -3;
+	if(lambda < 1) lambda = 5;
+	p->n = n;
+	p->nparts = 1;
+	while(p->nparts * HASHP_PARTITION < n) p->nparts *= 2;
+	p->parts = (HashpPartition*)calloc(p->nparts, sizeof(HashpPartition));
+	b.p = p;
+	b.hashes = (uint64_t*)malloc((n ? n : 1) * sizeof(uint64_t));
+	if(!p->parts || !b.hashes) {
+		free(b.hashes);
+		hashp_free(p);
+		return -1;
+	}
+	for(size_t i=0;i<n;i++) p->parts[hashes[i] & (p->nparts - 1)].n++;
+	for(size_t i=0;i<p->nparts;i++) {
+		HashpPartition *part = &p->parts[i];
+		part->offset = i ? part[-1].offset + part[-1].n : 0;
+		part->size = part->n + part->n / 100 + 1;
+		part->buckets = (size_t)(part->n / lambda) + 1;
+		part->pilots = p->npilots;
+		part->remap = p->nremap;
+		p->npilots += part->buckets;
+		p->nremap += part->size - part->n;
+	}
+	p->pilots = (uint16_t*)malloc(p->npilots * sizeof(uint16_t));
+	p->remap = (uint32_t*)malloc(p->nremap * sizeof(uint32_t));
+	if(!p->pilots || !p->remap) b.rc = -1;
+	else {
+		size_t *fill = (size_t*)malloc(p->nparts * sizeof(size_t));
+		if(!fill) b.rc = -1;
+		for(size_t i=0;fill && i<p->nparts;i++) fill[i] = p->parts[i].offset;
+		for(size_t i=0;fill && i<n;i++) b.hashes[fill[hashes[i] & (p->nparts - 1)]++] = hashes[i];
+		free(fill);
+	}
+	if(!b.rc) {
+		if(p->nparts == 1) hashp_build_parts(&b, 0, 1);
+		else threadpool_for(0, p->nparts, 1, hashp_build_parts, &b);
+	}
+	free(b.hashes);
+	if(b.rc) hashp_free(p);
+	return b.rc;
+}
+
+/* bytes of pilots, remap and partitions */
+static size_t hashp_bytes(const Hashp *p) {
+	return p->npilots * sizeof(uint16_t) + p->nremap * sizeof(uint32_t) + p->nparts * sizeof(HashpPartition);
+}
+
+/* keys per task when HASHP_DECLARE hashes and places keys */
+#define HASHP_GRAIN 65536
+
+/* static map of keys to values in one array ordered by perfect hash index.
+   keys are kept to reject keys outside the set */
+#define HASHP_DECLARE(name, TKEY, TVALUE, HASH, EQUALS) \
+typedef struct { \
+	TKEY key; \
+	TVALUE value; \
+} name##Entry; \
+typedef struct { \
+	Hashp mph; \
+	name##Entry *entries; /* by index. key next to value for one miss */ \
+	size_t n; \
+} name; \
+typedef struct { \
+	name *m; \
+	TKEY const *keys; \
+	TVALUE const *values; \
+	uint64_t *hashes; \
+} name##Build; \
+static void \
+name##_hash(void *ctx, size_t begin, size_t end) { \
+	name##Build *b = (name##Build*)ctx; \
+	for(size_t i=begin;i<end;i++) b->hashes[i] = (uint64_t)HASH(b->keys[i]); \
+} \
+static void \
+name##_place(void *ctx, size_t begin, size_t end) { \
+	name##Build *b = (name##Build*)ctx; \
+	for(size_t i=begin;i<end;i++) { \
+		name##Entry *e = &b->m->entries[hashp_index(&b->m->mph, b->hashes[i])]; \
+		e->key = b->keys[i]; \
+		if(b->values) e->value = b->values[i]; \
+	} \
+} \
+static void \
+name##_destroy(name *m) { \
+	hashp_free(&m->mph); \
+	free(m->entries); \
+	memset(m, 0, sizeof *m); \
+} \
+/* keys must be distinct. values may be null for zeroed values. \
+   return 0 on success. < 0 like hashp_build */ \
+static int \
+name##_build(name *m, TKEY const *keys, TVALUE const *values, size_t n, double lambda) { \
+	name##Build b; \
+	memset(m, 0, sizeof *m); \
+	b.m = m; \
+	b.keys = keys; \
+	b.values = values; \
+	b.hashes = (uint64_t*)malloc((n ? n : 1) * sizeof(uint64_t)); \
+	if(!b.hashes) return -1; \
+	if(n < HASHP_GRAIN) name##_hash(&b, 0, n); \
+	else threadpool_for(0, n, HASHP_GRAIN, name##_hash, &b); \
+	int rc = hashp_build(&m->mph, b.hashes, n, lambda); \
+	if(!rc && !(m->entries = (name##Entry*)calloc(n ? n : 1, sizeof(name##Entry)))) rc = -1; \
+	if(!rc) { \
+		m->n = n; \
+		if(n < HASHP_GRAIN) name##_place(&b, 0, n); \
+		else threadpool_for(0, n, HASHP_GRAIN, name##_place, &b); \
+	} \
+	free(b.hashes); \
+	if(rc) name##_destroy(m); \
+	return rc; \
+} \
+/* return 0 on missing */ \
+static TVALUE* \
+name##_get(const name *m, TKEY key) { \
+	size_t idx = hashp_index(&m->mph, (uint64_t)HASH(key)); \
+	if(idx >= m->n || !(EQUALS(m->entries[idx].key, key))) return 0; \
+	return &m->entries[idx].value; \
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef HASHP_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+#include "now.h"
+#define SIZE (8*1000*1000)
+
+HASHP_DECLARE(intmap, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHG_DECLARE(inthash, int, int, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHP_DECLARE(strmap, const char*, int, HASHG_STRING_HASH, HASHG_STRING_EQUALS)
+HASHP_DECLARE(viewmap, HashgView, int, HASHG_VIEW_HASH, HASHG_VIEW_EQUALS)
+
+int main(int argc, char **argv) {
+	int *keys = (int*)malloc(SIZE * sizeof(int)), *probes = (int*)malloc(SIZE * sizeof(int));
+	for(int i=0;i<SIZE;i++) keys[i] = i * 3;
+	for(int i=0;i<SIZE;i++) probes[i] = keys[(size_t)rand() * 7919 % SIZE];
+
+	/* every index is used exactly once */
+	uint64_t *hashes = (uint64_t*)malloc(SIZE * sizeof(uint64_t));
+	char *seen = (char*)calloc(SIZE, 1);
+	Hashp mph;
+	for(int i=0;i<SIZE;i++) hashes[i] = HASHG_INT_HASH(keys[i]);
+	for(int lambda=4;lambda<=5;lambda++) {
+		double t = now();
+		assert(!hashp_build(&mph, hashes, SIZE, lambda));
+		printf("lambda %d build %f %.2f bits/key\n", lambda, now() - t, hashp_bytes(&mph) * 8.0 / SIZE);
+		memset(seen, 0, SIZE);
+		for(int i=0;i<SIZE;i++) {
+			size_t idx = hashp_index(&mph, hashes[i]);
+			assert(idx < SIZE && !seen[idx]);
+			seen[idx] = 1;
+		}
+		hashp_free(&mph);
+	}
+	assert(hashp_build(&mph, hashes, SIZE, HASHP_LAMBDA_MAX + 1) == -3);
+	hashes[1] = hashes[0];
+	assert(hashp_build(&mph, hashes, SIZE, 0) == -2);
+	free(hashes);
+	free(seen);
+
+	intmap m;
+	double t = now();
+	assert(!intmap_build(&m, keys, keys, SIZE, 0));
+	printf("hashp build %f\n", now() - t);
+	inthash h;
+	t = now();
+	inthash_init(&h, 0);
+	for(int i=0;i<SIZE;i++) inthash_put(&h, keys[i], keys[i]);
+	printf("hashg build %f\n", now() - t);
+	printf("hashp %zu bytes hashg %zu bytes\n",
+		hashp_bytes(&m.mph) + SIZE * sizeof(intmapEntry),
+		h.capacity * (sizeof(inthashEntry) + sizeof(size_t)));
+
+	size_t sum = 0;
+	t = now();
+	for(int i=0;i<SIZE;i++) sum += *intmap_get(&m, probes[i]);
+	printf("hashp get %f\n", now() - t);
+	t = now();
+	for(int i=0;i<SIZE;i++) sum -= *inthash_get(&h, probes[i]);
+	printf("hashg get %f\n", now() - t);
+	assert(sum == 0);
+	t = now();
+	for(int i=0;i<SIZE;i++) sum += hashp_index(&m.mph, HASHG_INT_HASH(probes[i]));
+	printf("hashp index only %f (%zu)\n", now() - t, sum & 1);
+	assert(!intmap_get(&m, 1) && !intmap_get(&m, -3));
+	intmap_destroy(&m);
+	inthash_destroy(&h);
+
+	const char *words[] = {"alpha", "beta", "gamma", "delta", "epsilon"};
+	int values[] = {1, 2, 3, 4, 5};
+	strmap s;
+	assert(!strmap_build(&s, words, values, 5, 0));
+	for(int i=0;i<5;i++) assert(*strmap_get(&s, words[i]) == values[i]);
+	assert(!strmap_get(&s, "zeta"));
+	strmap_destroy(&s);
+
+	HashgView views[5];
+	viewmap v;
+	for(int i=0;i<5;i++) {
+		views[i].p = words[i];
+		views[i].n = 3;
+	}
+	assert(!viewmap_build(&v, views, 0, 5, 0));
+	HashgView del = {"delta", 3};
+	assert(viewmap_get(&v, del) && *viewmap_get(&v, del) == 0);
+	viewmap_destroy(&v);
+	free(keys);
+	free(probes);
+	return 0;
+}
+#endif
+/*
+Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
@@ -0,0 +1,321 @@
+#ifndef HASHS_H
+#define HASHS_H
+
+/* Generic open addressing hashmap and hashset in the style of SwissTable.
+ * A control byte per slot holds 7 bits of the hash or empty/deleted and
+ * lookups compare a whole group of 16 control bytes at once with SSE2
+ * (SWAR on other targets) so most misses never touch an entry.
+ * Power of 2 capacity, triangular probing over groups and tombstones
+ * for delete. Takes the same HASH and EQUALS macros as hashg.h */
+
+#include "hashg.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASHS_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HASHS_GROUP 16
+#define HASHS_EMPTY ((int8_t)-128)
+#define HASHS_DELETED ((int8_t)-2)
+
+/* bit i set for each slot i of the group at ctrl matching */
+static uint32_t hashs_match(const int8_t *ctrl, int8_t h2) {
+#ifdef HASHS_SSE2
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+#else
+	uint32_t mask = 0;
+	for(int half=0;half<2;half++) {
+		uint64_t w, lsb = 0x0101010101010101ull, msb = 0x8080808080808080ull;
+		memcpy(&w, ctrl + half * 8, 8);
+		w ^= lsb * (uint8_t)h2;
+		/* high bit of each zero byte. may flag a byte after a real match
+		   which the key compare rejects */
+		uint64_t t = (w - lsb) & ~w & msb;
+		mask |= (uint32_t)(((t >> 7) * 0x0102040810204080ull) >> 56) << (half * 8);
+	}
+	return mask;
+#endif
+}
+
+static uint32_t hashs_match_empty(const int8_t *ctrl) {
+#ifdef HASHS_SSE2
+	return hashs_match(ctrl, HASHS_EMPTY);
+#else
+	uint32_t mask = 0;
+	for(int half=0;half<2;half++) {
+		uint64_t w;
+		memcpy(&w, ctrl + half * 8, 8);
+		/* empty is the only control byte with bit 7 set and bit 1 clear */
+		uint64_t t = w & ~(w << 6) & 0x8080808080808080ull;
+		mask |= (uint32_t)(((t >> 7) * 0x0102040810204080ull) >> 56) << (half * 8);
+	}
+	return mask;
+#endif
+}
+
+static uint32_t hashs_match_free(const int8_t *ctrl) {
+#ifdef HASHS_SSE2
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+	uint32_t mask = 0;
+	for(int half=0;half<2;half++) {
+		uint64_t w;
+		memcpy(&w, ctrl + half * 8, 8);
+		uint64_t t = w & 0x8080808080808080ull;
+		mask |= (uint32_t)(((t >> 7) * 0x0102040810204080ull) >> 56) << (half * 8);
+	}
+	return mask;
+#endif
+}
+
+static int hashs_ctz(uint32_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return (int)i;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+/* spreads weak hashes like HASHG_INT_HASH over the group index and fragment */
+static uint64_t hashs_mix(uint64_t h) {
+	h *= 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 32);
+}
+
+/* power of 2 slots keeping n under 7/8 load */
+static size_t hashs_capacity(size_t n) {
+	size_t cap = HASHS_GROUP;
+	while(cap - cap / 8 <= n) cap *= 2;
+	return cap;
+}
+
+#define HASHS_DECLARE(name, TKEY, TVALUE, HASH, EQUALS) \
+typedef struct { \
+	TKEY key; \
+	TVALUE value; \
+} name##Entry;\
+typedef struct { \
+	int8_t *ctrl; \
+	name##Entry *entries; \
+	size_t capacity, n, deleted; \
+} name; \
+static void \
+name##_init(name*h, size_t n) { \
+	memset(h, 0, sizeof *h); \
+	h->capacity = hashs_capacity(n); \
+	h->ctrl = (int8_t*)malloc(h->capacity); \
+	h->entries = (name##Entry*)malloc(h->capacity * sizeof(name##Entry)); \
+	memset(h->ctrl, HASHS_EMPTY, h->capacity); \
+} \
+static void \
+name##_destroy(name*h) { \
+	free(h->ctrl); \
+	free(h->entries); \
+	memset(h, 0, sizeof *h); \
+} \
+static void \
+name##_clear(name*h) { \
+	if(h->ctrl) memset(h->ctrl, HASHS_EMPTY, h->capacity); \
+	h->n = h->deleted = 0; \
+}\
+/* slot holding key or SIZE_MAX */ \
+static size_t \
+name##_find(name*h, TKEY key) { \
+	if(!h->ctrl) return SIZE_MAX; \
+	uint64_t hash = hashs_mix(HASH(key)); \
+	int8_t h2 = (int8_t)(hash & 0x7F); \
+	size_t mask = h->capacity / HASHS_GROUP - 1; \
+	size_t g = (size_t)(hash >> 7) & mask; \
+	for(size_t step=1;;step++) { \
+		const int8_t *ctrl = h->ctrl + g * HASHS_GROUP; \
+		uint32_t m = hashs_match(ctrl, h2); \
+		while(m) { \
+			size_t i = g * HASHS_GROUP + hashs_ctz(m); \
+			if(EQUALS(h->entries[i].key, key)) return i; \
+			m &= m - 1; \
+		} \
+		/* an empty slot ends every probe that reached this group */ \
+		if(hashs_match_empty(ctrl)) return SIZE_MAX; \
+		g = (g + step) & mask; \
+	} \
+} \
+/* first free slot on the probe sequence of hash. the table is never full */ \
+static size_t \
+name##_slot(name*h, uint64_t hash) { \
+	size_t mask = h->capacity / HASHS_GROUP - 1; \
+	size_t g = (size_t)(hash >> 7) & mask; \
+	for(size_t step=1;;step++) { \
+		uint32_t m = hashs_match_free(h->ctrl + g * HASHS_GROUP); \
+		if(m) return g * HASHS_GROUP + hashs_ctz(m); \
+		g = (g + step) & mask; \
+	} \
+} \
+/* rebuilds at a size for n entries. also drops tombstones */ \
+static void \
+name##_rehash(name*h, size_t n) { \
+	name h2; \
+	name##_init(&h2, n); \
+	for(size_t i=0;i<h->capacity;i++) { \
+		if(!h->ctrl || h->ctrl[i] < 0) continue; \
+		uint64_t hash = hashs_mix(HASH(h->entries[i].key)); \
+		size_t j = name##_slot(&h2, hash); \
+		h2.ctrl[j] = (int8_t)(hash & 0x7F); \
+		h2.entries[j] = h->entries[i]; \
+	} \
+	h2.n = h->n; \
+	name##_destroy(h); \
+	*h = h2; \
+} \
+/* return 0 on already exists. 1 on added */ \
+static int \
+name##_put(name*h, TKEY key, TVALUE value) { \
+	if(name##_find(h, key) != SIZE_MAX) return 0; \
+	/* tombstones count as used so probes keep ending */ \
+	if(h->n + h->deleted + 1 > h->capacity - h->capacity / 8) \
+		name##_rehash(h, h->n + 1 > h->capacity / 2 ? h->capacity : h->n + 1); \
+	uint64_t hash = hashs_mix(HASH(key)); \
+	size_t i = name##_slot(h, hash); \
+	if(h->ctrl[i] == HASHS_DELETED) h->deleted--; \
+	h->ctrl[i] = (int8_t)(hash & 0x7F); \
+	h->entries[i].key = key; \
+	h->entries[i].value = value; \
+	h->n++; \
+	return 1; \
+}\
+/* return 0 on missing */ \
+static TVALUE* \
+name##_get(name*h, TKEY key) { \
+	size_t i = name##_find(h, key); \
+	return i == SIZE_MAX ? 0 : &h->entries[i].value; \
+} \
+/* return 0 on missing, 1 on deleted */ \
+static int \
+name##_del(name*h, TKEY key) { \
+	size_t i = name##_find(h, key); \
+	if(i == SIZE_MAX) return 0; \
+	/* probes never went past a group with an empty slot so no tombstone is needed */ \
+	if(hashs_match_empty(h->ctrl + i / HASHS_GROUP * HASHS_GROUP)) { \
+		h->ctrl[i] = HASHS_EMPTY; \
+	} else { \
+		h->ctrl[i] = HASHS_DELETED; \
+		h->deleted++; \
+	} \
+	h->n--; \
+	return 1; \
+} \
+/* iterate with i starting at 0. returns 0 at the end */ \
+static name##Entry* \
+name##_next(name*h, size_t *i) { \
+	for(;*i<h->capacity;++*i) \
+		if(h->ctrl[*i] >= 0) return &h->entries[(*i)++]; \
+	return 0; \
+}
+
+/* set on top of the map with an unused byte value */
+#define HASHSETS_DECLARE(name, TKEY, HASH, EQUALS) \
+HASHS_DECLARE(name##Map, TKEY, char, HASH, EQUALS) \
+typedef name##Map name; \
+static void name##_init(name *h, size_t n) { name##Map_init(h, n); } \
+static void name##_destroy(name *h) { name##Map_destroy(h); } \
+static void name##_clear(name *h) { name##Map_clear(h); } \
+/* return 0 on already exists. 1 on added */ \
+static int name##_put(name *h, TKEY key) { return name##Map_put(h, key, 0); } \
+static int name##_contains(name *h, TKEY key) { return name##Map_find(h, key) != SIZE_MAX; } \
+static int name##_del(name *h, TKEY key) { return name##Map_del(h, key); }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef HASHS_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+#include "now.h"
+#define SIZE 10*1000*1000
+
+HASHS_DECLARE(inthash, int, size_t, HASHG_INT_HASH, HASHG_INT_EQUALS)
+HASHSETS_DECLARE(strset, const char*, HASHG_STRING_HASH, HASHG_STRING_EQUALS)
+
+int main(int argc, char **argv) {
+	inthash hash;
+	inthash_init(&hash, 0);
+	int *k = (int*)malloc(SIZE * sizeof(int));
+	for(int i=0;i<SIZE;i++) k[i] = i;
+	for(int i=SIZE-1;i>0;i--) {
+		int j = rand() % (i + 1), tmp = k[i];
+		k[i] = k[j];
+		k[j] = tmp;
+	}
+
+	double t = now();
+	for(int i=0;i<SIZE;i++) assert(inthash_put(&hash, k[i], k[i]));
+	printf("put in %f\n", now() - t);
+	assert(!inthash_put(&hash, k[0], 0));
+
+	t = now();
+	for(int i=0;i<SIZE;i++) {
+		size_t *v = inthash_get(&hash, k[i]);
+		assert(v && *v == (size_t)k[i]);
+	}
+	printf("get in %f\n", now() - t);
+	assert(!inthash_get(&hash, -1));
+
+	/* delete every other key then reinsert through the tombstones */
+	for(int i=0;i<SIZE;i+=2) assert(inthash_del(&hash, k[i]));
+	assert(!inthash_del(&hash, k[0]));
+	assert(hash.n == SIZE / 2);
+	for(int i=0;i<SIZE;i++) assert(!inthash_get(&hash, k[i]) == !(i & 1));
+	size_t it = 0, count = 0;
+	inthashEntry *e;
+	while((e = inthash_next(&hash, &it))) count++;
+	assert(count == SIZE / 2);
+	for(int i=0;i<SIZE;i+=2) assert(inthash_put(&hash, k[i], k[i]));
+	assert(hash.n == SIZE);
+	inthash_destroy(&hash);
+	free(k);
+
+	strset set;
+	strset_init(&set, 4);
+	assert(strset_put(&set, "a"));
+	assert(strset_put(&set, "b"));
+	assert(!strset_put(&set, "a"));
+	assert(strset_contains(&set, "b"));
+	assert(strset_del(&set, "b"));
+	assert(!strset_contains(&set, "b"));
+	assert(!strset_contains(&set, "c"));
+	strset_destroy(&set);
+	return 0;
+}
+#endif
+/*
+Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
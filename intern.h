@@ -0,0 +1,360 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+/* String interning. maps byte strings to dense uint32_t ids 0, 1, 2... in
+ * the order they are first seen so equal strings get equal ids and string
+ * compares become integer compares. each distinct string is stored once
+ * with a trailing nul so intern_str works for C strings.
+ *
+ * strings are split into shards by the top bits of HASHG_VIEW_HASH. a
+ * shard is a hashg.h map from HashgView to id behind a spinlock plus a
+ * chain of arena blocks the views point into. blocks never move so views
+ * stay valid until intern_destroy. the id to view table is segments of
+ * doubling size that never move either, so intern_view does not lock.
+ * an id handed to another thread must be passed with the usual release and
+ * acquire (a mutex, a queue, thread join) like any other data.
+ * needs gcc or clang for __atomic builtins. see example and license (public
+ * domain) at end of file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+#include "hashg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returned when an allocation fails or by intern_find when missing */
+#define INTERN_NONE UINT32_MAX
+/* spins before a waiting thread yields the cpu */
+#define INTERN_SPIN 64
+/* arena block size. longer strings get a block of their own */
+#define INTERN_BLOCK 65536
+/* ids in the first segment of the reverse table. segment k holds 2^k times as many */
+#define INTERN_SEGMENT_BITS 10
+#define INTERN_SEGMENTS (33 - INTERN_SEGMENT_BITS)
+
+/* hash kept with the view so gets reject most other strings and grows
+   never rehash the bytes */
+typedef struct InternKey {
+	HashgView view;
+	size_t hash;
+} InternKey;
+
+#define INTERN_HASH(x) ((x).hash)
+#define INTERN_EQUALS(x, y) ((x).hash == (y).hash && HASHG_VIEW_EQUALS((x).view, (y).view))
+
+HASHG_DECLARE(internmap, InternKey, uint32_t, INTERN_HASH, INTERN_EQUALS)
+
+typedef struct InternShard {
+	internmap map;
+	char *block; /* newest arena block. starts with a pointer to the one before */
+	size_t used, size;
+	size_t bytes; /* arena bytes allocated */
+	int lock;
+	char pad[64];
+} InternShard;
+
+typedef struct Intern {
+	InternShard *shards;
+	size_t nshards; /* power of 2 */
+	int shift; /* hash >> shift is the shard */
+	uint32_t n;
+	HashgView *segments[INTERN_SEGMENTS];
+} Intern;
+
+static void intern_lock(int *lock) {
+	for(;;) {
+		for(int i=0;i<INTERN_SPIN;i++)
+			if(!__atomic_load_n(lock, __ATOMIC_RELAXED) && !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+				return;
+#ifdef _WIN32
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+}
+
+static void intern_unlock(int *lock) {
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/* shards rounded up to a power of 2. 0 for 64. return 0 on success */
+static int intern_init(Intern *in, size_t shards) {
+	memset(in, 0, sizeof *in);
+	if(!shards) shards = 64;
+	for(in->nshards=1;in->nshards<shards;in->nshards*=2) {}
+	in->shift = (int)(sizeof(size_t) * 8);
+	for(size_t n=in->nshards;n>1;n/=2) in->shift--;
+	in->shards = (InternShard*)calloc(in->nshards, sizeof(InternShard));
+	if(!in->shards) return -1;
+	for(size_t i=0;i<in->nshards;i++) internmap_init(&in->shards[i].map, 0);
+	return 0;
+}
+
+static void intern_destroy(Intern *in) {
+	for(size_t i=0;i<in->nshards;i++) {
+		InternShard *s = &in->shards[i];
+		while(s->block) {
+			char *prev;
+			memcpy(&prev, s->block, sizeof prev);
+			free(s->block);
+			s->block = prev;
+		}
+		internmap_destroy(&s->map);
+	}
+	for(int i=0;i<INTERN_SEGMENTS;i++) free(in->segments[i]);
+	free(in->shards);
+	memset(in, 0, sizeof *in);
+}
+
+/* segment and index of id */
+static HashgView* intern_slot(Intern *in, uint32_t id, int create) {
+	uint64_t x = (uint64_t)id + (1u << INTERN_SEGMENT_BITS);
+	int k = 63 - __builtin_clzll(x);
+	HashgView **seg = &in->segments[k - INTERN_SEGMENT_BITS];
+	HashgView *p = __atomic_load_n(seg, __ATOMIC_ACQUIRE);
+	if(!p && create) {
+		/* shards fill ids in parallel so two can race to allocate */
+		HashgView *fresh = (HashgView*)malloc(((size_t)1 << k) * sizeof(HashgView)), *expected = 0;
+		if(!fresh) return 0;
+		if(__atomic_compare_exchange_n(seg, &expected, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) p = fresh;
+		else {
+			free(fresh);
+			p = expected;
+		}
+	}
+	return p ? &p[x - ((uint64_t)1 << k)] : 0;
+}
+
+/* copy of n bytes plus a nul in the shard arena */
+static char* intern_copy(InternShard *s, const char *p, size_t n) {
+	char *d;
+	if(s->size - s->used < n + 1) {
+		size_t size = sizeof(char*) + n + 1 > INTERN_BLOCK ? sizeof(char*) + n + 1 : INTERN_BLOCK;
+		char *block = (char*)malloc(size);
+		if(!block) return 0;
+		memcpy(block, &s->block, sizeof(char*));
+		s->block = block;
+		s->used = sizeof(char*);
+		s->size = size;
+		s->bytes += size;
+	}
+	d = s->block + s->used;
+	memcpy(d, p, n);
+	d[n] = 0;
+	s->used += n + 1;
+	return d;
+}
+
+/* id of the n bytes at p, adding them if new. INTERN_NONE on allocation failure */
+static uint32_t intern(Intern *in, const char *p, size_t n) {
+	InternKey key;
+	key.view.p = p;
+	key.view.n = n;
+	key.hash = HASHG_VIEW_HASH(key.view);
+	InternShard *s = &in->shards[in->nshards > 1 ? key.hash >> in->shift : 0];
+	uint32_t id = INTERN_NONE, *found;
+	intern_lock(&s->lock);
+	if((found = internmap_get(&s->map, key))) id = *found;
+	else if(__atomic_load_n(&in->n, __ATOMIC_RELAXED) < INTERN_NONE && (key.view.p = intern_copy(s, p, n))) {
+		HashgView *slot;
+		id = __atomic_fetch_add(&in->n, 1, __ATOMIC_RELAXED);
+		/* written before the unlock so a thread finding the id in this shard sees it */
+		if(id != INTERN_NONE && (slot = intern_slot(in, id, 1))) {
+			*slot = key.view;
+			internmap_put(&s->map, key, id);
+		} else {
+			/* the id is skipped and the copy stays in the arena unused */
+			id = INTERN_NONE;
+		}
+	}
+	intern_unlock(&s->lock);
+	return id;
+}
+
+static uint32_t intern_string(Intern *in, const char *s) {
+	return intern(in, s, strlen(s));
+}
+
+/* id of the n bytes at p or INTERN_NONE if never interned */
+static uint32_t intern_find(Intern *in, const char *p, size_t n) {
+	InternKey key;
+	key.view.p = p;
+	key.view.n = n;
+	key.hash = HASHG_VIEW_HASH(key.view);
+	InternShard *s = &in->shards[in->nshards > 1 ? key.hash >> in->shift : 0];
+	uint32_t id, *found;
+	intern_lock(&s->lock);
+	found = internmap_get(&s->map, key);
+	id = found ? *found : INTERN_NONE;
+	intern_unlock(&s->lock);
+	return id;
+}
+
+/* bytes of an id from intern. valid until intern_destroy */
+static HashgView intern_view(Intern *in, uint32_t id) {
+	return *intern_slot(in, id, 0);
+}
+
+/* nul terminated */
+static const char* intern_str(Intern *in, uint32_t id) {
+	return intern_slot(in, id, 0)->p;
+}
+
+/* distinct strings. ids are 0 to count - 1 */
+static uint32_t intern_count(Intern *in) {
+	return __atomic_load_n(&in->n, __ATOMIC_RELAXED);
+}
+
+/* memory held by maps, arenas and the reverse table */
+static size_t intern_bytes(Intern *in) {
+	size_t bytes = in->nshards * sizeof(InternShard);
+	for(size_t i=0;i<in->nshards;i++) {
+		InternShard *s = &in->shards[i];
+		intern_lock(&s->lock);
+		bytes += s->bytes + s->map.capacity * (sizeof(size_t) + sizeof(internmapEntry));
+		intern_unlock(&s->lock);
+	}
+	for(int i=0;i<INTERN_SEGMENTS;i++)
+		if(in->segments[i]) bytes += ((size_t)1 << (i + INTERN_SEGMENT_BITS)) * sizeof(HashgView);
+	return bytes;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef INTERN_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+#include "thread.h"
+#include "now.h"
+
+#define ROWS (1 << 21)
+#define DISTINCT 5000
+#define THREADS 8
+
+static Intern pool;
+static char **rows;
+static uint32_t *ids;
+
+typedef struct Worker {
+	thrd_t thread;
+	int id;
+} Worker;
+
+/* every thread interns every row so most calls find a string another added */
+static int work(void *ctx) {
+	Worker *w = (Worker*)ctx;
+	for(size_t i=0;i<ROWS;i++) {
+		size_t r = (i + (size_t)w->id * (ROWS / THREADS)) % ROWS;
+		uint32_t id = intern_string(&pool, rows[r]);
+		assert(id != INTERN_NONE);
+		if(!w->id) ids[r] = id;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	Intern in;
+	assert(!intern_init(&in, 1));
+	assert(intern_string(&in, "a") == 0);
+	assert(intern_string(&in, "bc") == 1);
+	assert(intern(&in, "abc", 1) == 0);
+	assert(intern(&in, "", 0) == 2);
+	assert(intern_find(&in, "bc", 2) == 1);
+	assert(intern_find(&in, "b", 1) == INTERN_NONE);
+	assert(!strcmp(intern_str(&in, 1), "bc") && intern_view(&in, 2).n == 0);
+	/* strings longer than a block and enough ids to fill a few segments */
+	char *big = (char*)calloc(1, INTERN_BLOCK * 2 + 1);
+	memset(big, 'x', INTERN_BLOCK * 2);
+	assert(intern_string(&in, big) == 3);
+	assert(intern_view(&in, 3).n == INTERN_BLOCK * 2 && intern_str(&in, 3) != big);
+	char buf[32];
+	for(int i=0;i<100000;i++) {
+		snprintf(buf, sizeof buf, "key%d", i);
+		assert(intern_string(&in, buf) == (uint32_t)i + 4);
+	}
+	for(int i=0;i<100000;i+=997) {
+		snprintf(buf, sizeof buf, "key%d", i);
+		assert(!strcmp(intern_str(&in, (uint32_t)i + 4), buf));
+	}
+	assert(intern_count(&in) == 100004);
+	intern_destroy(&in);
+	free(big);
+
+	/* a string column of repeated values as one malloc per row vs ids */
+	size_t plain = 0;
+	rows = (char**)malloc(ROWS * sizeof(char*));
+	ids = (uint32_t*)malloc(ROWS * sizeof(uint32_t));
+	for(size_t i=0;i<ROWS;i++) {
+		snprintf(buf, sizeof buf, "customer-segment-%zu", i * 2654435761u % DISTINCT);
+		rows[i] = strdup(buf);
+		plain += sizeof(char*) + (strlen(buf) + 1 + 15) / 16 * 16 + 16; /* glibc malloc rounding and header */
+	}
+	assert(!intern_init(&pool, 0));
+	Worker w[THREADS];
+	double t = now();
+	for(int i=0;i<THREADS;i++) {
+		w[i].id = i;
+		thrd_create(&w[i].thread, work, &w[i]);
+	}
+	for(int i=0;i<THREADS;i++) thrd_join(w[i].thread, 0);
+	t = now() - t;
+	assert(intern_count(&pool) == DISTINCT);
+	for(size_t i=0;i<ROWS;i++) {
+		assert(!strcmp(intern_str(&pool, ids[i]), rows[i]));
+		assert(intern_find(&pool, rows[i], strlen(rows[i])) == ids[i]);
+	}
+	size_t interned = ROWS * sizeof(uint32_t) + intern_bytes(&pool);
+	printf("%d threads interned %d rows each in %f (%.1f M/s)\n", THREADS, ROWS, t, THREADS * (double)ROWS / t / 1e6);
+	printf("column of %d rows with %d distinct: %zu KB as strings, %zu KB as ids (%.1fx)\n",
+		ROWS, DISTINCT, plain / 1024, interned / 1024, (double)plain / interned);
+
+	/* comparing ids vs strings */
+	size_t same = 0, same2 = 0;
+	t = now();
+	for(size_t i=1;i<ROWS;i++) same += !strcmp(rows[i], rows[i - 1]);
+	double cmp = now() - t;
+	t = now();
+	for(size_t i=1;i<ROWS;i++) same2 += ids[i] == ids[i - 1];
+	printf("equal neighbours strcmp %f ids %f\n", cmp, now() - t);
+	assert(same == same2);
+
+	intern_destroy(&pool);
+	for(size_t i=0;i<ROWS;i++) free(rows[i]);
+	free(rows);
+	free(ids);
+	return 0;
+}
+#endif
+/*
+Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
@@ -0,0 +1,606 @@
+/* SPDX-License-Identifier: Unlicense */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/* Bounded lock-free queues of fixed size items.
+
+   QueueMpmc is Dmitry Vyukov's bounded multi producer multi consumer queue.
+   every slot has a sequence number so producers and consumers only contend
+   on one CAS each and never wait on each other.
+   QueueSpsc is a wait-free single producer single consumer ring. each side
+   caches the other side's index and batches copy many items per index update.
+
+   the _wait functions block with a futex (WaitOnAddress on windows) once
+   spinning fails. sleepers are counted so the fast paths make no syscall
+   unless someone sleeps. needs gcc or clang for __atomic builtins.
+
+   #define QUEUE_IMPLEMENTATION in one C file before including queue.h or
+   define QUEUE_STATIC before each include.
+
+   see example and license (public domain) at end of file */
+
+#if defined(QUEUE_STATIC) || defined(QUEUE_EXAMPLE)
+#define QUEUE_API static
+#define QUEUE_IMPLEMENTATION
+#else
+#define QUEUE_API extern
+#endif
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* futex word and count of threads sleeping on it */
+typedef struct QueueWait {
+	int epoch;
+	int sleepers;
+} QueueWait;
+
+typedef struct QueueMpmc {
+	unsigned char *cells;
+	size_t mask, size, stride;
+	char pad0[64];
+	size_t head; /* producers claim here */
+	char pad1[64];
+	size_t tail; /* consumers claim here */
+	char pad2[64];
+	QueueWait readers, writers;
+	int closed;
+} QueueMpmc;
+
+typedef struct QueueSpsc {
+	unsigned char *items;
+	size_t mask, size;
+	char pad0[64];
+	size_t head; /* written by the producer */
+	size_t tail_cache;
+	char pad1[64];
+	size_t tail; /* written by the consumer */
+	size_t head_cache;
+	char pad2[64];
+	QueueWait readers, writers;
+	int closed;
+} QueueSpsc;
+
+/* capacity is rounded up to a power of 2. size is bytes per item.
+   return 0 on success. < 0 on allocation failure */
+QUEUE_API int queue_mpmc_init(QueueMpmc *q, size_t capacity, size_t size);
+QUEUE_API void queue_mpmc_free(QueueMpmc *q);
+/* return 1 on success. 0 if full or empty */
+QUEUE_API int queue_mpmc_push(QueueMpmc *q, const void *item);
+QUEUE_API int queue_mpmc_pop(QueueMpmc *q, void *item);
+/* block while full or empty. timeout_ms < 0 waits forever.
+   return 1 on success. 0 on timeout or when closed (and empty for pop) */
+QUEUE_API int queue_mpmc_push_wait(QueueMpmc *q, const void *item, int timeout_ms);
+QUEUE_API int queue_mpmc_pop_wait(QueueMpmc *q, void *item, int timeout_ms);
+/* approximate while other threads push or pop */
+QUEUE_API size_t queue_mpmc_count(QueueMpmc *q);
+/* wakes every waiter. pops still drain what is queued */
+QUEUE_API void queue_mpmc_close(QueueMpmc *q);
+
+QUEUE_API int queue_spsc_init(QueueSpsc *q, size_t capacity, size_t size);
+QUEUE_API void queue_spsc_free(QueueSpsc *q);
+/* producer only. copies up to n items and returns how many fit */
+QUEUE_API size_t queue_spsc_push(QueueSpsc *q, const void *items, size_t n);
+/* consumer only. copies up to max items and returns how many */
+QUEUE_API size_t queue_spsc_pop(QueueSpsc *q, void *items, size_t max);
+/* pushes all n items, blocking while full. returns how many were pushed
+   which is less than n only on timeout or close */
+QUEUE_API size_t queue_spsc_push_wait(QueueSpsc *q, const void *items, size_t n, int timeout_ms);
+/* blocks until at least one item. returns 0 on timeout or when closed and empty */
+QUEUE_API size_t queue_spsc_pop_wait(QueueSpsc *q, void *items, size_t max, int timeout_ms);
+QUEUE_API size_t queue_spsc_count(QueueSpsc *q);
+QUEUE_API void queue_spsc_close(QueueSpsc *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef QUEUE_IMPLEMENTATION
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#pragma comment(lib, "synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+/* failed attempts before sleeping */
+#define QUEUE_SPIN 128
+
+static void
+queue_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static double
+queue_now(void) {
+#ifdef _WIN32
+	return (double)GetTickCount64() / 1e3;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+}
+
+/* sleeps while *addr == value for at most timeout_ms (< 0 forever) */
+static void
+queue_futex_wait(int *addr, int value, int timeout_ms) {
+#ifdef _WIN32
+	WaitOnAddress(addr, &value, sizeof value, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+#elif defined(__linux__)
+	struct timespec t, *tp = 0;
+	if(timeout_ms >= 0) {
+		t.tv_sec = timeout_ms / 1000;
+		t.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+		tp = &t;
+	}
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, tp, 0, 0);
+#else
+	/* no portable address wait. yield and let the caller recheck */
+	(void)addr; (void)value; (void)timeout_ms;
+	sched_yield();
+#endif
+}
+
+static void
+queue_futex_wake(int *addr, int n) {
+#ifdef _WIN32
+	if(n == 1) WakeByAddressSingle(addr);
+	else WakeByAddressAll(addr);
+#elif defined(__linux__)
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+#else
+	(void)addr; (void)n;
+#endif
+}
+
+/* called after making progress the other side may be sleeping on. the fence
+   pairs with the one in queue_sleep so either the sleeper sees the change
+   or we see the sleeper */
+static void
+queue_notify(QueueWait *w, int n) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(!__atomic_load_n(&w->sleepers, __ATOMIC_RELAXED)) return;
+	__atomic_fetch_add(&w->epoch, 1, __ATOMIC_SEQ_CST);
+	queue_futex_wake(&w->epoch, n);
+}
+
+/* ready(q) is rechecked after registering as a sleeper */
+static void
+queue_sleep(QueueWait *w, int (*ready)(void*), void *q, int timeout_ms) {
+	__atomic_fetch_add(&w->sleepers, 1, __ATOMIC_SEQ_CST);
+	int epoch = __atomic_load_n(&w->epoch, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(!ready(q)) queue_futex_wait(&w->epoch, epoch, timeout_ms);
+	__atomic_fetch_sub(&w->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+/* spins then sleeps until op(q, item) succeeds, the queue closes or the
+   timeout passes. ready(q) tells if op may succeed now */
+static int
+queue_block(QueueWait *w, int *closed, int (*op)(void*, void*), int (*ready)(void*),
+	void *q, void *item, int timeout_ms) {
+	double deadline = timeout_ms >= 0 ? queue_now() + timeout_ms / 1e3 : 0;
+	for(int i=0;;i++) {
+		if(op(q, item)) return 1;
+		if(__atomic_load_n(closed, __ATOMIC_ACQUIRE)) return 0;
+		if(i < QUEUE_SPIN) {
+			queue_pause();
+			continue;
+		}
+		int ms = -1;
+		if(timeout_ms >= 0) {
+			double left = deadline - queue_now();
+			if(left <= 0) return 0;
+			ms = (int)(left * 1e3) + 1;
+		}
+		queue_sleep(w, ready, q, ms);
+	}
+}
+
+static size_t
+queue_capacity(size_t capacity) {
+	size_t n = 2;
+	while(n < capacity) n *= 2;
+	return n;
+}
+
+QUEUE_API int
+queue_mpmc_init(QueueMpmc *q, size_t capacity, size_t size) {
+	memset(q, 0, sizeof *q);
+	capacity = queue_capacity(capacity);
+	/* sequence number then the item */
+	q->stride = (sizeof(size_t) + size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	q->cells = (unsigned char*)malloc(capacity * q->stride);
+	if(!q->cells) return -1;
+	q->mask = capacity - 1;
+	q->size = size;
+	for(size_t i=0;i<capacity;i++) *(size_t*)(q->cells + i * q->stride) = i;
+	return 0;
+}
+
+QUEUE_API void
+queue_mpmc_free(QueueMpmc *q) {
+	free(q->cells);
+	q->cells = 0;
+}
+
+QUEUE_API int
+queue_mpmc_push(QueueMpmc *q, const void *item) {
+	size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	size_t *seq;
+	for(;;) {
+		seq = (size_t*)(q->cells + (pos & q->mask) * q->stride);
+		intptr_t dif = (intptr_t)__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+		if(dif == 0) {
+			if(__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(dif < 0) {
+			return 0; /* the slot still holds an item from a lap ago */
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(seq + 1, item, q->size);
+	__atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+	queue_notify(&q->readers, 1);
+	return 1;
+}
+
+QUEUE_API int
+queue_mpmc_pop(QueueMpmc *q, void *item) {
+	size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	size_t *seq;
+	for(;;) {
+		seq = (size_t*)(q->cells + (pos & q->mask) * q->stride);
+		intptr_t dif = (intptr_t)__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+		if(dif == 0) {
+			if(__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(dif < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(item, seq + 1, q->size);
+	/* free for the producer one lap later */
+	__atomic_store_n(seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	queue_notify(&q->writers, 1);
+	return 1;
+}
+
+QUEUE_API size_t
+queue_mpmc_count(QueueMpmc *q) {
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return head > tail ? head - tail : 0;
+}
+
+static int
+queue_mpmc_has_items(void *q) {
+	return queue_mpmc_count((QueueMpmc*)q) > 0 || __atomic_load_n(&((QueueMpmc*)q)->closed, __ATOMIC_ACQUIRE);
+}
+
+static int
+queue_mpmc_has_space(void *q) {
+	return queue_mpmc_count((QueueMpmc*)q) <= ((QueueMpmc*)q)->mask || __atomic_load_n(&((QueueMpmc*)q)->closed, __ATOMIC_ACQUIRE);
+}
+
+static int
+queue_mpmc_push_op(void *q, void *item) {
+	return queue_mpmc_push((QueueMpmc*)q, item);
+}
+
+static int
+queue_mpmc_pop_op(void *q, void *item) {
+	return queue_mpmc_pop((QueueMpmc*)q, item);
+}
+
+QUEUE_API int
+queue_mpmc_push_wait(QueueMpmc *q, const void *item, int timeout_ms) {
+	if(__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) return 0;
+	return queue_block(&q->writers, &q->closed, queue_mpmc_push_op, queue_mpmc_has_space, q, (void*)item, timeout_ms);
+}
+
+QUEUE_API int
+queue_mpmc_pop_wait(QueueMpmc *q, void *item, int timeout_ms) {
+	return queue_block(&q->readers, &q->closed, queue_mpmc_pop_op, queue_mpmc_has_items, q, item, timeout_ms) ||
+		queue_mpmc_pop(q, item); /* a push may have landed just before close */
+}
+
+QUEUE_API void
+queue_mpmc_close(QueueMpmc *q) {
+	__atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+	queue_notify(&q->readers, INT_MAX);
+	queue_notify(&q->writers, INT_MAX);
+}
+
+QUEUE_API int
+queue_spsc_init(QueueSpsc *q, size_t capacity, size_t size) {
+	memset(q, 0, sizeof *q);
+	capacity = queue_capacity(capacity);
+	q->items = (unsigned char*)malloc(capacity * size);
+	if(!q->items) return -1;
+	q->mask = capacity - 1;
+	q->size = size;
+	return 0;
+}
+
+QUEUE_API void
+queue_spsc_free(QueueSpsc *q) {
+	free(q->items);
+	q->items = 0;
+}
+
+/* copies n items to or from ring index i, wrapping once if needed */
+static void
+queue_spsc_copy(QueueSpsc *q, size_t i, void *items, size_t n, int in) {
+	size_t at = i & q->mask;
+	size_t first = q->mask + 1 - at;
+	if(first > n) first = n;
+	unsigned char *ring = q->items, *p = (unsigned char*)items;
+	if(in) {
+		memcpy(ring + at * q->size, p, first * q->size);
+		memcpy(ring, p + first * q->size, (n - first) * q->size);
+	} else {
+		memcpy(p, ring + at * q->size, first * q->size);
+		memcpy(p + first * q->size, ring, (n - first) * q->size);
+	}
+}
+
+QUEUE_API size_t
+queue_spsc_push(QueueSpsc *q, const void *items, size_t n) {
+	size_t head = q->head, cap = q->mask + 1;
+	/* only read the consumer's index when the cached one says full */
+	if(head - q->tail_cache + n > cap)
+		q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t space = cap - (head - q->tail_cache);
+	if(n > space) n = space;
+	if(!n) return 0;
+	queue_spsc_copy(q, head, (void*)items, n, 1);
+	__atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+	queue_notify(&q->readers, 1);
+	return n;
+}
+
+QUEUE_API size_t
+queue_spsc_pop(QueueSpsc *q, void *items, size_t max) {
+	size_t tail = q->tail;
+	if(q->head_cache - tail < max)
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	size_t n = q->head_cache - tail;
+	if(n > max) n = max;
+	if(!n) return 0;
+	queue_spsc_copy(q, tail, items, n, 0);
+	__atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
+	queue_notify(&q->writers, 1);
+	return n;
+}
+
+QUEUE_API size_t
+queue_spsc_count(QueueSpsc *q) {
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+static int
+queue_spsc_has_items(void *q) {
+	return queue_spsc_count((QueueSpsc*)q) > 0 || __atomic_load_n(&((QueueSpsc*)q)->closed, __ATOMIC_ACQUIRE);
+}
+
+static int
+queue_spsc_has_space(void *q) {
+	return queue_spsc_count((QueueSpsc*)q) <= ((QueueSpsc*)q)->mask || __atomic_load_n(&((QueueSpsc*)q)->closed, __ATOMIC_ACQUIRE);
+}
+
+/* adapters for queue_block. item points at a QueueSpscBatch */
+typedef struct QueueSpscBatch {
+	unsigned char *items;
+	size_t n, done;
+} QueueSpscBatch;
+
+static int
+queue_spsc_push_op(void *q, void *arg) {
+	QueueSpscBatch *b = (QueueSpscBatch*)arg;
+	b->done += queue_spsc_push((QueueSpsc*)q, b->items + b->done * ((QueueSpsc*)q)->size, b->n - b->done);
+	return b->done == b->n;
+}
+
+static int
+queue_spsc_pop_op(void *q, void *arg) {
+	QueueSpscBatch *b = (QueueSpscBatch*)arg;
+	b->done = queue_spsc_pop((QueueSpsc*)q, b->items, b->n);
+	return b->done > 0;
+}
+
+QUEUE_API size_t
+queue_spsc_push_wait(QueueSpsc *q, const void *items, size_t n, int timeout_ms) {
+	QueueSpscBatch b = {(unsigned char*)items, n, 0};
+	if(__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) return 0;
+	queue_block(&q->writers, &q->closed, queue_spsc_push_op, queue_spsc_has_space, q, &b, timeout_ms);
+	return b.done;
+}
+
+QUEUE_API size_t
+queue_spsc_pop_wait(QueueSpsc *q, void *items, size_t max, int timeout_ms) {
+	QueueSpscBatch b = {(unsigned char*)items, max, 0};
+	if(!max) return 0;
+	if(!queue_block(&q->readers, &q->closed, queue_spsc_pop_op, queue_spsc_has_items, q, &b, timeout_ms))
+		b.done = queue_spsc_pop(q, items, max);
+	return b.done;
+}
+
+QUEUE_API void
+queue_spsc_close(QueueSpsc *q) {
+	__atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+	queue_notify(&q->readers, INT_MAX);
+	queue_notify(&q->writers, INT_MAX);
+}
+
+#endif
+#ifdef QUEUE_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+#include "thread.h"
+#include "now.h"
+
+#define ITEMS 2000000
+
+typedef struct Item {
+	uint64_t value;
+	uint64_t producer;
+} Item;
+
+static QueueMpmc mpmc;
+static QueueSpsc spsc;
+static int nproducers, nconsumers;
+static uint64_t consumed_sum, consumed_count;
+
+static int mpmc_producer(void *arg) {
+	Item item;
+	item.producer = (uint64_t)(uintptr_t)arg;
+	for(uint64_t i=item.producer;i<ITEMS;i+=nproducers) {
+		item.value = i;
+		queue_mpmc_push_wait(&mpmc, &item, -1);
+	}
+	return 0;
+}
+
+static int mpmc_consumer(void *arg) {
+	Item item;
+	uint64_t sum = 0, count = 0;
+	(void)arg;
+	while(queue_mpmc_pop_wait(&mpmc, &item, -1)) {
+		sum += item.value;
+		count++;
+	}
+	__atomic_fetch_add(&consumed_sum, sum, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&consumed_count, count, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void mpmc_bench(int producers, int consumers) {
+	thrd_t p[16], c[16];
+	nproducers = producers;
+	nconsumers = consumers;
+	consumed_sum = consumed_count = 0;
+	queue_mpmc_init(&mpmc, 1024, sizeof(Item));
+	double t = now();
+	for(int i=0;i<consumers;i++) thrd_create(&c[i], mpmc_consumer, 0);
+	for(int i=0;i<producers;i++) thrd_create(&p[i], mpmc_producer, (void*)(uintptr_t)i);
+	for(int i=0;i<producers;i++) thrd_join(p[i], 0);
+	queue_mpmc_close(&mpmc);
+	for(int i=0;i<consumers;i++) thrd_join(c[i], 0);
+	t = now() - t;
+	printf("mpmc %dx%d: %.1fM items/s\n", producers, consumers, ITEMS / t / 1e6);
+	assert(consumed_count == ITEMS);
+	assert(consumed_sum == (uint64_t)ITEMS * (ITEMS - 1) / 2);
+	queue_mpmc_free(&mpmc);
+}
+
+static size_t spsc_batch;
+
+static int spsc_producer(void *arg) {
+	uint64_t buf[256];
+	(void)arg;
+	for(uint64_t i=0;i<ITEMS;) {
+		size_t n = 0;
+		while(n < spsc_batch && i < ITEMS) buf[n++] = i++;
+		queue_spsc_push_wait(&spsc, buf, n, -1);
+	}
+	queue_spsc_close(&spsc);
+	return 0;
+}
+
+static void spsc_bench(size_t batch) {
+	uint64_t buf[256], sum = 0, count = 0;
+	size_t n;
+	thrd_t p;
+	spsc_batch = batch;
+	queue_spsc_init(&spsc, 4096, sizeof(uint64_t));
+	double t = now();
+	thrd_create(&p, spsc_producer, 0);
+	while((n = queue_spsc_pop_wait(&spsc, buf, batch, -1)))
+		for(size_t i=0;i<n;i++) {
+			assert(buf[i] == count);
+			sum += buf[i];
+			count++;
+		}
+	thrd_join(p, 0);
+	t = now() - t;
+	printf("spsc batch %zu: %.1fM items/s\n", batch, ITEMS / t / 1e6);
+	assert(count == ITEMS);
+	queue_spsc_free(&spsc);
+}
+
+int main(void) {
+	QueueMpmc q;
+	Item item;
+	queue_mpmc_init(&q, 3, sizeof item);
+	for(uint64_t i=0;i<4;i++) {
+		item.value = i;
+		assert(queue_mpmc_push(&q, &item));
+	}
+	assert(!queue_mpmc_push(&q, &item));
+	assert(queue_mpmc_count(&q) == 4);
+	for(uint64_t i=0;i<4;i++) {
+		assert(queue_mpmc_pop(&q, &item));
+		assert(item.value == i);
+	}
+	assert(!queue_mpmc_pop(&q, &item));
+	assert(!queue_mpmc_pop_wait(&q, &item, 10));
+	queue_mpmc_free(&q);
+
+	/* contention. more threads than cores shows the cost of parking */
+	mpmc_bench(1, 1);
+	mpmc_bench(2, 2);
+	mpmc_bench(4, 4);
+	mpmc_bench(8, 1);
+	mpmc_bench(1, 8);
+	spsc_bench(1);
+	spsc_bench(16);
+	spsc_bench(256);
+	return 0;
+}
+#endif
+/* Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
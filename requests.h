@@ -31,12 +31,141 @@ REQUESTS_API int request_run(struct Request* req);
 REQUESTS_API void request_decompress(struct Request*);
 REQUESTS_API void request_destroy(struct Request* req);
 
+/* called with each chunk of the response body instead of collecting the body
+   for request_data(). chunks are already decompressed if request_decompress() was called.
+   return non-zero to abort the transfer */
+typedef int (*request_sink_fn)(void *ctx, const char *data, size_t ndata);
+/* copy up to nbuf bytes of the request body into buf.
+   return number of bytes copied, 0 at end of body or < 0 to abort the transfer */
+typedef ptrdiff_t (*request_source_fn)(void *ctx, char *buf, size_t nbuf);
+
+REQUESTS_API void request_sink(struct Request *req, request_sink_fn sink, void *ctx);
+/* same as request_post() but the body is read incrementally from source while sending.
+   ndata is the body length or < 0 when unknown and the body is sent chunked */
+REQUESTS_API void request_post_source(struct Request *req, const char *content_type, const char *content_encoding,
+    request_source_fn source, void *ctx, ptrdiff_t ndata);
+
+/* completion queue for requests started with request_submit() */
+struct RequestQueue;
+typedef struct RequestQueue RequestQueue;
+/* called when a request completes */
+typedef void (*request_done_fn)(struct Request *req, void *ctx);
+/* runs fn(ctx) somewhere else, e.g. threadpool_run */
+typedef void (*request_executor_fn)(void (*fn)(void *ctx), void *ctx);
+
+REQUESTS_API RequestQueue* requests_queue_new(void);
+/* does not destroy requests still in the queue */
+REQUESTS_API void requests_queue_destroy(RequestQueue *q);
+/* start req and return immediately. when it completes it is added to q if q is not null
+   and the request_oncomplete() callback runs. do not pass submitted requests to requests_run() */
+REQUESTS_API void request_submit(struct Request *req, RequestQueue *q);
+/* return a completed request or null if there are none */
+REQUESTS_API struct Request* requests_poll(RequestQueue *q);
+/* wait up to timeout_ms (< 0 forever) for any completed request. returns null on timeout */
+REQUESTS_API struct Request* requests_wait(RequestQueue *q, int timeout_ms);
+/* set completion callback. it runs on the requests thread and must not block
+   unless an executor is set with requests_executor() */
+REQUESTS_API void request_oncomplete(struct Request *req, request_done_fn done, void *ctx);
+/* run completion callbacks with exec instead of on the requests thread. null to reset */
+REQUESTS_API void requests_executor(request_executor_fn exec);
+
+/* connection pool with its own limits and background thread */
+struct RequestsClient;
+typedef struct RequestsClient RequestsClient;
+/* zero fields use the default */
+typedef struct RequestsConfig {
+    long max_host_connections;  /* default 4 */
+    long max_total_connections; /* default 1024 */
+    long max_idle_connections;  /* size of the connection cache. default curl's */
+    long max_streams;           /* concurrent HTTP/2 streams per connection. default curl's (100) */
+    int http2;                  /* negotiate HTTP/2 over TLS and multiplex requests on a connection */
+    long keepalive_idle;        /* seconds before the first TCP keepalive probe. default 900 */
+    long keepalive_interval;    /* seconds between TCP keepalive probes. default 60 */
+    long max_connection_age;    /* seconds an idle connection may still be reused. default curl's (118) */
+    long dns_cache_timeout;     /* seconds. default curl's (60) */
+    long connect_timeout;       /* seconds. default 10 */
+    size_t max_idle_handles;    /* easy handles of destroyed requests kept for reuse. default 64 */
+} RequestsConfig;
+
+/* config may be null. DNS and TLS session caches are shared by all clients */
+REQUESTS_API RequestsClient* requests_client_new(const RequestsConfig *config);
+/* all requests created on c must be destroyed first */
+REQUESTS_API void requests_client_destroy(RequestsClient *c);
+/* same as request_new() but runs on c. request_new() uses a default client */
+REQUESTS_API struct Request* request_new_client(RequestsClient *c, const char *url);
+
+/* seconds. dns, connect, tls and first_byte count from the start of the transfer
+   so each includes the ones before it. zero when unknown or a connection was reused */
+typedef struct RequestTimings {
+    double queue;      /* submit until the transfer thread started it */
+    double dns;
+    double connect;
+    double tls;
+    double first_byte;
+    double total;      /* transfer time */
+    double elapsed;    /* submit until complete */
+    size_t bytes_in;   /* headers and body */
+    size_t bytes_out;
+    int redirects;
+    int retries;
+} RequestTimings;
+
+/* valid once the request completes */
+REQUESTS_API const RequestTimings* request_timings(struct Request *req);
+/* write per-host latency percentiles of completed requests to buf.
+   returns the length like snprintf */
+REQUESTS_API size_t requests_stats_dump(char *buf, size_t nbuf);
+REQUESTS_API void requests_stats_reset(void);
+
+/* fail with "Deadline exceeded" unless complete within ms of being submitted,
+   including queueing and retries. 0 disables */
+REQUESTS_API void request_deadline(struct Request *req, long ms);
+/* retry connection errors and 429/5xx responses up to retries times. the wait before
+   attempt n is uniformly random in [0, backoff_ms * 2^n). only requests that are not
+   POST and don't use a sink or source are retried */
+REQUESTS_API void request_retry(struct Request *req, int retries, long backoff_ms);
+/* send a duplicate when there is no response after ms and keep whichever succeeds first.
+   ms < 0 uses the p95 transfer time of the host from the request stats.
+   same restrictions as request_retry() */
+REQUESTS_API void request_hedge(struct Request *req, long ms);
+/* stop a submitted request. it completes with the error "Request cancelled"
+   unless it completed already */
+REQUESTS_API void request_cancel(struct Request *req);
+
+#ifdef STREAM_H
+/* stream.h adapters for request_sink() and request_post_source(). ctx is the Stream* */
+static int request_stream_sink(void *ctx, const char *data, size_t ndata) {
+    Stream *s = (Stream*)ctx;
+    return s->write(s, data, ndata) == (ssize_t)ndata ? 0 : -1;
+}
+static ptrdiff_t request_stream_source(void *ctx, char *buf, size_t nbuf) {
+    Stream *s = (Stream*)ctx;
+    return (ptrdiff_t)s->read(s, buf, nbuf);
+}
+#endif
+
 #endif
 
 #define REQUESTS_IMPLEMENTATION
 #ifdef REQUESTS_IMPLEMENTATION
+#include <stdint.h>
 #include <string.h>
 
+/* latency histogram metrics */
+enum {
+    REQUESTS_QUEUE,
+    REQUESTS_DNS,
+    REQUESTS_CONNECT,
+    REQUESTS_TLS,
+    REQUESTS_FIRST_BYTE,
+    REQUESTS_TOTAL,
+    REQUESTS_ELAPSED,
+    REQUESTS_METRICS
+};
+
+static void requests_record(const char *url, const struct RequestTimings *t);
+static double requests_host_quantile(const char *url, int metric, double q);
+
 static int request_strnstr(const char* haystack, size_t nhaystack, const char* needle) {
     size_t n = strlen(needle);
     for (int i = 0; i < (int)nhaystack && (size_t)i <= nhaystack - n; i++) {
@@ -93,10 +222,29 @@ struct Request {
     void *userctx;
     RequestHeader* headers;
     RequestOutputHeader *output_headers;
+    request_sink_fn sink;
+    void *sinkctx;
+    request_source_fn source;
+    void *sourcectx;
+    ptrdiff_t nsource;
+    RequestQueue *queue;
+    struct Request *qnext;
+    request_done_fn done;
+    void *donectx;
+    RequestTimings timings;
+    double submitted;
+    long deadline_ms;
+    volatile long cancelled;
     unsigned owns_input : 1;
     unsigned complete : 1;
 };
 
+struct RequestQueue {
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+    Request *head, *tail;
+};
+
 typedef struct RequestUrl {
     const char* scheme;
     size_t nscheme;
@@ -212,17 +360,89 @@ static int request_url_parse(RequestUrl* u, const char* url, size_t nurl) {
     return 0;
 }
 
+#define REQUESTS_SOURCE_CHUNK (64*1024)
+
+static request_executor_fn requests_exec;
+
+static double requests_now(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / freq.QuadPart;
+}
+
+static void request_done_run(void *ctx) {
+    Request *req = (Request*)ctx;
+    req->done(req, req->donectx);
+}
+
+/* hand a completed request to its waiter, queue or callback */
+static void request_finish(Request *req) {
+    RequestQueue *q = req->queue;
+    request_done_fn done = req->done;
+    /* winhttp has no per-phase timings. the connection is opened while sending */
+    req->timings.total = req->timings.elapsed = requests_now() - req->submitted;
+    requests_record(req->url, &req->timings);
+    AcquireSRWLockExclusive(&req->lock);
+    req->complete = 1;
+    WakeConditionVariable(&req->cond);
+    ReleaseSRWLockExclusive(&req->lock);
+    if (q) {
+        AcquireSRWLockExclusive(&q->lock);
+        req->qnext = 0;
+        if (q->tail) q->tail->qnext = req;
+        else q->head = req;
+        q->tail = req;
+        WakeConditionVariable(&q->cond);
+        ReleaseSRWLockExclusive(&q->lock);
+    }
+    if (done) {
+        if (requests_exec) requests_exec(request_done_run, req);
+        else done(req, req->donectx);
+    }
+}
+
+static void request_fail(Request *req, const char *error) {
+    req->error = strdup(error);
+    request_finish(req);
+}
+
+/* write next chunk of a streamed body. receive the response after the last one */
+static void request_write_source(Request *req) {
+    ptrdiff_t n;
+    if (!req->input) {
+        req->input = malloc(REQUESTS_SOURCE_CHUNK);
+        req->owns_input = 1;
+    }
+    n = req->source(req->sourcectx, req->input, REQUESTS_SOURCE_CHUNK);
+    if (n < 0) {
+        request_fail(req, "Request aborted by source");
+        return;
+    }
+    if (!n) {
+        WinHttpReceiveResponse(req->handle, 0);
+        return;
+    }
+    req->timings.bytes_out += n;
+    if (!WinHttpWriteData(req->handle, req->input, (DWORD)n, 0))
+        request_fail(req, "WinHttpWriteData failed");
+}
+
 static void request_callback(HINTERNET session, DWORD_PTR ctx, DWORD status, void* info, DWORD ninfo) {
     (void)session;
     Request* req = (Request*)ctx;
     // printf("callback: status=%u ninfo=%u\n", status, ninfo);
+    if (req->cancelled && !req->complete && status != WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING) {
+        request_fail(req, "Request cancelled");
+        return;
+    }
     switch (status) {
     case WINHTTP_CALLBACK_STATUS_DATA_AVAILABLE:
         ninfo = *(DWORD*)info;
         // printf("request have data: %zu + %u\n", req->noutput, ninfo);
         if (!ninfo) {
-            req->complete = 1;
-            WakeConditionVariable(&req->cond);
+            request_finish(req);
             break;
         }
         if (ninfo > req->output_capacity - req->noutput) {
@@ -238,14 +458,28 @@ static void request_callback(HINTERNET session, DWORD_PTR ctx, DWORD status, voi
         break;
     case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
         // printf("request read complete: %zu + %u\n", req->noutput, ninfo);
-        req->noutput += ninfo;
+        if (req->sink) {
+            /* output buffer is reused for every chunk */
+            if (ninfo && req->sink(req->sinkctx, req->output, ninfo)) {
+                request_fail(req, "Request aborted by sink");
+                break;
+            }
+        } else
+            req->noutput += ninfo;
+        req->timings.bytes_in += ninfo;
         /* fallthrough */
     case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
         // printf("request headers available\n");
+        if (!req->timings.first_byte)
+            req->timings.first_byte = requests_now() - req->submitted;
         WinHttpQueryDataAvailable(req->handle, 0);
         break;
     case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
         // printf("request send request\n");
+        if (req->source) {
+            request_write_source(req);
+            break;
+        }
         if (req->owns_input) {
             free(req->input);
             req->input = 0;
@@ -255,6 +489,7 @@ static void request_callback(HINTERNET session, DWORD_PTR ctx, DWORD status, voi
         break;
     case WINHTTP_CALLBACK_STATUS_WRITE_COMPLETE:
         // printf("request write complete\n");
+        if (req->source) request_write_source(req);
         break;
     case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR: {
         // printf("request callback error\n");
@@ -262,8 +497,7 @@ static void request_callback(HINTERNET session, DWORD_PTR ctx, DWORD status, voi
         // printf("error code=%u\n", r->dwError);
         req->error = request_geterror(r->dwError);
         // printf("error: %s\n", req->error);
-        req->complete = 1;
-        WakeConditionVariable(&req->cond);
+        request_finish(req);
     } break;
     default:
         // printf("request unhandled callback\n");
@@ -387,6 +621,48 @@ REQUESTS_API Request* request_new(const char* url) {
     return req;
 }
 
+struct RequestsClient {
+    RequestsConfig config;
+};
+
+#ifndef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+#define WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL 133
+#endif
+#ifndef WINHTTP_PROTOCOL_FLAG_HTTP2
+#define WINHTTP_PROTOCOL_FLAG_HTTP2 0x1
+#endif
+
+/* winhttp pools connections, DNS and TLS sessions itself per session handle.
+   there is one session so a client only applies its limits to that */
+REQUESTS_API RequestsClient* requests_client_new(const RequestsConfig *config) {
+    RequestsClient *c = calloc(1, sizeof *c);
+    if (config) c->config = *config;
+    request_init();
+    if (c->config.max_host_connections) {
+        DWORD n = (DWORD)c->config.max_host_connections;
+        WinHttpSetOption(request_session, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &n, sizeof n);
+        WinHttpSetOption(request_session, WINHTTP_OPTION_MAX_CONNS_PER_1_0_SERVER, &n, sizeof n);
+    }
+    if (c->config.http2) {
+        DWORD flags = WINHTTP_PROTOCOL_FLAG_HTTP2;
+        WinHttpSetOption(request_session, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &flags, sizeof flags);
+    }
+    if (c->config.connect_timeout) {
+        DWORD ms = (DWORD)c->config.connect_timeout * 1000;
+        WinHttpSetOption(request_session, WINHTTP_OPTION_CONNECT_TIMEOUT, &ms, sizeof ms);
+    }
+    return c;
+}
+
+REQUESTS_API void requests_client_destroy(RequestsClient *c) {
+    free(c);
+}
+
+REQUESTS_API Request* request_new_client(RequestsClient *c, const char *url) {
+    (void)c;
+    return request_new(url);
+}
+
 /* for RTools40 mingw64 */
 #ifndef WINHTTP_OPTION_DECOMPRESSION
 #define WINHTTP_OPTION_DECOMPRESSION 118
@@ -475,109 +751,275 @@ REQUESTS_API void request_post(
     request_addheader(req, "Content-Length: ", buf);
 }
 
+REQUESTS_API void request_post_source(
+    Request *req,
+    const char *content_type,
+    const char *content_encoding,
+    request_source_fn source,
+    void *ctx,
+    ptrdiff_t ndata)
+{
+    free(req->verb);
+    req->verb = strdup("POST");
+    if(req->owns_input) free(req->input);
+    req->input = 0;
+    req->ninput = 0;
+    req->owns_input = 0;
+    req->source = source;
+    req->sourcectx = ctx;
+    req->nsource = ndata;
 
-REQUESTS_API void requests_run(Request** reqs, size_t nreqs) {
-    for(size_t ireq=0;ireq<nreqs;ireq++) {
-        Request *req = reqs[ireq];
-        RequestUrl u;
-        if (request_url_parse(&u, req->url, 0)) {
-            req->complete = 1;
-            req->error = strdup("Erorr parsing URL");
-            continue;
-        }
-        int port;
-        if (u.nport)
-            port = 0;
-        else if (!strncmp(u.scheme, "http", u.nscheme))
-            port = 80;
-        else if (!strncmp(u.scheme, "https", u.nscheme))
-            port = 443;
-        for (size_t i = 0; i < u.nport; i++) {
-            port *= 10;
-            port += u.port[i] - '0';
-        }
-        // printf("port=%d from '%.*s'\n", port, (int)u.nport, u.port);
-        HINTERNET conn = request_connect(u.host, u.nhost, port);
-        if (!conn) {
-            req->complete = 1;
-            req->error = strdup("Error creating connection");
-            continue;
-        }
-        const char* verb = req->verb ? req->verb : "GET";
-        wchar_t vbuf[16];
-        size_t i = 0;
-        for (const char* p = verb; *p; ++p, ++i)
-            vbuf[i] = toupper(*p);
-        vbuf[i] = 0;
-        // printf("cverb='%s'\n", verb);
-        if (request_url_parse(&u, req->url, 0)) {
-            req->complete = 1;
-            req->error = strdup("Erorr parsing URL");
-            continue;
-        }
-        int n = MultiByteToWideChar(CP_UTF8, 0, u.path, (int)(req->url - u.path), 0, 0);
-        assert(n >= 0);
-        wchar_t* pbuf = malloc((n + 1) * sizeof(wchar_t));
-        MultiByteToWideChar(CP_UTF8, 0, u.path, (int)(req->url - u.path), pbuf, (int)n);
-        pbuf[n] = 0;
-        // printf("verb='%ls'\n", vbuf);
-        // printf("pbuf=%ls\n", pbuf);
-        // printf("scheme=%.*s\n", (int)u.nscheme, u.scheme);
-        DWORD flag = (u.nscheme == 5 && !memcmp(u.scheme, "https", 5)) ? WINHTTP_FLAG_SECURE : 0;
-        // printf("flag=%u\n", flag);
-        req->handle = WinHttpOpenRequest(
-            conn,
-            vbuf,
-            n ? pbuf : 0,
-            L"HTTP/1.1",
-            WINHTTP_NO_REFERER,
-            WINHTTP_DEFAULT_ACCEPT_TYPES,
-            flag);
-        free(pbuf);
-        if (!req->handle) {
-            req->complete = 1;
-            req->error = strdup("WinHttpOpenRequest failed");
-            continue;
-        }
+    if(content_type) request_addheader(req, "Content-Type: ", content_type);
+    if(content_encoding) request_addheader(req, "Content-Encoding: ", content_encoding);
+    if(ndata >= 0) {
+        char buf[64];
+        snprintf(buf, sizeof buf, "%zu", (size_t)ndata);
+        request_addheader(req, "Content-Length: ", buf);
+    }
+}
+
+REQUESTS_API void request_sink(Request *req, request_sink_fn sink, void *ctx) {
+    req->sink = sink;
+    req->sinkctx = ctx;
+}
 
-        for (RequestHeader* h = req->headers; h; h = h->next) {
-            // printf("adding header='%ls'\n", h->header);
-            if (!WinHttpAddRequestHeaders(
-                    req->handle,
-                    h->header,
-                    -1,
-                    WINHTTP_ADDREQ_FLAG_REPLACE | WINHTTP_ADDREQ_FLAG_ADD)) {
-                printf("adding headers failed: %d\n", (int)GetLastError());
+/* winhttp needs the total length up front. read a body of unknown length into memory */
+static int request_drain_source(Request *req) {
+    size_t cap = REQUESTS_SOURCE_CHUNK;
+    char *p = malloc(cap);
+    ptrdiff_t n;
+    req->ninput = 0;
+    if(!p) {
+        req->error = strdup("Out of memory reading request body");
+        return -1;
+    }
+    for(;;) {
+        if(cap - req->ninput < REQUESTS_SOURCE_CHUNK) {
+            char *tmp = realloc(p, cap * 2);
+            if(!tmp) {
+                /* sending what was read would be a truncated body */
+                free(p);
+                req->ninput = 0;
+                req->source = 0;
+                req->error = strdup("Out of memory reading request body");
+                return -1;
             }
+            p = tmp;
+            cap *= 2;
         }
+        n = req->source(req->sourcectx, p + req->ninput, cap - req->ninput);
+        if(n <= 0) break;
+        req->ninput += n;
+    }
+    req->input = p;
+    req->owns_input = 1;
+    req->source = 0;
+    if(n < 0) {
+        req->error = strdup("Request aborted by source");
+        return -1;
+    }
+    char buf[64];
+    snprintf(buf, sizeof buf, "%zu", req->ninput);
+    request_addheader(req, "Content-Length: ", buf);
+    return 0;
+}
 
-        // printf("request opened\n");
-        if (!WinHttpSendRequest(req->handle,
-                WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                req->ninput ? req->input : WINHTTP_NO_REQUEST_DATA,
-                (DWORD)req->ninput,
-                0,
-                (DWORD_PTR)req)) {
-            char buf[1024];
-            snprintf(buf, sizeof buf, "WinHttpSendRequest failed: winhttp code=%d\n", (int)GetLastError());
-            req->complete = 1;
-            req->error = strdup(buf);
-            continue;
+/* send the request. completion is reported from request_callback */
+static int request_start(Request *req) {
+    RequestUrl u;
+    memset(&req->timings, 0, sizeof req->timings);
+    req->submitted = requests_now();
+    if (req->source && req->nsource < 0 && request_drain_source(req))
+        return -1;
+    if (request_url_parse(&u, req->url, 0)) {
+        req->error = strdup("Erorr parsing URL");
+        return -1;
+    }
+    int port;
+    if (u.nport)
+        port = 0;
+    else if (!strncmp(u.scheme, "http", u.nscheme))
+        port = 80;
+    else if (!strncmp(u.scheme, "https", u.nscheme))
+        port = 443;
+    for (size_t i = 0; i < u.nport; i++) {
+        port *= 10;
+        port += u.port[i] - '0';
+    }
+    // printf("port=%d from '%.*s'\n", port, (int)u.nport, u.port);
+    HINTERNET conn = request_connect(u.host, u.nhost, port);
+    if (!conn) {
+        req->error = strdup("Error creating connection");
+        return -1;
+    }
+    const char* verb = req->verb ? req->verb : "GET";
+    wchar_t vbuf[16];
+    size_t i = 0;
+    for (const char* p = verb; *p; ++p, ++i)
+        vbuf[i] = toupper(*p);
+    vbuf[i] = 0;
+    // printf("cverb='%s'\n", verb);
+    if (request_url_parse(&u, req->url, 0)) {
+        req->error = strdup("Erorr parsing URL");
+        return -1;
+    }
+    int n = MultiByteToWideChar(CP_UTF8, 0, u.path, (int)(req->url - u.path), 0, 0);
+    assert(n >= 0);
+    wchar_t* pbuf = malloc((n + 1) * sizeof(wchar_t));
+    MultiByteToWideChar(CP_UTF8, 0, u.path, (int)(req->url - u.path), pbuf, (int)n);
+    pbuf[n] = 0;
+    // printf("verb='%ls'\n", vbuf);
+    // printf("pbuf=%ls\n", pbuf);
+    // printf("scheme=%.*s\n", (int)u.nscheme, u.scheme);
+    DWORD flag = (u.nscheme == 5 && !memcmp(u.scheme, "https", 5)) ? WINHTTP_FLAG_SECURE : 0;
+    // printf("flag=%u\n", flag);
+    req->handle = WinHttpOpenRequest(
+        conn,
+        vbuf,
+        n ? pbuf : 0,
+        L"HTTP/1.1",
+        WINHTTP_NO_REFERER,
+        WINHTTP_DEFAULT_ACCEPT_TYPES,
+        flag);
+    free(pbuf);
+    if (!req->handle) {
+        req->error = strdup("WinHttpOpenRequest failed");
+        return -1;
+    }
+
+    if (req->deadline_ms > 0) {
+        /* winhttp has no overall deadline. bound each phase instead */
+        int ms = (int)req->deadline_ms;
+        WinHttpSetTimeouts(req->handle, ms, ms, ms, ms);
+    }
+
+    for (RequestHeader* h = req->headers; h; h = h->next) {
+        // printf("adding header='%ls'\n", h->header);
+        if (!WinHttpAddRequestHeaders(
+                req->handle,
+                h->header,
+                -1,
+                WINHTTP_ADDREQ_FLAG_REPLACE | WINHTTP_ADDREQ_FLAG_ADD)) {
+            printf("adding headers failed: %d\n", (int)GetLastError());
         }
     }
 
+    // printf("request opened\n");
+    req->timings.bytes_out = req->ninput;
+    if (!WinHttpSendRequest(req->handle,
+            WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+            req->ninput ? req->input : WINHTTP_NO_REQUEST_DATA,
+            (DWORD)req->ninput,
+            req->source ? (DWORD)req->nsource : 0,
+            (DWORD_PTR)req)) {
+        char buf[1024];
+        snprintf(buf, sizeof buf, "WinHttpSendRequest failed: winhttp code=%d\n", (int)GetLastError());
+        req->error = strdup(buf);
+        return -1;
+    }
+    return 0;
+}
+
+REQUESTS_API void requests_run(Request** reqs, size_t nreqs) {
+    for(size_t i=0;i<nreqs;i++) {
+        Request *req = reqs[i];
+        req->complete = 0;
+        if (request_start(req)) request_finish(req);
+    }
+
     for(size_t i=0;i<nreqs;i++) {
         Request *req = reqs[i];
         // printf("request sent\n");
-        int done = 0;
-        do {
-            // printf("waiting\n");
-            AcquireSRWLockExclusive(&req->lock);
+        AcquireSRWLockExclusive(&req->lock);
+        while (!req->complete)
             SleepConditionVariableSRW(&req->cond, &req->lock, INFINITE, 0);
-            done = req->complete;
-            ReleaseSRWLockExclusive(&req->lock);
-        } while(!done);
+        ReleaseSRWLockExclusive(&req->lock);
+    }
+}
+
+REQUESTS_API void request_submit(Request *req, RequestQueue *q) {
+    req->queue = q;
+    req->complete = 0;
+    if (request_start(req)) request_finish(req);
+}
+
+REQUESTS_API RequestQueue* requests_queue_new(void) {
+    RequestQueue *q = calloc(1, sizeof *q);
+    InitializeSRWLock(&q->lock);
+    InitializeConditionVariable(&q->cond);
+    return q;
+}
+
+REQUESTS_API void requests_queue_destroy(RequestQueue *q) {
+    free(q);
+}
+
+static Request* requests_pop(RequestQueue *q) {
+    Request *req = q->head;
+    if (req) {
+        q->head = req->qnext;
+        if (!q->head) q->tail = 0;
+        req->qnext = 0;
+    }
+    return req;
+}
+
+REQUESTS_API Request* requests_poll(RequestQueue *q) {
+    AcquireSRWLockExclusive(&q->lock);
+    Request *req = requests_pop(q);
+    ReleaseSRWLockExclusive(&q->lock);
+    return req;
+}
+
+REQUESTS_API Request* requests_wait(RequestQueue *q, int timeout_ms) {
+    DWORD end = GetTickCount() + (DWORD)timeout_ms;
+    AcquireSRWLockExclusive(&q->lock);
+    while (!q->head) {
+        DWORD wait = INFINITE;
+        if (timeout_ms >= 0) {
+            DWORD now = GetTickCount();
+            if ((int)(end - now) <= 0) break;
+            wait = end - now;
+        }
+        SleepConditionVariableSRW(&q->cond, &q->lock, wait, 0);
     }
+    Request *req = requests_pop(q);
+    ReleaseSRWLockExclusive(&q->lock);
+    return req;
+}
+
+REQUESTS_API void request_oncomplete(Request *req, request_done_fn done, void *ctx) {
+    req->done = done;
+    req->donectx = ctx;
+}
+
+REQUESTS_API const RequestTimings* request_timings(Request *req) {
+    return &req->timings;
+}
+
+REQUESTS_API void request_deadline(Request *req, long ms) {
+    req->deadline_ms = ms;
+}
+
+/* retries and hedging need the multi loop of the curl backend */
+REQUESTS_API void request_retry(Request *req, int retries, long backoff_ms) {
+    (void)req;
+    (void)retries;
+    (void)backoff_ms;
+}
+
+REQUESTS_API void request_hedge(Request *req, long ms) {
+    (void)req;
+    (void)ms;
+}
+
+/* takes effect on the next winhttp callback */
+REQUESTS_API void request_cancel(Request *req) {
+    InterlockedExchange(&req->cancelled, 1);
+}
+
+REQUESTS_API void requests_executor(request_executor_fn exec) {
+    requests_exec = exec;
 }
 
 REQUESTS_API int request_run(Request *req) {
@@ -695,6 +1137,7 @@ REQUESTS_API char* request_error(Request *req) {
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #ifdef REQUESTS_HAVE_CURL_H
 #include <curl/curl.h>
@@ -705,7 +1148,12 @@ extern "C" {
 typedef int64_t curl_off_t;
 typedef void CURL;
 typedef void CURLM;
+typedef void CURLSH;
 typedef int CURLcode;
+typedef int CURLSHcode;
+typedef int CURLSHoption;
+typedef int curl_lock_data;
+typedef int curl_lock_access;
 typedef int CURLMcode;
 typedef int CURLMSG;
 typedef int CURLMoption;
@@ -753,6 +1201,11 @@ CURLcode curl_easy_setopt(CURL *curl, CURLoption option, ...);
 void curl_easy_cleanup(CURL *curl);
 void curl_slist_free_all(struct curl_slist *);
 CURLcode curl_easy_getinfo(CURL *curl, CURLINFO info, ...);
+void curl_easy_reset(CURL *curl);
+CURL *curl_easy_duphandle(CURL *curl);
+CURLSH *curl_share_init(void);
+CURLSHcode curl_share_setopt(CURLSH *share, CURLSHoption option, ...);
+CURLSHcode curl_share_cleanup(CURLSH *share);
 CURLMcode curl_multi_add_handle(CURLM *multi_handle, CURL *curl_handle);
 #define CURLE_OK 0
 #define CURLMSG_DONE 1
@@ -784,11 +1237,42 @@ CURLMcode curl_multi_add_handle(CURLM *multi_handle, CURL *curl_handle);
 #define CURL_GLOBAL_ALL (CURL_GLOBAL_SSL|CURL_GLOBAL_WIN32)
 #define CURLOPT_VERBOSE 41
 #define CURLINFO_RESPONSE_CODE 2097154
+#define CURLINFO_EFFECTIVE_URL 1048577
+#define CURLINFO_HEADER_SIZE 2097163
+#define CURLINFO_REQUEST_SIZE 2097164
+#define CURLINFO_REDIRECT_COUNT 2097172
+#define CURLINFO_SIZE_UPLOAD_T 6291463
+#define CURLINFO_SIZE_DOWNLOAD_T 6291464
+#define CURLINFO_TOTAL_TIME_T 6291506
+#define CURLINFO_NAMELOOKUP_TIME_T 6291507
+#define CURLINFO_CONNECT_TIME_T 6291508
+#define CURLINFO_STARTTRANSFER_TIME_T 6291510
+#define CURLINFO_APPCONNECT_TIME_T 6291512
 #define CURLOPT_POSTFIELDSIZE_LARGE 30120
 #define CURLOPT_POSTFIELDS 10015
 #define CURLOPT_COPYPOSTFIELDS 10165
+#define CURLOPT_POST 47
+#define CURLOPT_READDATA 10009
+#define CURLOPT_READFUNCTION 20012
+#define CURL_READFUNC_ABORT 0x10000000
+#define CURLOPT_SHARE 10100
+#define CURLOPT_DNS_CACHE_TIMEOUT 92
+#define CURLOPT_PIPEWAIT 237
+#define CURLOPT_MAXAGE_CONN 288
+#define CURLMOPT_MAXCONNECTS 6
+#define CURLMOPT_MAX_CONCURRENT_STREAMS 16
+#define CURLPIPE_MULTIPLEX 2
+#define CURLSHOPT_SHARE 1
+#define CURLSHOPT_LOCKFUNC 3
+#define CURLSHOPT_UNLOCKFUNC 4
+#define CURL_LOCK_DATA_DNS 3
+#define CURL_LOCK_DATA_SSL_SESSION 4
+/* oldest version with every option used here */
+#define LIBCURL_VERSION_MAJOR 7
+#define LIBCURL_VERSION_MINOR 67
 
 #define CURL_HTTP_VERSION_1_1 2
+#define CURL_HTTP_VERSION_2TLS 4
 #ifdef __cplusplus
 }
 #endif
@@ -813,97 +1297,527 @@ struct Request {
     size_t output_capacity;
     void *userctx;
     RequestHeader *output_headers;
+    request_sink_fn sink;
+    void *sinkctx;
+    request_source_fn source;
+    void *sourcectx;
+    RequestQueue *queue;
+    struct Request *qnext;
+    request_done_fn done;
+    void *donectx;
+    RequestsClient *client;
+    RequestTimings timings;
+    double submitted;
+    char *url;
+    long deadline_ms;
+    long backoff_ms;
+    long hedge_ms;
+    int retries;
+    int attempt;
+    /* absolute times, 0 when unset */
+    double deadline;
+    double retry_at;
+    double hedge_at;
+    double timer;            /* earliest of the above */
+    size_t heap;             /* index in client timers + 1. 0 when not scheduled */
+    struct Request *hedge;   /* duplicate racing this request */
+    struct Request *primary; /* set on a duplicate */
+    struct Request *cnext;   /* client cancel list */
+    char idempotent;
+    char in_multi;
+    char duplicated; /* curl handle came from curl_easy_duphandle */
+    /* protected by client mtx */
+    char active;
+    char cancel_pending;
     unsigned complete : 1;
 };
 
-static pthread_mutex_t requests_incoming_mtx = PTHREAD_MUTEX_INITIALIZER;
-static Request *requests_incoming;
-static CURLM *requests_multi;
-static int requests_waiter;
-static int requests_wakeup;
+struct RequestQueue {
+    pthread_mutex_t mtx;
+    pthread_cond_t cnd;
+    Request *head, *tail;
+};
 
+struct RequestsClient {
+    RequestsConfig config;
+    /* protects incoming, cancelled, idle and Request.active */
+    pthread_mutex_t mtx;
+    Request *incoming;
+    Request *cancelled;
+    CURL **idle;
+    size_t nidle;
+    /* min-heap on Request.timer. used by the multi thread only */
+    Request **timers;
+    size_t ntimers;
+    size_t ctimers;
+    unsigned seed;
+    CURLM *multi;
+    int waiter;
+    int wakeup;
+    /* set while a wakeup byte is unread so a burst of submits writes only once */
+    int wakeup_pending;
+    int stop;
+    pthread_t thread;
+};
 
-static void* requests_threadrun(void *ctx) {
-    (void)ctx;
-    requests_multi = curl_multi_init();
-    if(!requests_multi) {
-        printf("creating multi handle failed\n");
-        abort();
+static double requests_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double request_info_time(CURL *curl, CURLINFO info) {
+    curl_off_t us = 0;
+    curl_easy_getinfo(curl, info, &us);
+    return us * 1e-6;
+}
+
+static void request_info_timings(Request *req) {
+    RequestTimings *t = &req->timings;
+    curl_off_t n = 0;
+    long size = 0;
+    char *url = 0;
+    t->dns = request_info_time(req->curl, CURLINFO_NAMELOOKUP_TIME_T);
+    t->connect = request_info_time(req->curl, CURLINFO_CONNECT_TIME_T);
+    t->tls = request_info_time(req->curl, CURLINFO_APPCONNECT_TIME_T);
+    t->first_byte = request_info_time(req->curl, CURLINFO_STARTTRANSFER_TIME_T);
+    t->total = request_info_time(req->curl, CURLINFO_TOTAL_TIME_T);
+    t->elapsed = requests_now() - req->submitted;
+    curl_easy_getinfo(req->curl, CURLINFO_SIZE_DOWNLOAD_T, &n);
+    curl_easy_getinfo(req->curl, CURLINFO_HEADER_SIZE, &size);
+    t->bytes_in = (size_t)n + size;
+    n = 0;
+    size = 0;
+    curl_easy_getinfo(req->curl, CURLINFO_SIZE_UPLOAD_T, &n);
+    curl_easy_getinfo(req->curl, CURLINFO_REQUEST_SIZE, &size);
+    t->bytes_out = (size_t)n + size;
+    size = 0;
+    curl_easy_getinfo(req->curl, CURLINFO_REDIRECT_COUNT, &size);
+    t->redirects = (int)size;
+    curl_easy_getinfo(req->curl, CURLINFO_EFFECTIVE_URL, &url);
+    if(url) requests_record(url, t);
+}
+
+static RequestsClient requests_default;
+static CURLSH *requests_share;
+/* indexed by curl_lock_data */
+static pthread_mutex_t requests_share_mtx[8];
+static request_executor_fn requests_exec;
+
+static void request_done_run(void *ctx) {
+    Request *req = (Request*)ctx;
+    req->done(req, req->donectx);
+}
+
+/* hand a completed request to its waiter, queue or callback */
+static void request_finish(Request *req) {
+    RequestQueue *q = req->queue;
+    request_done_fn done = req->done;
+    pthread_mutex_lock(&req->mtx);
+    req->complete = 1;
+    pthread_cond_signal(&req->cnd);
+    pthread_mutex_unlock(&req->mtx);
+    if(q) {
+        pthread_mutex_lock(&q->mtx);
+        req->qnext = 0;
+        if(q->tail) q->tail->qnext = req;
+        else q->head = req;
+        q->tail = req;
+        pthread_cond_signal(&q->cnd);
+        pthread_mutex_unlock(&q->mtx);
+    }
+    if(done) {
+        if(requests_exec) requests_exec(request_done_run, req);
+        else done(req, req->donectx);
     }
+}
 
-#if LIBCURL_VERSION_MAJOR > 7 || (LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR >= 30)
-    long max_concurrent = 1024;
-    curl_multi_setopt(requests_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_concurrent);
-    curl_multi_setopt(requests_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)4);
-    curl_multi_setopt(requests_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
-#endif
 
+static void request_destroyheaders(Request *req);
+
+static void requests_heap_set(RequestsClient *c, size_t i, Request *req) {
+    c->timers[i] = req;
+    req->heap = i + 1;
+}
+
+static void requests_heap_up(RequestsClient *c, size_t i) {
+    Request *req = c->timers[i];
+    while(i) {
+        size_t parent = (i - 1) / 2;
+        if(c->timers[parent]->timer <= req->timer) break;
+        requests_heap_set(c, i, c->timers[parent]);
+        i = parent;
+    }
+    requests_heap_set(c, i, req);
+}
+
+static void requests_heap_down(RequestsClient *c, size_t i) {
+    Request *req = c->timers[i];
     for(;;) {
-        pthread_mutex_lock(&requests_incoming_mtx);
-        for(Request *req = requests_incoming;req;req=req->next) {
+        size_t child = 2 * i + 1;
+        if(child >= c->ntimers) break;
+        if(child + 1 < c->ntimers && c->timers[child + 1]->timer < c->timers[child]->timer) child++;
+        if(req->timer <= c->timers[child]->timer) break;
+        requests_heap_set(c, i, c->timers[child]);
+        i = child;
+    }
+    requests_heap_set(c, i, req);
+}
+
+static void requests_heap_remove(RequestsClient *c, Request *req) {
+    size_t i = req->heap - 1;
+    Request *last = c->timers[--c->ntimers];
+    req->heap = 0;
+    if(last != req) {
+        requests_heap_set(c, i, last);
+        requests_heap_down(c, i);
+        requests_heap_up(c, last->heap - 1);
+    }
+}
+
+/* schedule req for the earliest of its deadline, retry and hedge times */
+static void requests_timer_update(RequestsClient *c, Request *req) {
+    double t = req->deadline;
+    if(req->retry_at && (!t || req->retry_at < t)) t = req->retry_at;
+    if(req->hedge_at && (!t || req->hedge_at < t)) t = req->hedge_at;
+    if(!t) {
+        if(req->heap) requests_heap_remove(c, req);
+        return;
+    }
+    req->timer = t;
+    if(req->heap) {
+        requests_heap_down(c, req->heap - 1);
+        requests_heap_up(c, req->heap - 1);
+        return;
+    }
+    if(c->ntimers == c->ctimers) {
+        c->ctimers = c->ctimers ? c->ctimers * 2 : 64;
+        c->timers = (Request**)realloc(c->timers, c->ctimers * sizeof *c->timers);
+    }
+    c->timers[c->ntimers++] = req;
+    requests_heap_up(c, c->ntimers - 1);
+}
+
+static void request_attempt(RequestsClient *c, Request *r) {
+    curl_multi_add_handle(c->multi, r->curl);
+    r->in_multi = 1;
+}
+
+static void request_detach(RequestsClient *c, Request *r) {
+    if(r->in_multi) {
+        curl_multi_remove_handle(c->multi, r->curl);
+        r->in_multi = 0;
+    }
+}
+
+/* free a hedge duplicate */
+static void request_drop(RequestsClient *c, Request *dup) {
+    request_detach(c, dup);
+    curl_easy_cleanup(dup->curl);
+    free(dup->output);
+    free(dup->reason);
+    request_destroyheaders(dup);
+    free(dup);
+}
+
+static void request_hedge_arm(Request *req, double now) {
+    req->hedge_at = 0;
+    if(!req->idempotent || req->sink || req->source) return;
+    if(req->hedge_ms > 0)
+        req->hedge_at = now + req->hedge_ms * 1e-3;
+    else if(req->hedge_ms < 0) {
+        double p95 = requests_host_quantile(req->url, REQUESTS_TOTAL, 0.95);
+        if(p95 > 0) req->hedge_at = now + p95;
+    }
+}
+
+static void request_hedge_start(RequestsClient *c, Request *req) {
+    /* only while nothing has arrived */
+    if(!req->in_multi || req->hedge || req->noutput || req->output_headers) return;
+    Request *dup = (Request*)calloc(1, sizeof *dup);
+    dup->primary = req;
+    dup->client = c;
+    dup->curl = curl_easy_duphandle(req->curl);
+    if(!dup->curl) {
+        free(dup);
+        return;
+    }
+    curl_easy_setopt(dup->curl, CURLOPT_PRIVATE, dup);
+    curl_easy_setopt(dup->curl, CURLOPT_WRITEDATA, dup);
+    curl_easy_setopt(dup->curl, CURLOPT_HEADERDATA, dup);
+    req->hedge = dup;
+    request_attempt(c, dup);
+}
+
+/* req takes over the response and handle of dup */
+static void request_swap(Request *req, Request *dup) {
+    CURL *curl = req->curl;
+    char *output = req->output, *reason = req->reason;
+    size_t noutput = req->noutput, output_capacity = req->output_capacity;
+    RequestHeader *headers = req->output_headers;
+    req->curl = dup->curl;
+    req->output = dup->output;
+    req->noutput = dup->noutput;
+    req->output_capacity = dup->output_capacity;
+    req->output_headers = dup->output_headers;
+    req->reason = dup->reason;
+    dup->curl = curl;
+    dup->output = output;
+    dup->noutput = noutput;
+    dup->output_capacity = output_capacity;
+    dup->output_headers = headers;
+    dup->reason = reason;
+    req->duplicated = 1;
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(req->curl, CURLOPT_HEADERDATA, req);
+}
+
+static void request_complete(RequestsClient *c, Request *req, CURLcode result, const char *error) {
+    if(req->hedge) {
+        request_drop(c, req->hedge);
+        req->hedge = 0;
+    }
+    request_detach(c, req);
+    req->deadline = req->retry_at = req->hedge_at = 0;
+    if(req->heap) requests_heap_remove(c, req);
+    if(error) {
+        free(req->error);
+        req->error = strdup(error);
+    } else if(!req->noutput && result != CURLE_OK)
+        req->error = strdup(curl_easy_strerror(result));
+    request_info_timings(req);
+    pthread_mutex_lock(&c->mtx);
+    req->active = 0;
+    pthread_mutex_unlock(&c->mtx);
+    request_finish(req);
+}
+
+static int request_failed(Request *r, CURLcode result) {
+    long code = 0;
+    if(result != CURLE_OK) return 1;
+    curl_easy_getinfo(r->curl, CURLINFO_RESPONSE_CODE, &code);
+    return code >= 500 || code == 429;
+}
+
+/* schedule the next attempt. 0 when out of retries */
+static int request_retry_later(RequestsClient *c, Request *req) {
+    if(req->attempt >= req->retries || !req->idempotent || req->sink || req->source) return 0;
+    double now = requests_now();
+    double cap = req->backoff_ms * 1e-3 * (double)(1u << (req->attempt < 20 ? req->attempt : 20));
+    double delay = cap * (rand_r(&c->seed) / (RAND_MAX + 1.0)); /* full jitter */
+    if(req->deadline && now + delay >= req->deadline) return 0;
+    req->attempt++;
+    req->timings.retries++;
+    req->noutput = 0;
+    request_destroyheaders(req);
+    free(req->reason);
+    req->reason = 0;
+    req->hedge_at = 0;
+    req->retry_at = now + delay;
+    requests_timer_update(c, req);
+    return 1;
+}
+
+static void request_done(RequestsClient *c, CURL *curl, CURLcode result) {
+    Request *r;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, &r);
+    curl_multi_remove_handle(c->multi, curl);
+    r->in_multi = 0;
+    Request *req = r->primary ? r->primary : r;
+    int failed = request_failed(r, result);
+    if(r != req) {
+        req->hedge = 0;
+        if(failed && req->in_multi) {
+            /* the original may still succeed */
+            request_drop(c, r);
+            return;
+        }
+        request_detach(c, req);
+        request_swap(req, r);
+        request_drop(c, r);
+    } else if(req->hedge) {
+        if(failed) return; /* wait for the duplicate */
+        request_drop(c, req->hedge);
+        req->hedge = 0;
+    }
+    if(failed && request_retry_later(c, req)) return;
+    request_complete(c, req, result, 0);
+}
+
+static void requests_timers(RequestsClient *c) {
+    double now = requests_now();
+    while(c->ntimers && c->timers[0]->timer <= now) {
+        Request *req = c->timers[0];
+        if(req->deadline && req->deadline <= now) {
+            request_complete(c, req, CURLE_OK, "Deadline exceeded");
+            continue;
+        }
+        if(req->retry_at && req->retry_at <= now) {
+            req->retry_at = 0;
+            request_hedge_arm(req, now);
+            request_attempt(c, req);
+        }
+        if(req->hedge_at && req->hedge_at <= now) {
+            req->hedge_at = 0;
+            request_hedge_start(c, req);
+        }
+        requests_timer_update(c, req);
+    }
+}
+
+static void* requests_threadrun(void *ctx) {
+    RequestsClient *c = (RequestsClient*)ctx;
+    while(!__atomic_load_n(&c->stop, __ATOMIC_SEQ_CST)) {
+        /* clear before taking the list so a later submit writes a new wakeup */
+        __atomic_store_n(&c->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+        /* take both lists at once so a cancel is never seen before its submit */
+        Request *cancelled = 0;
+        pthread_mutex_lock(&c->mtx);
+        Request *incoming = c->incoming;
+        c->incoming = 0;
+        while(c->cancelled) {
+            Request *req = c->cancelled;
+            c->cancelled = req->cnext;
+            req->cancel_pending = 0;
+            if(req->active) {
+                req->cnext = cancelled;
+                cancelled = req;
+            }
+        }
+        pthread_mutex_unlock(&c->mtx);
+        double now = requests_now();
+        while(incoming) {
             //printf("adding new handle\n");
-            curl_multi_add_handle(requests_multi, req->curl);
+            Request *req = incoming;
+            incoming = req->next;
+            req->next = 0;
+            req->timings.queue = now - req->submitted;
+            req->attempt = 0;
+            req->retry_at = 0;
+            req->deadline = req->deadline_ms > 0 ? req->submitted + req->deadline_ms * 1e-3 : 0;
+            request_hedge_arm(req, now);
+            requests_timer_update(c, req);
+            request_attempt(c, req);
+        }
+        while(cancelled) {
+            Request *req = cancelled;
+            cancelled = req->cnext;
+            req->cnext = 0;
+            request_complete(c, req, CURLE_OK, "Request cancelled");
         }
-        requests_incoming = 0;
-        pthread_mutex_unlock(&requests_incoming_mtx);
 
         int running_count;
-        CURLMcode mc = curl_multi_perform(requests_multi, &running_count);
+        CURLMcode mc = curl_multi_perform(c->multi, &running_count);
         assert(!mc);
         CURLMsg *msg;
         do {
             int msgs;
-            msg = curl_multi_info_read(requests_multi, &msgs);
+            msg = curl_multi_info_read(c->multi, &msgs);
             if(msg && msg->msg == CURLMSG_DONE) {
                 //printf("request complete\n");
-                CURL *curl = msg->easy_handle;
-                curl_multi_remove_handle(requests_multi, curl);
-                Request *req;
-                curl_easy_getinfo(curl, CURLINFO_PRIVATE, &req);
-                if(!req->noutput && msg->data.result != CURLE_OK)
-                    req->error = strdup(curl_easy_strerror(msg->data.result));
-                req->complete = 1;
-                pthread_cond_signal(&req->cnd);
+                request_done(c, msg->easy_handle, msg->data.result);
             }
         } while(msg);
+        requests_timers(c);
 
+        int timeout = INT_MAX;
+        if(c->ntimers) {
+            double ms = (c->timers[0]->timer - requests_now()) * 1e3;
+            timeout = ms <= 0 ? 0 : ms >= INT_MAX ? INT_MAX : (int)ms + 1;
+        }
         int ready;
         struct curl_waitfd fd;
-        fd.fd = requests_waiter;
+        fd.fd = c->waiter;
         fd.events = CURL_WAIT_POLLIN;
         fd.revents = 0;
-        curl_multi_wait(requests_multi, &fd, 1, INT_MAX, &ready);
+        curl_multi_wait(c->multi, &fd, 1, timeout, &ready);
         if(fd.revents) {
             /* drain socket */
             char buf[1024];
-            read(fd.fd, buf, sizeof buf);
+            while(read(fd.fd, buf, sizeof buf) > 0) {}
         }
     }
-    curl_multi_cleanup(requests_multi);
+    return 0;
 }
 
-static void requests_init1() {
-    curl_global_init(CURL_GLOBAL_ALL);
-    pthread_t t;
-    if(pthread_create(&t, 0, requests_threadrun, 0)) {
-        printf("requests multi thread create failed\n");
+static void requests_client_start(RequestsClient *c, const RequestsConfig *config) {
+    if(config) c->config = *config;
+    if(!c->config.max_host_connections) c->config.max_host_connections = 4;
+    if(!c->config.max_total_connections) c->config.max_total_connections = 1024;
+    if(!c->config.keepalive_idle) c->config.keepalive_idle = 15*60;
+    if(!c->config.keepalive_interval) c->config.keepalive_interval = 60;
+    if(!c->config.connect_timeout) c->config.connect_timeout = 10;
+    if(!c->config.max_idle_handles) c->config.max_idle_handles = 64;
+    c->idle = (CURL**)malloc(c->config.max_idle_handles * sizeof *c->idle);
+    c->seed = (unsigned)time(0) ^ (unsigned)(size_t)c;
+    pthread_mutex_init(&c->mtx, 0);
+
+    c->multi = curl_multi_init();
+    if(!c->multi) {
+        printf("creating multi handle failed\n");
         abort();
     }
 
+#if LIBCURL_VERSION_MAJOR > 7 || (LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR >= 30)
+    curl_multi_setopt(c->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, c->config.max_total_connections);
+    curl_multi_setopt(c->multi, CURLMOPT_MAX_HOST_CONNECTIONS, c->config.max_host_connections);
+    curl_multi_setopt(c->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_MAJOR > 7 || (LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR >= 67)
+    if(c->config.max_streams)
+        curl_multi_setopt(c->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, c->config.max_streams);
+#endif
+    if(c->config.max_idle_connections)
+        curl_multi_setopt(c->multi, CURLMOPT_MAXCONNECTS, c->config.max_idle_connections);
+
     int socks[2];
     if(socketpair(AF_LOCAL, SOCK_STREAM, 0, socks)) {
         printf("socketpair for waking CURL could not be created\n");
         abort();
     }
 
-    requests_waiter = socks[0];
-    requests_wakeup = socks[1];
+    c->waiter = socks[0];
+    c->wakeup = socks[1];
 
-    int flags = fcntl(requests_waiter, F_GETFL);
-    if(fcntl(requests_waiter, F_SETFL, flags | O_NONBLOCK)) {
+    int flags = fcntl(c->waiter, F_GETFL);
+    if(fcntl(c->waiter, F_SETFL, flags | O_NONBLOCK)) {
         printf("socketpair could not be set to nonblocking\n");
         abort();
     }
+
+    if(pthread_create(&c->thread, 0, requests_threadrun, c)) {
+        printf("requests multi thread create failed\n");
+        abort();
+    }
+}
+
+static void requests_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *ctx) {
+    (void)curl;
+    (void)access;
+    (void)ctx;
+    pthread_mutex_lock(&requests_share_mtx[data & 7]);
+}
+
+static void requests_share_unlock(CURL *curl, curl_lock_data data, void *ctx) {
+    (void)curl;
+    (void)ctx;
+    pthread_mutex_unlock(&requests_share_mtx[data & 7]);
+}
+
+static void requests_init1() {
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    /* connections can't be shared between multi threads so each client keeps its own */
+    for(size_t i=0;i<sizeof requests_share_mtx / sizeof requests_share_mtx[0];i++)
+        pthread_mutex_init(&requests_share_mtx[i], 0);
+    requests_share = curl_share_init();
+    curl_share_setopt(requests_share, CURLSHOPT_LOCKFUNC, requests_share_lock);
+    curl_share_setopt(requests_share, CURLSHOPT_UNLOCKFUNC, requests_share_unlock);
+    curl_share_setopt(requests_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(requests_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    requests_client_start(&requests_default, 0);
 }
 
 static void requests_init() {
@@ -911,6 +1825,28 @@ static void requests_init() {
     pthread_once(&once, requests_init1);
 }
 
+REQUESTS_API RequestsClient* requests_client_new(const RequestsConfig *config) {
+    requests_init();
+    RequestsClient *c = (RequestsClient*)calloc(1, sizeof *c);
+    requests_client_start(c, config);
+    return c;
+}
+
+REQUESTS_API void requests_client_destroy(RequestsClient *c) {
+    char wakeup = 1;
+    __atomic_store_n(&c->stop, 1, __ATOMIC_SEQ_CST);
+    write(c->wakeup, &wakeup, sizeof wakeup);
+    pthread_join(c->thread, 0);
+    for(size_t i=0;i<c->nidle;i++) curl_easy_cleanup(c->idle[i]);
+    free(c->idle);
+    free(c->timers);
+    curl_multi_cleanup(c->multi);
+    close(c->waiter);
+    close(c->wakeup);
+    pthread_mutex_destroy(&c->mtx);
+    free(c);
+}
+
 REQUESTS_API void request_addheader(Request *req, const char *a, const char *b) {
     size_t n = snprintf(0, 0, "%s%s", a, b);
     char *c = (char*)malloc(n + 1);
@@ -923,6 +1859,7 @@ REQUESTS_API void request_addheader(Request *req, const char *a, const char *b)
 static size_t request_writecb(char *ptr, size_t size, size_t nmemb, void *userdata) {
     Request *req = (Request*)userdata;
     size *= nmemb;
+    if(req->sink) return req->sink(req->sinkctx, ptr, size) ? 0 : size;
     size_t required = req->noutput + size;
     if(required > req->output_capacity) {
         size_t cap = req->output_capacity * 2;
@@ -937,6 +1874,12 @@ static size_t request_writecb(char *ptr, size_t size, size_t nmemb, void *userda
     return size;
 }
 
+static size_t request_readcb(char *buf, size_t size, size_t nitems, void *userdata) {
+    Request *req = (Request*)userdata;
+    ptrdiff_t n = req->source(req->sourcectx, buf, size * nitems);
+    return n < 0 ? CURL_READFUNC_ABORT : (size_t)n;
+}
+
 static void request_destroyheaders(Request *req) {
     for(RequestHeader *h = req->output_headers;h;) {
         free(h->key);
@@ -1012,11 +1955,18 @@ REQUESTS_API void request_decompress(Request* req) {
     curl_easy_setopt(req->curl, CURLOPT_ACCEPT_ENCODING, ""); /* enable */
 }
 
-REQUESTS_API Request *request_new(const char *url) {
+REQUESTS_API Request *request_new_client(RequestsClient *c, const char *url) {
     requests_init();
+    if(!c) c = &requests_default;
     Request *req = (Request*)calloc(1, sizeof *req);
     assert(req);
-    req->curl = curl_easy_init();
+    req->client = c;
+    req->url = strdup(url);
+    req->idempotent = 1;
+    pthread_mutex_lock(&c->mtx);
+    if(c->nidle) req->curl = c->idle[--c->nidle];
+    pthread_mutex_unlock(&c->mtx);
+    if(!req->curl) req->curl = curl_easy_init();
     if(getenv("REQUESTS_VERBOSE")) curl_easy_setopt(req->curl, CURLOPT_VERBOSE, 1L);
     curl_easy_setopt(req->curl, CURLOPT_URL, url);
     curl_easy_setopt(req->curl, CURLOPT_FOLLOWLOCATION, 1L);
@@ -1025,14 +1975,21 @@ REQUESTS_API Request *request_new(const char *url) {
     curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
     curl_easy_setopt(req->curl, CURLOPT_HEADERFUNCTION, request_headercb);
     curl_easy_setopt(req->curl, CURLOPT_HEADERDATA, req);
-    curl_easy_setopt(req->curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(req->curl, CURLOPT_CONNECTTIMEOUT, c->config.connect_timeout);
     curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
     curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPALIVE, 1L);  /* enable TCP keep-alive for this transfer */
-    curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPIDLE, 15L*60); /* keep-alive idle time in seconds*/
-    curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPINTVL, 60L);   /* interval time between keep-alive probes in seconds.     once an OS specific number of these have failed the OS will close the connection */
+    curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPIDLE, c->config.keepalive_idle); /* keep-alive idle time in seconds*/
+    curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPINTVL, c->config.keepalive_interval);   /* interval time between keep-alive probes in seconds.     once an OS specific number of these have failed the OS will close the connection */
     curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_TIME, 30L);
     curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_LIMIT, 0L);
-    curl_easy_setopt(req->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    if(c->config.http2) {
+        curl_easy_setopt(req->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(req->curl, CURLOPT_PIPEWAIT, 1L); /* wait to multiplex rather than open another connection */
+    } else
+        curl_easy_setopt(req->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(req->curl, CURLOPT_SHARE, requests_share);
+    if(c->config.dns_cache_timeout) curl_easy_setopt(req->curl, CURLOPT_DNS_CACHE_TIMEOUT, c->config.dns_cache_timeout);
+    if(c->config.max_connection_age) curl_easy_setopt(req->curl, CURLOPT_MAXAGE_CONN, c->config.max_connection_age);
     curl_easy_setopt(req->curl, CURLOPT_ACCEPT_ENCODING, (char*)0); /* disable automatic decompression */
     /* disable Expect: 100-continue and 1 sec delay which curl library introduces */
     req->headers = curl_slist_append(req->headers, "Expect:");
@@ -1042,12 +1999,40 @@ REQUESTS_API Request *request_new(const char *url) {
     return req;
 }
 
+REQUESTS_API Request *request_new(const char *url) {
+    return request_new_client(0, url);
+}
+
 REQUESTS_API void request_destroy(Request *req) {
     free(req->error);
     free(req->output);
     free(req->reason);
     if(req->headers) curl_slist_free_all(req->headers);
-    if(req->curl) curl_easy_cleanup(req->curl);
+    free(req->url);
+    if(req->cancel_pending) {
+        RequestsClient *c = req->client;
+        pthread_mutex_lock(&c->mtx);
+        for(Request **p = &c->cancelled;*p;p=&(*p)->cnext) {
+            if(*p == req) {
+                *p = req->cnext;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&c->mtx);
+    }
+    if(req->curl) {
+        /* keep the handle for the next request */
+        RequestsClient *c = req->client;
+        curl_easy_reset(req->curl);
+        pthread_mutex_lock(&c->mtx);
+        /* curl_easy_reset() leaks state of duplicated handles */
+        if(c->nidle < c->config.max_idle_handles && !req->duplicated) {
+            c->idle[c->nidle++] = req->curl;
+            req->curl = 0;
+        }
+        pthread_mutex_unlock(&c->mtx);
+        if(req->curl) curl_easy_cleanup(req->curl);
+    }
     pthread_mutex_destroy(&req->mtx);
     pthread_cond_destroy(&req->cnd);
     request_destroyheaders(req);
@@ -1085,28 +2070,101 @@ REQUESTS_API char* request_header(struct Request *req, const char *header) {
     return 0;
 }
 
-REQUESTS_API void requests_run(Request **reqs, size_t nreqs) {
-    pthread_mutex_lock(&requests_incoming_mtx);
-    for(size_t i=0;i<nreqs;i++) {
-        Request *req = reqs[i];
-        req->next = requests_incoming;
-        requests_incoming = req;
+/* pass request to the multi thread of its client */
+static void requests_push(Request *req) {
+    RequestsClient *c = req->client;
+    req->complete = 0;
+    memset(&req->timings, 0, sizeof req->timings);
+    req->submitted = requests_now();
+    pthread_mutex_lock(&c->mtx);
+    req->active = 1;
+    req->next = c->incoming;
+    c->incoming = req;
+    pthread_mutex_unlock(&c->mtx);
+    if(!__atomic_exchange_n(&c->wakeup_pending, 1, __ATOMIC_SEQ_CST)) {
+        char wakeup = 1;
+        write(c->wakeup, &wakeup, sizeof wakeup);
     }
-    pthread_mutex_unlock(&requests_incoming_mtx);
-    char wakeup = 1;
-    write(requests_wakeup, &wakeup, sizeof wakeup);
+}
+
+REQUESTS_API void requests_run(Request **reqs, size_t nreqs) {
+    for(size_t i=0;i<nreqs;i++)
+        requests_push(reqs[i]);
 
     for(size_t i=0;i<nreqs;i++) {
         Request *req = reqs[i];
-        int done = 0;
-        do {
-            pthread_mutex_lock(&req->mtx);
+        pthread_mutex_lock(&req->mtx);
+        while(!req->complete)
             pthread_cond_wait(&req->cnd, &req->mtx);
-            done = req->complete;
-            pthread_mutex_unlock(&req->mtx);
-        } while(!done);
-        req->next = 0;
+        pthread_mutex_unlock(&req->mtx);
+    }
+}
+
+REQUESTS_API void request_submit(Request *req, RequestQueue *q) {
+    req->queue = q;
+    requests_push(req);
+}
+
+REQUESTS_API RequestQueue* requests_queue_new(void) {
+    RequestQueue *q = (RequestQueue*)calloc(1, sizeof *q);
+    pthread_mutex_init(&q->mtx, 0);
+    pthread_cond_init(&q->cnd, 0);
+    return q;
+}
+
+REQUESTS_API void requests_queue_destroy(RequestQueue *q) {
+    pthread_mutex_destroy(&q->mtx);
+    pthread_cond_destroy(&q->cnd);
+    free(q);
+}
+
+static Request* requests_pop(RequestQueue *q) {
+    Request *req = q->head;
+    if(req) {
+        q->head = req->qnext;
+        if(!q->head) q->tail = 0;
+        req->qnext = 0;
+    }
+    return req;
+}
+
+REQUESTS_API Request* requests_poll(RequestQueue *q) {
+    pthread_mutex_lock(&q->mtx);
+    Request *req = requests_pop(q);
+    pthread_mutex_unlock(&q->mtx);
+    return req;
+}
+
+REQUESTS_API Request* requests_wait(RequestQueue *q, int timeout_ms) {
+    struct timespec end;
+    clock_gettime(CLOCK_REALTIME, &end);
+    end.tv_sec += timeout_ms / 1000;
+    end.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if(end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&q->mtx);
+    while(!q->head) {
+        if(timeout_ms < 0) pthread_cond_wait(&q->cnd, &q->mtx);
+        else if(pthread_cond_timedwait(&q->cnd, &q->mtx, &end)) break;
     }
+    Request *req = requests_pop(q);
+    pthread_mutex_unlock(&q->mtx);
+    return req;
+}
+
+REQUESTS_API void request_oncomplete(Request *req, request_done_fn done, void *ctx) {
+    req->done = done;
+    req->donectx = ctx;
+}
+
+REQUESTS_API const RequestTimings* request_timings(Request *req) {
+    return &req->timings;
+}
+
+REQUESTS_API void requests_executor(request_executor_fn exec) {
+    requests_exec = exec;
 }
 
 REQUESTS_API int request_run(Request *req) {
@@ -1128,6 +2186,7 @@ REQUESTS_API void request_post(
     size_t ndata,
     int copy)
 {
+    req->idempotent = 0;
     /* length then data or curl runs strlen() */
     curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)ndata);
     curl_easy_setopt(req->curl, copy ? CURLOPT_COPYPOSTFIELDS : CURLOPT_POSTFIELDS, data);
@@ -1140,10 +2199,199 @@ REQUESTS_API void request_post(
     request_addheader(req, "Content-Length: ", buf);
 }
 
+REQUESTS_API void request_post_source(
+    Request *req,
+    const char *content_type,
+    const char *content_encoding,
+    request_source_fn source,
+    void *ctx,
+    ptrdiff_t ndata)
+{
+    req->source = source;
+    req->sourcectx = ctx;
+    req->idempotent = 0;
+    curl_easy_setopt(req->curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, (char*)0);
+    curl_easy_setopt(req->curl, CURLOPT_READFUNCTION, request_readcb);
+    curl_easy_setopt(req->curl, CURLOPT_READDATA, req);
+    /* -1 sends chunked */
+    curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)(ndata < 0 ? -1 : ndata));
+
+    if(content_type) request_addheader(req, "Content-Type: ", content_type);
+    if(content_encoding) request_addheader(req, "Content-Encoding: ", content_encoding);
+    if(ndata >= 0) {
+        char buf[64];
+        snprintf(buf, sizeof buf, "%zu", (size_t)ndata);
+        request_addheader(req, "Content-Length: ", buf);
+    } else request_addheader(req, "Transfer-Encoding: ", "chunked");
+}
+
+REQUESTS_API void request_sink(Request *req, request_sink_fn sink, void *ctx) {
+    req->sink = sink;
+    req->sinkctx = ctx;
+}
+
+REQUESTS_API void request_deadline(Request *req, long ms) {
+    req->deadline_ms = ms;
+}
+
+REQUESTS_API void request_retry(Request *req, int retries, long backoff_ms) {
+    req->retries = retries;
+    req->backoff_ms = backoff_ms;
+}
 
+REQUESTS_API void request_hedge(Request *req, long ms) {
+    req->hedge_ms = ms;
+}
+
+REQUESTS_API void request_cancel(Request *req) {
+    RequestsClient *c = req->client;
+    pthread_mutex_lock(&c->mtx);
+    if(!req->cancel_pending) {
+        req->cancel_pending = 1;
+        req->cnext = c->cancelled;
+        c->cancelled = req;
+    }
+    pthread_mutex_unlock(&c->mtx);
+    if(!__atomic_exchange_n(&c->wakeup_pending, 1, __ATOMIC_SEQ_CST)) {
+        char wakeup = 1;
+        write(c->wakeup, &wakeup, sizeof wakeup);
+    }
+}
 
 #endif
 
+#define REQUESTS_HOSTS 64
+#define REQUESTS_BUCKETS 32
+
+static const char *requests_metric_names[REQUESTS_METRICS] = {
+    "queue", "dns", "connect", "tls", "first_byte", "total", "elapsed"
+};
+
+/* log2 histograms of microseconds per host. bucket b holds [2^(b-1), 2^b) us.
+   slots are claimed once and never freed so recording is only relaxed atomic adds */
+typedef struct RequestsHost {
+    long state; /* 0 free, 1 claiming, 2 ready */
+    char host[64];
+    size_t count[REQUESTS_METRICS][REQUESTS_BUCKETS];
+} RequestsHost;
+
+static RequestsHost requests_hosts[REQUESTS_HOSTS];
+
+#ifdef _MSC_VER
+#define requests_load(p) InterlockedCompareExchange((p), 0, 0)
+#define requests_store(p, v) InterlockedExchange((p), (v))
+#define requests_cas(p, expect, value) (InterlockedCompareExchange((p), (value), (expect)) == (expect))
+#define requests_inc(p) InterlockedIncrement64((volatile LONG64*)(p))
+#define requests_get(p) (*(volatile size_t*)(p))
+#define requests_zero(p) (*(volatile size_t*)(p) = 0)
+#else
+#define requests_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define requests_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define requests_cas(p, expect, value) __sync_bool_compare_and_swap((p), (expect), (value))
+#define requests_inc(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#define requests_get(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define requests_zero(p) __atomic_store_n((p), 0, __ATOMIC_RELAXED)
+#endif
+
+static RequestsHost* requests_host(const char *url) {
+    const char *p = strstr(url, "://");
+    size_t n = 0;
+    uint32_t h = 2166136261u;
+    if(p) url = p + 3;
+    while(url[n] && url[n] != '/' && url[n] != '?' && url[n] != '#' && n < sizeof requests_hosts[0].host - 1) {
+        h = (h ^ (unsigned char)url[n]) * 16777619u;
+        n++;
+    }
+    for(size_t i=0;i<REQUESTS_HOSTS;i++) {
+        RequestsHost *host = &requests_hosts[(h + i) % REQUESTS_HOSTS];
+        long state = requests_load(&host->state);
+        if(!state && requests_cas(&host->state, 0, 1)) {
+            memcpy(host->host, url, n);
+            host->host[n] = 0;
+            requests_store(&host->state, 2);
+            return host;
+        }
+        while(state != 2) state = requests_load(&host->state);
+        if(!strncmp(host->host, url, n) && !host->host[n]) return host;
+    }
+    return 0; /* table full */
+}
+
+static void requests_record(const char *url, const RequestTimings *t) {
+    double values[REQUESTS_METRICS];
+    RequestsHost *host = requests_host(url);
+    if(!host) return;
+    values[REQUESTS_QUEUE] = t->queue;
+    values[REQUESTS_DNS] = t->dns;
+    values[REQUESTS_CONNECT] = t->connect;
+    values[REQUESTS_TLS] = t->tls;
+    values[REQUESTS_FIRST_BYTE] = t->first_byte;
+    values[REQUESTS_TOTAL] = t->total;
+    values[REQUESTS_ELAPSED] = t->elapsed;
+    for(int m=0;m<REQUESTS_METRICS;m++) {
+        /* phases skipped for reused connections are left out */
+        if(values[m] <= 0 && m != REQUESTS_QUEUE && m != REQUESTS_ELAPSED) continue;
+        uint64_t us = values[m] > 0 ? (uint64_t)(values[m] * 1e6) : 0;
+        int b = 0;
+        while(us && b < REQUESTS_BUCKETS - 1) {
+            us >>= 1;
+            b++;
+        }
+        requests_inc(&host->count[m][b]);
+    }
+}
+
+/* upper bound in ms of the bucket holding quantile q */
+static double requests_quantile(const size_t *count, size_t total, double q) {
+    size_t want = (size_t)(q * total), sum = 0;
+    for(int b=0;b<REQUESTS_BUCKETS;b++) {
+        sum += count[b];
+        if(sum > want) return (double)((uint64_t)1 << b) / 1000;
+    }
+    return (double)((uint64_t)1 << (REQUESTS_BUCKETS - 1)) / 1000;
+}
+
+/* seconds. 0 without samples */
+static double requests_host_quantile(const char *url, int metric, double q) {
+    size_t count[REQUESTS_BUCKETS], total = 0;
+    RequestsHost *host = requests_host(url);
+    if(!host) return 0;
+    for(int b=0;b<REQUESTS_BUCKETS;b++)
+        total += count[b] = requests_get(&host->count[metric][b]);
+    return total ? requests_quantile(count, total, q) / 1000 : 0;
+}
+
+REQUESTS_API size_t requests_stats_dump(char *buf, size_t nbuf) {
+    size_t n = 0;
+    for(size_t i=0;i<REQUESTS_HOSTS;i++) {
+        RequestsHost *host = &requests_hosts[i];
+        if(requests_load(&host->state) != 2) continue;
+        for(int m=0;m<REQUESTS_METRICS;m++) {
+            size_t count[REQUESTS_BUCKETS], total = 0;
+            for(int b=0;b<REQUESTS_BUCKETS;b++)
+                total += count[b] = requests_get(&host->count[m][b]);
+            if(!total) continue;
+            int w = snprintf(n < nbuf ? buf + n : 0, n < nbuf ? nbuf - n : 0,
+                "%s %s n=%zu p50<%.3fms p90<%.3fms p99<%.3fms max<%.3fms\n",
+                host->host, requests_metric_names[m], total,
+                requests_quantile(count, total, 0.5),
+                requests_quantile(count, total, 0.9),
+                requests_quantile(count, total, 0.99),
+                requests_quantile(count, total, 1.0 - 1e-12));
+            if(w > 0) n += w;
+        }
+    }
+    return n;
+}
+
+REQUESTS_API void requests_stats_reset(void) {
+    for(size_t i=0;i<REQUESTS_HOSTS;i++)
+        for(int m=0;m<REQUESTS_METRICS;m++)
+            for(int b=0;b<REQUESTS_BUCKETS;b++)
+                requests_zero(&requests_hosts[i].count[m][b]);
+}
+
 REQUESTS_API void request_setctx(Request *req, void *userctx) {
     req->userctx = userctx;
 }
@@ -1154,7 +2402,303 @@ REQUESTS_API void* request_ctx(Request *req) {
 
 #ifdef REQUESTS_EXAMPLE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+static int example_sink(void *ctx, const char *data, size_t ndata) {
+    (void)data;
+    *(size_t*)ctx += ndata;
+    return 0;
+}
+static ptrdiff_t example_source(void *ctx, char *buf, size_t nbuf) {
+    size_t *left = (size_t*)ctx;
+    size_t n = nbuf < *left ? nbuf : *left;
+    memset(buf, 'x', n);
+    *left -= n;
+    return (ptrdiff_t)n;
+}
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* stand-in HTTP/1.1 server for tests. replies to every request with a body
+   the size of the request body, or "hello" when there is none.
+   /slow waits a second, /flaky fails with 503 two times out of three and
+   only the first /hedge is slow */
+typedef struct ExampleConn {
+    int fd;
+    size_t start, end;
+    char buf[64*1024];
+} ExampleConn;
+
+static int example_fill(ExampleConn *c) {
+    if(c->start == c->end) c->start = c->end = 0;
+    if(c->end == sizeof c->buf) {
+        memmove(c->buf, c->buf + c->start, c->end - c->start);
+        c->end -= c->start;
+        c->start = 0;
+    }
+    ssize_t n = read(c->fd, c->buf + c->end, sizeof c->buf - c->end);
+    if(n <= 0) return -1;
+    c->end += n;
+    return 0;
+}
+
+/* return line without \r\n or null on eof */
+static char* example_line(ExampleConn *c) {
+    for(;;) {
+        char *nl = (char*)memchr(c->buf + c->start, '\n', c->end - c->start);
+        if(nl) {
+            char *line = c->buf + c->start;
+            c->start = nl + 1 - c->buf;
+            if(nl > line && nl[-1] == '\r') --nl;
+            *nl = 0;
+            return line;
+        }
+        if(example_fill(c)) return 0;
+    }
+}
+
+static int example_skip(ExampleConn *c, size_t n) {
+    while(n) {
+        if(c->start == c->end && example_fill(c)) return -1;
+        size_t m = c->end - c->start;
+        if(m > n) m = n;
+        c->start += m;
+        n -= m;
+    }
+    return 0;
+}
+
+static int example_flaky, example_hedged;
+
+static void* example_serve(void *ctx) {
+    ExampleConn *c = (ExampleConn*)ctx;
+    char *line, path[256];
+    static const char body[64*1024] = {0};
+    while((line = example_line(c))) {
+        size_t length = 0, received = 0;
+        int status = 200;
+        if(sscanf(line, "%*s %255s", path) != 1) break;
+        int chunked = 0;
+        while((line = example_line(c)) && *line) {
+            if(!strncasecmp(line, "content-length:", 15)) length = strtoul(line + 15, 0, 10);
+            if(!strncasecmp(line, "transfer-encoding:", 18) && strstr(line, "chunked")) chunked = 1;
+        }
+        if(!line) break;
+        if(chunked) {
+            for(;;) {
+                if(!(line = example_line(c))) goto done;
+                size_t n = strtoul(line, 0, 16);
+                if(example_skip(c, n) || !example_line(c)) goto done;
+                if(!n) break;
+                received += n;
+            }
+        } else {
+            if(example_skip(c, length)) break;
+            received = length;
+        }
+        if(!strcmp(path, "/slow") || (!strcmp(path, "/hedge") && !__atomic_fetch_add(&example_hedged, 1, __ATOMIC_SEQ_CST)))
+            usleep(1000*1000);
+        if(!strcmp(path, "/flaky") && __atomic_fetch_add(&example_flaky, 1, __ATOMIC_SEQ_CST) % 3 != 2)
+            status = 503;
+        char head[128];
+        size_t nbody = received ? received : 5;
+        int nhead = snprintf(head, sizeof head, "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n\r\n",
+            status, status == 200 ? "OK" : "Service Unavailable", nbody);
+        if(write(c->fd, head, nhead) != nhead) break;
+        if(!received) {
+            if(write(c->fd, "hello", 5) != 5) break;
+            continue;
+        }
+        while(received) {
+            size_t n = received < sizeof body ? received : sizeof body;
+            ssize_t w = write(c->fd, body, n);
+            if(w <= 0) goto done;
+            received -= w;
+        }
+    }
+done:
+    close(c->fd);
+    free(c);
+    return 0;
+}
+
+static void* example_accept(void *ctx) {
+    int fd = *(int*)ctx;
+    for(;;) {
+        int client = accept(fd, 0, 0);
+        if(client < 0) continue;
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        ExampleConn *c = (ExampleConn*)malloc(sizeof *c);
+        c->fd = client;
+        c->start = c->end = 0;
+        pthread_t t;
+        pthread_create(&t, 0, example_serve, c);
+        pthread_detach(t);
+    }
+    return 0;
+}
+
+static int example_server(void) {
+    static int fd;
+    struct sockaddr_in addr;
+    socklen_t naddr = sizeof addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof addr) || listen(fd, 128)) return -1;
+    getsockname(fd, (struct sockaddr*)&addr, &naddr);
+    pthread_t t;
+    pthread_create(&t, 0, example_accept, &fd);
+    pthread_detach(t);
+    return ntohs(addr.sin_port);
+}
+
+static double example_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void example_done(Request *req, void *ctx) {
+    (void)req;
+    __atomic_fetch_add((int*)ctx, 1, __ATOMIC_SEQ_CST);
+}
+
+static void example_queue(RequestsClient *c, const char *url, const char *name) {
+    enum { N = 2000 };
+    RequestQueue *q = requests_queue_new();
+    double start = example_now();
+    for(int i=0;i<N;i++)
+        request_submit(request_new_client(c, url), q);
+    int ok = 0;
+    for(int i=0;i<N;i++) {
+        Request *req = requests_wait(q, 10000);
+        assert(req);
+        char *data;
+        size_t ndata;
+        request_data(req, &data, &ndata);
+        ok += request_status(req) == 200 && ndata == 5 && !memcmp(data, "hello", 5);
+        request_destroy(req);
+    }
+    assert(!requests_poll(q));
+    assert(!requests_wait(q, 10));
+    double t = example_now() - start;
+    printf("%s: %d/%d ok in %.3fs %.0f req/s\n", name, ok, N, t, N / t);
+    assert(ok == N);
+    requests_queue_destroy(q);
+}
+
+static void example_local(void) {
+    char url[64];
+    int port = example_server();
+    if(port < 0) {
+        printf("could not start local server\n");
+        exit(1);
+    }
+    snprintf(url, sizeof url, "http://127.0.0.1:%d/", port);
+
+    /* stream 1MB of unknown length up and count the response bytes */
+    size_t left = 1 << 20, received = 0;
+    Request *up = request_new(url);
+    request_post_source(up, "application/octet-stream", 0, example_source, &left, -1);
+    request_sink(up, example_sink, &received);
+    if(request_run(up)) printf("failure: %s\n", request_error(up));
+    printf("streamed status=%d received=%zu\n", request_status(up), received);
+    const RequestTimings *tm = request_timings(up);
+    printf("timings: queue=%.3fms connect=%.3fms first_byte=%.3fms total=%.3fms elapsed=%.3fms in=%zu out=%zu\n",
+        tm->queue * 1e3, tm->connect * 1e3, tm->first_byte * 1e3, tm->total * 1e3, tm->elapsed * 1e3, tm->bytes_in, tm->bytes_out);
+    assert(tm->bytes_out >= 1 << 20 && tm->bytes_in >= 1 << 20);
+    assert(received == 1 << 20);
+    request_destroy(up);
+
+    /* completion queue throughput */
+    example_queue(0, url, "queue");
+    RequestsConfig config;
+    memset(&config, 0, sizeof config);
+    config.max_host_connections = 16;
+    config.max_idle_handles = 4096;
+    RequestsClient *client = requests_client_new(&config);
+    example_queue(client, url, "client 16 connections");
+    /* second run reuses easy handles and connections */
+    example_queue(client, url, "client reused");
+    requests_client_destroy(client);
+
+    /* completion callbacks */
+    enum { N = 2000 };
+    static Request *reqs[N];
+    int done = 0;
+    double start = example_now();
+    for(int i=0;i<N;i++) {
+        reqs[i] = request_new(url);
+        request_oncomplete(reqs[i], example_done, &done);
+        request_submit(reqs[i], 0);
+    }
+    while(__atomic_load_n(&done, __ATOMIC_SEQ_CST) < N) usleep(1000);
+    double t = example_now() - start;
+    printf("callbacks: %d in %.3fs %.0f req/s\n", N, t, N / t);
+    for(int i=0;i<N;i++) request_destroy(reqs[i]);
+
+    /* retry, deadline, cancel and hedge */
+    char path[96];
+    snprintf(path, sizeof path, "%sflaky", url);
+    Request *r = request_new(path);
+    request_retry(r, 3, 10);
+    request_run(r);
+    printf("flaky: status=%d retries=%d\n", request_status(r), request_timings(r)->retries);
+    assert(request_status(r) == 200 && request_timings(r)->retries == 2);
+    request_destroy(r);
+
+    snprintf(path, sizeof path, "%sslow", url);
+    r = request_new(path);
+    request_deadline(r, 100);
+    assert(request_run(r));
+    printf("deadline: %s after %.3fs\n", request_error(r), request_timings(r)->elapsed);
+    assert(!strcmp(request_error(r), "Deadline exceeded") && request_timings(r)->elapsed < 0.5);
+    request_destroy(r);
+
+    RequestQueue *q = requests_queue_new();
+    r = request_new(path);
+    request_submit(r, q);
+    request_cancel(r);
+    assert(requests_wait(q, 500) == r);
+    printf("cancel: %s\n", request_error(r));
+    assert(!strcmp(request_error(r), "Request cancelled"));
+    request_destroy(r);
+    requests_queue_destroy(q);
+
+    snprintf(path, sizeof path, "%shedge", url);
+    r = request_new(path);
+    request_hedge(r, 50);
+    assert(!request_run(r));
+    printf("hedge: status=%d after %.3fs\n", request_status(r), request_timings(r)->elapsed);
+    assert(request_status(r) == 200 && request_timings(r)->elapsed < 0.5);
+    request_destroy(r);
+
+    char stats[4096];
+    size_t nstats = requests_stats_dump(stats, sizeof stats);
+    assert(nstats < sizeof stats);
+    printf("%s", stats);
+    requests_stats_reset();
+    assert(!requests_stats_dump(0, 0));
+}
+#endif
+
 int main(int argc, char** argv) {
+    setvbuf(stdout, 0, _IONBF, 0);
+    (void)argc;
+    (void)argv;
+#ifndef _WIN32
+    example_local();
+#endif
     Request* req = request_new("google.com");
     request_decompress(req);
     if (request_run(req)) {
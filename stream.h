@@ -78,6 +78,7 @@ static ssize_t streammem_read(Stream *s, void *buf, size_t nbuf) {
     size_t n = ms->cap - ms->n;
     if(n > nbuf) n = nbuf;
     memcpy(buf, ms->buf + ms->n, n);
+    ms->n += n;
     return (ssize_t)n;
 }
 static ssize_t streammem_write(Stream *s, const void *buf, size_t nbuf) {
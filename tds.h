@@ -53,12 +53,23 @@ typedef struct TdsParser {
 	unsigned i : 6; /* column index */
 	char state;
 } TdsParser;
+/* per connection statement statistics. bytes are TDS payload bytes */
+typedef struct TdsStats {
+	size_t queries, errors;
+	size_t bytes_sent, bytes_recv;
+	double time, max_time; /* seconds from send to last byte received */
+} TdsStats;
 typedef struct TdsConn {
 	char error[512];
 	int fd;
-	TdsBuf buf;
+	TdsBuf buf; /* response being received by tds_query_poll() */
 	short npacket;
 	char logged_in;
+	char busy; /* tds_query_start() called and response not complete */
+	unsigned char header[8]; /* partial packet header for tds_query_poll() */
+	unsigned nheader, nbody;
+	double start;
+	TdsStats stats;
 } TdsConn;
 typedef enum TdsType {
 	tds_type_none, /* never used. getting this is a bug */
@@ -144,6 +155,8 @@ TDS_API int tds_connect(TdsConn *conn, const char *host, int port, int timeout_s
 /* returns 0 on success. < 0 on error. */
 TDS_API int tds_login(TdsConn *conn, const char *host, const char *app, const char *user, const char *password);
 TDS_API void tds_timeout(TdsConn *conn, int seconds);
+/* copy statement statistics for the connection */
+TDS_API void tds_stats(TdsConn *conn, TdsStats *stats);
 /* returns 0 on success. < 0 on error. */
 TDS_API int tds_query(TdsConn *conn, TdsResponse *result, const char *format, ...);
 /* returns 0 on success. < 0 on error. */
@@ -157,6 +170,20 @@ TDS_API const char* tds_error(TdsConn *conn);
 TDS_API void tds_response_destroy(TdsResponse*);
 TDS_API void tds_destroy(TdsConn *conn);
 
+#ifndef _WIN32
+/* Non-blocking queries. Put the socket in non-blocking mode, send the query with
+   tds_query_start() then call tds_query_poll() each time the socket is readable.
+   The query is written before tds_query_start() returns. */
+/* returns 0 on success. < 0 on error. */
+TDS_API int tds_nonblocking(TdsConn *conn, int on);
+/* returns 0 on success. < 0 on error. */
+TDS_API int tds_query_start(TdsConn *conn, const char *format, ...);
+/* returns 0 on success. < 0 on error. */
+TDS_API int tds_vquery_start(TdsConn *conn, const char *format, va_list args);
+/* returns 1 on response complete, 0 on needs more data, < 0 on error */
+TDS_API int tds_query_poll(TdsConn *conn, TdsResponse *result);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -176,9 +203,11 @@ TDS_API void tds_destroy(TdsConn *conn);
 #include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef _WIN32
 #	include <winsock2.h>
@@ -190,6 +219,7 @@ TDS_API void tds_destroy(TdsConn *conn);
 #	include <netdb.h>
 #	include <netinet/in.h>
 #	include <netinet/tcp.h>
+#	include <poll.h>
 #	include <sys/socket.h>
 #	include <sys/time.h>
 #	include <sys/types.h>
@@ -476,6 +506,20 @@ static void tds_debug(const char *format, ...) {
 	printf("\n");
 }
 
+/* monotonic seconds */
+static double tds_now(void) {
+#ifdef _WIN32
+	LARGE_INTEGER f, t;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+}
+
 static int
 tds_parser_make_error(TdsParser *p, const char *format, ...) {
 	va_list arg;
@@ -538,7 +582,7 @@ tds_peek(TdsSlice *slice, int n, unsigned char **p) {
 }
 
 static int
-tds_writebytes(TdsBuf *buf, const void *data, size_t n) {
+tds_reserve(TdsBuf *buf, size_t n) {
 	if(buf->n + n > buf->cap) {
 		size_t cap = buf->cap * 2;
 		char *p;
@@ -549,6 +593,12 @@ tds_writebytes(TdsBuf *buf, const void *data, size_t n) {
 		buf->data = p;
 		buf->cap = cap;
 	}
+	return 0;
+}
+
+static int
+tds_writebytes(TdsBuf *buf, const void *data, size_t n) {
+	if(tds_reserve(buf, n)) return -1;
 	memcpy(buf->data + buf->n, data, n);
 	buf->n += n;
 	return 0;
@@ -786,7 +836,28 @@ tds_send(int fd, const void *buf, ptrdiff_t n) {
 		rc = send(fd, p + sent, (int)(n - sent), 0);
 		if(rc <= 0) {
 			if(rc == -1 && errno == EINTR) continue;
-			if(rc == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) break;
+			if(rc == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+#ifndef _WIN32
+				/* non-blocking socket so wait for room up to the send timeout
+				   tds_socket_timeout set. with none it waits like a blocking send */
+				struct pollfd pfd;
+				struct timeval v;
+				socklen_t len = sizeof v;
+				int ms = -1;
+				if(!(fcntl(fd, F_GETFL) & O_NONBLOCK)) break;
+				if(!getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &v, &len) && (v.tv_sec || v.tv_usec) &&
+				   v.tv_sec < INT_MAX / 1000 - 1)
+					ms = (int)(v.tv_sec * 1000 + v.tv_usec / 1000);
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				if((rc = poll(&pfd, 1, ms)) > 0) continue;
+				if(rc == -1 && errno == EINTR) continue;
+				printf("error writing %s\n", rc ? strerror(errno) : "send timed out");
+				return -1;
+#else
+				break;
+#endif
+			}
 			if(rc == 0) return 0;
 			printf("error writing %s\n", strerror(errno));
 			return -1;
@@ -1003,6 +1074,21 @@ tds_timeout(TdsConn *conn, int seconds) {
 	tds_socket_timeout(conn->fd, seconds);
 }
 
+TDS_API void
+tds_stats(TdsConn *conn, TdsStats *stats) {
+	*stats = conn->stats;
+}
+
+static void
+tds_stats_add(TdsConn *conn, size_t nrecv, int error) {
+	double t = tds_now() - conn->start;
+	conn->stats.queries++;
+	if(error) conn->stats.errors++;
+	conn->stats.bytes_recv += nrecv;
+	conn->stats.time += t;
+	if(t > conn->stats.max_time) conn->stats.max_time = t;
+}
+
 static int
 tds_parse_envchange(TdsParser *parser) {
 	unsigned char *p;
@@ -1965,27 +2051,31 @@ tds_query(TdsConn *conn, TdsResponse *resp, const char *sql, ...) {
 	return rc;
 }
 
-TDS_API int
-tds_vquery(TdsConn *conn, TdsResponse *resp, const char *format, va_list args) {
+/* send a TDS_LANGUAGE request. returns 0 on success */
+static int
+tds_vsendquery(TdsConn *conn, const char *format, va_list args) {
 	int n, rc;
-	char *sql, *p;
+	char *sql;
 	va_list arg0, arg1;
-	TdsBuf buf = {0};
-	TdsHeader h;
-
-	memset(resp, 0, sizeof *resp);
-	if(tds_error(conn)) return -1;
 
 	va_copy(arg0, args);
 	va_copy(arg1, args);
 
 	n = vsnprintf(0, 0, format, arg0);
-	if(n < 0) goto error;
+	va_end(arg0);
+	if(n < 0) {
+		va_end(arg1);
+		return -1;
+	}
 
 	++n;
 	sql = (char*)malloc(n + 7);
-	if(!sql) goto error;
+	if(!sql) {
+		va_end(arg1);
+		return -1;
+	}
 	vsnprintf(sql+6, n, format, arg1);
+	va_end(arg1);
 
 	sql[0] = TDS_LANGUAGE;
 	sql[1] = n;
@@ -1996,20 +2086,125 @@ tds_vquery(TdsConn *conn, TdsResponse *resp, const char *format, va_list args) {
 	n += 5;
 
 	tds_debug("send TDS_LANGUAGE");
+	conn->start = tds_now();
 	rc = tds_sendpacket(conn->fd, TDS_BUF_NORMAL, sql, n);
 	free(sql);
-	if(rc) goto error;
+	if(!rc) conn->stats.bytes_sent += n;
+	return rc;
+}
+
+TDS_API int
+tds_vquery(TdsConn *conn, TdsResponse *resp, const char *format, va_list args) {
+	char *p;
+	TdsBuf buf = {0};
+	TdsHeader h;
+
+	memset(resp, 0, sizeof *resp);
+	if(tds_error(conn)) return -1;
+
+	if(tds_vsendquery(conn, format, args)) goto error;
 	if(tds_recvpacket(conn->fd, &buf, &h)) goto error;
 	assert(h.type == TDS_BUF_RESPONSE);
 	p = (char*)realloc(buf.data, buf.n);
 	resp->data = p ? p : buf.data;
 	resp->n = buf.n;
+	tds_stats_add(conn, buf.n, 0);
 	return 0;
 error:
+	free(buf.data);
+	tds_stats_add(conn, 0, 1);
 	tds_make_error(conn, "TDS query failed");
 	return -1;
 }
 
+#ifndef _WIN32
+TDS_API int
+tds_nonblocking(TdsConn *conn, int on) {
+	int flags = fcntl(conn->fd, F_GETFL);
+	if(flags == -1) return -1;
+	flags = on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+	return fcntl(conn->fd, F_SETFL, flags) ? -1 : 0;
+}
+
+TDS_API int
+tds_query_start(TdsConn *conn, const char *format, ...) {
+	va_list args;
+	int rc;
+	va_start(args, format);
+	rc = tds_vquery_start(conn, format, args);
+	va_end(args);
+	return rc;
+}
+
+TDS_API int
+tds_vquery_start(TdsConn *conn, const char *format, va_list args) {
+	if(tds_error(conn)) return -1;
+	if(conn->busy) {
+		tds_make_error(conn, "TDS query already in progress");
+		return -1;
+	}
+	conn->buf.n = 0;
+	conn->nheader = conn->nbody = 0;
+	if(tds_vsendquery(conn, format, args)) {
+		tds_stats_add(conn, 0, 1);
+		tds_make_error(conn, "TDS query failed");
+		return -1;
+	}
+	conn->busy = 1;
+	return 0;
+}
+
+TDS_API int
+tds_query_poll(TdsConn *conn, TdsResponse *resp) {
+	ssize_t rc;
+	size_t n;
+
+	memset(resp, 0, sizeof *resp);
+	if(!conn->busy) return -1;
+	for(;;) {
+		if(conn->nheader < sizeof conn->header) {
+			rc = recv(conn->fd, conn->header + conn->nheader, sizeof conn->header - conn->nheader, 0);
+			if(rc < 0 && errno == EINTR) continue;
+			if(rc < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return 0;
+			if(rc <= 0) goto error;
+			conn->nheader += rc;
+			if(conn->nheader < sizeof conn->header) continue;
+			if(conn->header[0] != TDS_BUF_RESPONSE) goto error;
+			n = (conn->header[2] << 8) | conn->header[3];
+			if(n < sizeof conn->header || n - sizeof conn->header > TDS_MAX_PACKET_SIZE) goto error;
+			conn->nbody = (unsigned)(n - sizeof conn->header);
+			if(tds_reserve(&conn->buf, conn->nbody)) goto error;
+		}
+		if(conn->nbody) {
+			rc = recv(conn->fd, conn->buf.data + conn->buf.n, conn->nbody, 0);
+			if(rc < 0 && errno == EINTR) continue;
+			if(rc < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return 0;
+			if(rc <= 0) goto error;
+			conn->buf.n += rc;
+			conn->nbody -= (unsigned)rc;
+			if(conn->nbody) continue;
+		}
+		/* packet complete */
+		n = (conn->header[2] << 8) | conn->header[3];
+		conn->nheader = 0;
+		if((conn->header[1] & TDS_BUFSTAT_EOM) || n == sizeof conn->header) break;
+	}
+	tds_debug("received pdu %zu", conn->buf.n);
+	resp->data = conn->buf.data;
+	resp->n = conn->buf.n;
+	tds_stats_add(conn, conn->buf.n, 0);
+	memset(&conn->buf, 0, sizeof conn->buf);
+	conn->busy = 0;
+	return 1;
+error:
+	conn->busy = 0;
+	conn->buf.n = 0;
+	tds_stats_add(conn, 0, 1);
+	tds_make_error(conn, "TDS query receive failed");
+	return -1;
+}
+#endif
+
 TDS_API int
 tds_login(TdsConn *conn, const char *host, const char *app, const char *user, const char *password) {
 	TdsBuf b = {0};
@@ -0,0 +1,779 @@
+/* SPDX-License-Identifier: Unlicense */
+
+#ifndef TDSPOOL_H
+#define TDSPOOL_H
+
+/* Thread-safe connection pool for tds.h with prewarmed logins, idle validation
+   and automatic reconnect. On linux TdsLoop drives many pooled connections
+   from one thread with epoll and the non-blocking tds_query_start()/tds_query_poll().
+
+   #define TDSPOOL_IMPLEMENTATION in one C file before including tdspool.h or
+   define TDSPOOL_STATIC before each include. Only the public tds.h API is used.
+
+   see example and license (public domain) at end of file */
+
+#if defined(TDSPOOL_STATIC) || defined(TDSPOOL_EXAMPLE)
+#define TDSPOOL_API static
+#define TDSPOOL_IMPLEMENTATION
+#ifndef TDS_STATIC
+#define TDS_STATIC
+#endif
+#else
+#define TDSPOOL_API extern
+#endif
+
+#include "tds.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TdsPoolConfig {
+	const char *host;
+	int port;
+	const char *app, *user, *password;
+	const char *database; /* optional. sent as USE database after login */
+	int min, max; /* connections kept logged in, hard limit on connections */
+	int timeout_sec; /* socket timeout. <= 0 for none */
+	/* connections idle longer than this run validate_sql before being handed out.
+	   < 0 to never validate */
+	double idle_sec;
+	const char *validate_sql; /* default "select 1" */
+} TdsPoolConfig;
+
+typedef struct TdsPoolStats {
+	int open, idle;
+	size_t acquires, waits, timeouts;
+	size_t connects, connect_failures, reconnects;
+	size_t validations, validation_failures;
+	TdsStats tds; /* totals of all connections released to the pool */
+} TdsPoolStats;
+
+struct TdsPool;
+typedef struct TdsPool TdsPool;
+
+/* returns 0 on error. logs in config->min connections before returning */
+TDSPOOL_API TdsPool* tdspool_new(const TdsPoolConfig *config);
+/* all connections must be released first */
+TDSPOOL_API void tdspool_destroy(TdsPool *pool);
+/* log in connections until config->min are open. returns number opened or < 0 on error */
+TDSPOOL_API int tdspool_prewarm(TdsPool *pool);
+/* returns logged in connection or 0 on timeout or connect failure.
+   timeout_ms < 0 to wait forever. 0 to not wait when all max connections are in use */
+TDSPOOL_API TdsConn* tdspool_acquire(TdsPool *pool, int timeout_ms);
+/* return connection to the pool. connections with errors are closed and
+   replaced on a later acquire */
+TDSPOOL_API void tdspool_release(TdsPool *pool, TdsConn *conn);
+/* acquire, query and release. a query failing on a connection error
+   is retried once on a new connection. returns 0 on success. < 0 on error */
+TDSPOOL_API int tdspool_query(TdsPool *pool, TdsResponse *result, const char *format, ...);
+TDSPOOL_API void tdspool_stats(TdsPool *pool, TdsPoolStats *stats);
+
+#ifdef __linux__
+struct TdsLoop;
+typedef struct TdsLoop TdsLoop;
+/* resp is 0 and error is set on failure. resp must be destroyed by the callback */
+typedef void (*tdsloop_cb)(void *ctx, TdsResponse *resp, const char *error);
+
+/* max_inflight limits connections used by the loop. <= 0 for pool max */
+TDSPOOL_API TdsLoop* tdsloop_new(TdsPool *pool, int max_inflight);
+/* queue a query. cb runs from tdsloop_run(). returns 0 on success */
+TDSPOOL_API int tdsloop_submit(TdsLoop *loop, tdsloop_cb cb, void *ctx, const char *format, ...);
+/* wait up to timeout_ms for responses, or for a pool connection when all are
+   in use by other threads. returns number of callbacks run or < 0 on error */
+TDSPOOL_API int tdsloop_run(TdsLoop *loop, int timeout_ms);
+/* number of queries submitted and not yet completed */
+TDSPOOL_API int tdsloop_pending(TdsLoop *loop);
+/* pending queries are completed first */
+TDSPOOL_API void tdsloop_destroy(TdsLoop *loop);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#ifdef TDSPOOL_IMPLEMENTATION
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define TDSPOOL_OF(ptr) ((TdsPoolConn*)((char*)(ptr) - offsetof(TdsPoolConn, conn)))
+
+typedef struct TdsPoolConn {
+	TdsConn conn;
+	struct TdsPoolConn *next;
+	double idle_since;
+	TdsStats reported; /* stats already added to pool totals */
+} TdsPoolConn;
+
+struct TdsPool {
+	TdsPoolConfig config;
+	char *strings[6];
+	pthread_mutex_t mtx;
+	pthread_cond_t cnd;
+	TdsPoolConn *idle; /* most recently used first */
+	int nbroken; /* closed on error and not yet replaced */
+	TdsPoolStats stats;
+};
+
+static double
+tdspool_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static char*
+tdspool_strdup(const char *s) {
+	size_t n;
+	char *p;
+	if(!s) return 0;
+	n = strlen(s) + 1;
+	p = (char*)malloc(n);
+	if(p) memcpy(p, s, n);
+	return p;
+}
+
+static void
+tdspool_addstats(TdsStats *total, const TdsStats *now, TdsStats *reported) {
+	total->queries += now->queries - reported->queries;
+	total->errors += now->errors - reported->errors;
+	total->bytes_sent += now->bytes_sent - reported->bytes_sent;
+	total->bytes_recv += now->bytes_recv - reported->bytes_recv;
+	total->time += now->time - reported->time;
+	if(now->max_time > total->max_time) total->max_time = now->max_time;
+	*reported = *now;
+}
+
+static void
+tdspool_close(TdsPool *pool, TdsPoolConn *c) {
+	pthread_mutex_lock(&pool->mtx);
+	tdspool_addstats(&pool->stats.tds, &c->conn.stats, &c->reported);
+	pool->stats.open--;
+	pthread_cond_signal(&pool->cnd);
+	pthread_mutex_unlock(&pool->mtx);
+	tds_destroy(&c->conn);
+	free(c);
+}
+
+/* caller has already counted the connection in stats.open */
+static TdsPoolConn*
+tdspool_open(TdsPool *pool) {
+	TdsPoolConfig *cfg = &pool->config;
+	TdsPoolConn *c = (TdsPoolConn*)calloc(1, sizeof *c);
+	if(!c) goto error;
+	if(tds_connect(&c->conn, cfg->host, cfg->port, cfg->timeout_sec > 0 ? cfg->timeout_sec : -1)) {
+		free(c);
+		goto error;
+	}
+	if(tds_login(&c->conn, cfg->host, cfg->app, cfg->user, cfg->password) ||
+	   (cfg->database && tds_command(&c->conn, "USE %s\n", cfg->database))) {
+		tds_destroy(&c->conn);
+		free(c);
+		goto error;
+	}
+	pthread_mutex_lock(&pool->mtx);
+	pool->stats.connects++;
+	if(pool->nbroken) {
+		pool->nbroken--;
+		pool->stats.reconnects++;
+	}
+	pthread_mutex_unlock(&pool->mtx);
+	return c;
+error:
+	pthread_mutex_lock(&pool->mtx);
+	pool->stats.connect_failures++;
+	pool->stats.open--;
+	pthread_cond_signal(&pool->cnd);
+	pthread_mutex_unlock(&pool->mtx);
+	return 0;
+}
+
+TDSPOOL_API TdsPool*
+tdspool_new(const TdsPoolConfig *config) {
+	TdsPool *pool = (TdsPool*)calloc(1, sizeof *pool);
+	TdsPoolConfig *cfg;
+	if(!pool) return 0;
+	cfg = &pool->config;
+	*cfg = *config;
+	cfg->host = pool->strings[0] = tdspool_strdup(config->host);
+	cfg->app = pool->strings[1] = tdspool_strdup(config->app ? config->app : "tdspool");
+	cfg->user = pool->strings[2] = tdspool_strdup(config->user ? config->user : "");
+	cfg->password = pool->strings[3] = tdspool_strdup(config->password ? config->password : "");
+	cfg->database = pool->strings[4] = tdspool_strdup(config->database);
+	cfg->validate_sql = pool->strings[5] = tdspool_strdup(config->validate_sql ? config->validate_sql : "select 1");
+	if(cfg->max < 1) cfg->max = 1;
+	if(cfg->min > cfg->max) cfg->min = cfg->max;
+	if(cfg->min < 0) cfg->min = 0;
+	pthread_mutex_init(&pool->mtx, 0);
+	pthread_cond_init(&pool->cnd, 0);
+	/* database is the only optional string */
+	if(!cfg->host || !cfg->app || !cfg->user || !cfg->password || !cfg->validate_sql ||
+	   (config->database && !cfg->database)) {
+		tdspool_destroy(pool);
+		return 0;
+	}
+	if(tdspool_prewarm(pool) < 0) {
+		tdspool_destroy(pool);
+		return 0;
+	}
+	return pool;
+}
+
+TDSPOOL_API void
+tdspool_destroy(TdsPool *pool) {
+	TdsPoolConn *c, *next;
+	int i;
+	if(!pool) return;
+	for(c=pool->idle;c;c=next) {
+		next = c->next;
+		tds_destroy(&c->conn);
+		free(c);
+	}
+	for(i=0;i<(int)(sizeof pool->strings / sizeof pool->strings[0]);i++)
+		free(pool->strings[i]);
+	pthread_mutex_destroy(&pool->mtx);
+	pthread_cond_destroy(&pool->cnd);
+	free(pool);
+}
+
+TDSPOOL_API int
+tdspool_prewarm(TdsPool *pool) {
+	int n = 0;
+	TdsPoolConn *c;
+	for(;;) {
+		pthread_mutex_lock(&pool->mtx);
+		if(pool->stats.open >= pool->config.min) {
+			pthread_mutex_unlock(&pool->mtx);
+			return n;
+		}
+		pool->stats.open++;
+		pthread_mutex_unlock(&pool->mtx);
+
+		if(!(c = tdspool_open(pool))) return -1;
+		c->idle_since = tdspool_now();
+		pthread_mutex_lock(&pool->mtx);
+		c->next = pool->idle;
+		pool->idle = c;
+		pool->stats.idle++;
+		pthread_cond_signal(&pool->cnd);
+		pthread_mutex_unlock(&pool->mtx);
+		++n;
+	}
+}
+
+/* failed is set when 0 is returned because a connect failed rather than a timeout */
+static TdsConn*
+tdspool_get(TdsPool *pool, int timeout_ms, int *failed) {
+	TdsPoolConn *c;
+	struct timespec deadline;
+	int waited = 0;
+
+	*failed = 0;
+
+	if(timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->stats.acquires++;
+	for(;;) {
+		if((c = pool->idle)) {
+			pool->idle = c->next;
+			pool->stats.idle--;
+			pthread_mutex_unlock(&pool->mtx);
+
+			if(pool->config.idle_sec >= 0 && tdspool_now() - c->idle_since >= pool->config.idle_sec) {
+				int rc = tds_command(&c->conn, "%s", pool->config.validate_sql);
+				pthread_mutex_lock(&pool->mtx);
+				pool->stats.validations++;
+				if(rc) {
+					pool->stats.validation_failures++;
+					pool->nbroken++;
+				}
+				pthread_mutex_unlock(&pool->mtx);
+				if(rc) {
+					tdspool_close(pool, c);
+					pthread_mutex_lock(&pool->mtx);
+					continue;
+				}
+			}
+			c->next = 0;
+			return &c->conn;
+		}
+		if(pool->stats.open < pool->config.max) {
+			pool->stats.open++;
+			pthread_mutex_unlock(&pool->mtx);
+			if(!(c = tdspool_open(pool))) {
+				*failed = 1;
+				return 0;
+			}
+			return &c->conn;
+		}
+		if(!timeout_ms) break;
+		if(!waited++) pool->stats.waits++;
+		if(timeout_ms < 0) pthread_cond_wait(&pool->cnd, &pool->mtx);
+		else if(pthread_cond_timedwait(&pool->cnd, &pool->mtx, &deadline) == ETIMEDOUT) break;
+	}
+	pool->stats.timeouts++;
+	pthread_mutex_unlock(&pool->mtx);
+	return 0;
+}
+
+TDSPOOL_API TdsConn*
+tdspool_acquire(TdsPool *pool, int timeout_ms) {
+	int failed;
+	return tdspool_get(pool, timeout_ms, &failed);
+}
+
+TDSPOOL_API void
+tdspool_release(TdsPool *pool, TdsConn *conn) {
+	TdsPoolConn *c;
+	if(!conn) return;
+	c = TDSPOOL_OF(conn);
+	if(tds_error(conn) || conn->busy) {
+		pthread_mutex_lock(&pool->mtx);
+		pool->nbroken++;
+		pthread_mutex_unlock(&pool->mtx);
+		tdspool_close(pool, c);
+		return;
+	}
+	c->idle_since = tdspool_now();
+	pthread_mutex_lock(&pool->mtx);
+	tdspool_addstats(&pool->stats.tds, &conn->stats, &c->reported);
+	c->next = pool->idle;
+	pool->idle = c;
+	pool->stats.idle++;
+	pthread_cond_signal(&pool->cnd);
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+TDSPOOL_API int
+tdspool_query(TdsPool *pool, TdsResponse *resp, const char *format, ...) {
+	va_list args;
+	TdsConn *conn;
+	int rc = -1, attempt;
+
+	memset(resp, 0, sizeof *resp);
+	for(attempt=0;attempt<2;attempt++) {
+		if(!(conn = tdspool_acquire(pool, -1))) return -1;
+		va_start(args, format);
+		rc = tds_vquery(conn, resp, format, args);
+		va_end(args);
+		tdspool_release(pool, conn);
+		if(!rc) break;
+	}
+	return rc;
+}
+
+TDSPOOL_API void
+tdspool_stats(TdsPool *pool, TdsPoolStats *stats) {
+	pthread_mutex_lock(&pool->mtx);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+#ifdef __linux__
+typedef struct TdsLoopReq {
+	tdsloop_cb cb;
+	void *ctx;
+	char *sql;
+	TdsConn *conn;
+	struct TdsLoopReq *next;
+} TdsLoopReq;
+
+struct TdsLoop {
+	TdsPool *pool;
+	int epfd;
+	int inflight, max_inflight, pending;
+	TdsLoopReq *head, *tail; /* waiting for a connection */
+};
+
+TDSPOOL_API TdsLoop*
+tdsloop_new(TdsPool *pool, int max_inflight) {
+	TdsLoop *loop = (TdsLoop*)calloc(1, sizeof *loop);
+	if(!loop) return 0;
+	loop->pool = pool;
+	loop->max_inflight = max_inflight > 0 ? max_inflight : pool->config.max;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(loop->epfd < 0) {
+		free(loop);
+		return 0;
+	}
+	return loop;
+}
+
+static void
+tdsloop_complete(TdsLoop *loop, TdsLoopReq *req, TdsResponse *resp, const char *error) {
+	char buf[512];
+	if(req->conn) {
+		/* copy before release since the connection may be closed */
+		if(error) {
+			snprintf(buf, sizeof buf, "%s", error);
+			error = buf;
+		}
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, req->conn->fd, 0);
+		tds_nonblocking(req->conn, 0);
+		tdspool_release(loop->pool, req->conn);
+		loop->inflight--;
+	}
+	loop->pending--;
+	req->cb(req->ctx, resp, error);
+	free(req->sql);
+	free(req);
+}
+
+/* start queued queries while connections are available. with nothing in
+   flight wait up to wait_ms for another thread to release one. queries
+   stay queued while the pool is busy and fail only if a connect fails */
+static int
+tdsloop_dispatch(TdsLoop *loop, int wait_ms) {
+	int n = 0, failed;
+	TdsLoopReq *req;
+	struct epoll_event ev;
+
+	while((req = loop->head) && loop->inflight < loop->max_inflight) {
+		if(!(req->conn = tdspool_get(loop->pool, loop->inflight ? 0 : wait_ms, &failed))) {
+			if(!failed) break;
+			loop->head = req->next;
+			if(!loop->head) loop->tail = 0;
+			tdsloop_complete(loop, req, 0, "TDS pool connection failed");
+			++n;
+			continue;
+		}
+		loop->head = req->next;
+		if(!loop->head) loop->tail = 0;
+		loop->inflight++;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = req;
+		if(tds_nonblocking(req->conn, 1) ||
+		   tds_query_start(req->conn, "%s", req->sql) ||
+		   epoll_ctl(loop->epfd, EPOLL_CTL_ADD, req->conn->fd, &ev)) {
+			const char *e = tds_error(req->conn);
+			if(!e) {
+				/* mark broken so release closes it */
+				req->conn->busy = 1;
+				e = "TDS loop start failed";
+			}
+			tdsloop_complete(loop, req, 0, e);
+			++n;
+		}
+	}
+	return n;
+}
+
+TDSPOOL_API int
+tdsloop_submit(TdsLoop *loop, tdsloop_cb cb, void *ctx, const char *format, ...) {
+	va_list args;
+	int n;
+	TdsLoopReq *req = (TdsLoopReq*)calloc(1, sizeof *req);
+	if(!req) return -1;
+
+	va_start(args, format);
+	n = vsnprintf(0, 0, format, args);
+	va_end(args);
+	if(n < 0 || !(req->sql = (char*)malloc(n + 1))) {
+		free(req);
+		return -1;
+	}
+	va_start(args, format);
+	vsnprintf(req->sql, n + 1, format, args);
+	va_end(args);
+
+	req->cb = cb;
+	req->ctx = ctx;
+	if(loop->tail) loop->tail->next = req;
+	else loop->head = req;
+	loop->tail = req;
+	loop->pending++;
+	tdsloop_dispatch(loop, 0);
+	return 0;
+}
+
+TDSPOOL_API int
+tdsloop_run(TdsLoop *loop, int timeout_ms) {
+	struct epoll_event events[64];
+	TdsResponse resp;
+	TdsLoopReq *req;
+	int i, n, rc, done;
+
+	done = tdsloop_dispatch(loop, timeout_ms);
+	if(!loop->inflight) return done;
+	n = epoll_wait(loop->epfd, events, (int)(sizeof events / sizeof events[0]), done ? 0 : timeout_ms);
+	if(n < 0) return errno == EINTR ? done : -1;
+	for(i=0;i<n;i++) {
+		req = (TdsLoopReq*)events[i].data.ptr;
+		rc = tds_query_poll(req->conn, &resp);
+		if(!rc) continue;
+		tdsloop_complete(loop, req, rc > 0 ? &resp : 0, rc > 0 ? 0 : tds_error(req->conn));
+		++done;
+	}
+	return done + tdsloop_dispatch(loop, 0);
+}
+
+TDSPOOL_API int
+tdsloop_pending(TdsLoop *loop) {
+	return loop->pending;
+}
+
+TDSPOOL_API void
+tdsloop_destroy(TdsLoop *loop) {
+	if(!loop) return;
+	while(loop->pending) if(tdsloop_run(loop, -1) < 0) break;
+	close(loop->epfd);
+	free(loop);
+}
+#endif
+
+#endif
+
+#ifdef TDSPOOL_EXAMPLE
+/* Fake TDS server replaying recorded responses. One thread per connection.
+   A query of "close" makes the server drop the connection. */
+#include <assert.h>
+
+static const unsigned char tdspool_login_reply[] = {
+	TDS_LOGINACK, 14, 0, TDS_LOG_SUCCEED, 5, 0, 0, 0, 4, 'f', 'a', 'k', 'e', 1, 0, 0, 0,
+	TDS_DONE, 0, 0, 0, 0
+};
+/* select id, name: (1, 'one') (2, 'two') */
+static const unsigned char tdspool_query_reply[] = {
+	TDS_ROWFMT, 0, 0, 0, 0, 2, 0,
+	2, 'i', 'd', 0, 0, 0, 0, 0, TDS_INT4, 0,
+	4, 'n', 'a', 'm', 'e', 0, 0, 0, 0, 0, TDS_VARCHAR, 255, 0,
+	TDS_ROW, 1, 0, 0, 0, 3, 'o', 'n', 'e',
+	TDS_ROW, 2, 0, 0, 0, 3, 't', 'w', 'o',
+	TDS_DONE, TDS_DONE_COUNT, 0, 0, 0, 2, 0, 0, 0
+};
+
+static int fake_logins, fake_queries;
+static pthread_mutex_t fake_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void* fake_conn(void *ctx) {
+	int fd = (int)(size_t)ctx;
+	TdsBuf buf = {0};
+	TdsHeader h;
+	while(!tds_recvpacket(fd, &buf, &h)) {
+		pthread_mutex_lock(&fake_mtx);
+		if(h.type == TDS_BUF_LOGIN) fake_logins++;
+		else fake_queries++;
+		pthread_mutex_unlock(&fake_mtx);
+		if(h.type == TDS_BUF_LOGIN)
+			tds_sendpacket(fd, TDS_BUF_RESPONSE, tdspool_login_reply, sizeof tdspool_login_reply);
+		else if(buf.n >= 11 && !memcmp(buf.data + 6, "close", 5)) break;
+		else tds_sendpacket(fd, TDS_BUF_RESPONSE, tdspool_query_reply, sizeof tdspool_query_reply);
+	}
+	free(buf.data);
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	return 0;
+}
+
+static void* fake_server(void *ctx) {
+	int lfd = (int)(size_t)ctx, fd;
+	pthread_t t;
+	while((fd = accept(lfd, 0, 0)) >= 0) {
+		pthread_create(&t, 0, fake_conn, (void*)(size_t)fd);
+		pthread_detach(t);
+	}
+	return 0;
+}
+
+static int fake_start(void) {
+	struct sockaddr_in addr;
+	socklen_t n = sizeof addr;
+	pthread_t t;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(!bind(fd, (struct sockaddr*)&addr, sizeof addr));
+	assert(!listen(fd, 64));
+	assert(!getsockname(fd, (struct sockaddr*)&addr, &n));
+	pthread_create(&t, 0, fake_server, (void*)(size_t)fd);
+	pthread_detach(t);
+	return ntohs(addr.sin_port);
+}
+
+static int check_response(TdsResponse *resp) {
+	TdsParser p;
+	TdsValue v;
+	int32_t id;
+	int rows = 0;
+	tds_parser_init(&p, resp->data, resp->n);
+	while(tds_row(&p)) {
+		++rows;
+		assert(tds_col(&p, &v) && tds_i32(&v, &id) && id == rows);
+		assert(tds_col(&p, &v) && v.type == tds_type_string && v.data.s.n == 3);
+	}
+	assert(!tds_parser_error(&p));
+	return rows;
+}
+
+static TdsPool *pool;
+
+static void* worker(void *ctx) {
+	TdsResponse resp;
+	int i;
+	(void)ctx;
+	for(i=0;i<100;i++) {
+		assert(!tdspool_query(pool, &resp, "select id, name from t where x = %d", i));
+		assert(check_response(&resp) == 2);
+		tds_response_destroy(&resp);
+	}
+	return 0;
+}
+
+static int loop_done;
+static void loop_cb(void *ctx, TdsResponse *resp, const char *error) {
+	(void)ctx;
+	assert(resp && !error);
+	assert(check_response(resp) == 2);
+	tds_response_destroy(resp);
+	loop_done++;
+}
+
+static int loop_errors;
+static void error_cb(void *ctx, TdsResponse *resp, const char *error) {
+	(void)ctx;
+	assert(!resp && error);
+	loop_errors++;
+}
+
+/* a port that refuses connections. bound but not listening */
+static int refused_port(int *fd) {
+	struct sockaddr_in addr;
+	socklen_t n = sizeof addr;
+	*fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(!bind(*fd, (struct sockaddr*)&addr, sizeof addr));
+	assert(!getsockname(*fd, (struct sockaddr*)&addr, &n));
+	return ntohs(addr.sin_port);
+}
+
+int main(int argc, char **argv) {
+	TdsPoolConfig cfg;
+	TdsPoolStats stats;
+	TdsConn *conn;
+	TdsLoop *loop;
+	pthread_t threads[8];
+	int i;
+
+	memset(&cfg, 0, sizeof cfg);
+	cfg.host = "127.0.0.1";
+	cfg.port = fake_start();
+	cfg.user = "user";
+	cfg.password = "password";
+	cfg.min = 2;
+	cfg.max = 4;
+	cfg.timeout_sec = 5;
+	cfg.idle_sec = 60;
+
+	pool = tdspool_new(&cfg);
+	assert(pool);
+	assert(fake_logins == 2);
+
+	for(i=0;i<8;i++) pthread_create(&threads[i], 0, worker, 0);
+	for(i=0;i<8;i++) pthread_join(threads[i], 0);
+	tdspool_stats(pool, &stats);
+	printf("threads: open=%d connects=%zu queries=%zu waits=%zu avg=%fms max=%fms\n",
+		stats.open, stats.connects, stats.tds.queries, stats.waits,
+		stats.tds.time * 1000 / stats.tds.queries, stats.tds.max_time * 1000);
+	assert(stats.open <= cfg.max);
+	assert(stats.tds.queries == 800 && !stats.tds.errors);
+
+	/* server drops connection. pool reconnects on next acquire */
+	conn = tdspool_acquire(pool, -1);
+	assert(conn);
+	assert(tds_command(conn, "close"));
+	tdspool_release(pool, conn);
+	worker(0);
+	tdspool_stats(pool, &stats);
+	assert(stats.reconnects == 1 || stats.open < cfg.max);
+
+	loop = tdsloop_new(pool, 0);
+	assert(loop);
+	for(i=0;i<200;i++) assert(!tdsloop_submit(loop, loop_cb, 0, "select id, name from t where x = %d", i));
+	while(tdsloop_pending(loop)) assert(tdsloop_run(loop, 1000) >= 0);
+	assert(loop_done == 200);
+	tdsloop_destroy(loop);
+
+	/* a pool busy with other threads leaves queries queued instead of failing them */
+	{
+		TdsConn *held[4];
+		for(i=0;i<cfg.max;i++) assert((held[i] = tdspool_acquire(pool, -1)));
+		loop_done = 0;
+		assert((loop = tdsloop_new(pool, 0)));
+		assert(!tdsloop_submit(loop, loop_cb, 0, "select id, name from t"));
+		assert(tdsloop_run(loop, 10) == 0 && tdsloop_pending(loop) == 1);
+		for(i=0;i<cfg.max;i++) tdspool_release(pool, held[i]);
+		while(tdsloop_pending(loop)) assert(tdsloop_run(loop, 1000) >= 0);
+		assert(loop_done == 1);
+		tdsloop_destroy(loop);
+	}
+
+	/* connect failures complete queued queries with an error and the loop
+	   keeps taking new ones */
+	{
+		TdsPoolConfig bad = cfg;
+		TdsPool *down;
+		int fd;
+		bad.port = refused_port(&fd);
+		bad.min = 0;
+		assert((down = tdspool_new(&bad)));
+		assert((loop = tdsloop_new(down, 0)));
+		assert(!tdsloop_submit(loop, error_cb, 0, "select 1") && loop_errors == 1);
+		assert(!tdsloop_submit(loop, error_cb, 0, "select 2") && loop_errors == 2);
+		assert(!tdsloop_pending(loop));
+		tdsloop_destroy(loop);
+		tdspool_destroy(down);
+		close(fd);
+	}
+
+	tdspool_stats(pool, &stats);
+	printf("loop: open=%d connects=%zu reconnects=%zu queries=%zu errors=%zu logins=%d server queries=%d\n",
+		stats.open, stats.connects, stats.reconnects, stats.tds.queries, stats.tds.errors,
+		fake_logins, fake_queries);
+	tdspool_destroy(pool);
+	printf("success\n");
+	return 0;
+}
+#endif
+/* Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
@@ -6,17 +6,119 @@
 #if defined(THREADPOOL_STATIC) || defined(THREADPOOL_EXAMPLE)
 #define THREADPOOL_API static
 #define THREADPOOL_IMPLEMENTATION
+#ifndef QUEUE_STATIC
+#define QUEUE_STATIC
+#endif
 #else
 #define THREADPOOL_API extern
 #endif
 
+#include <stddef.h>
+#ifdef THREADPOOL_STATS
+#include <stdint.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef void (*threadpool_cb)(void *ctx);
+typedef void* (*threadpool_fn)(void *ctx);
+typedef void (*threadpool_range_fn)(void *ctx, size_t begin, size_t end);
+
+typedef struct Threadpool Threadpool;
+
+/* priority lanes. idle workers look for high before normal before low.
+   tasks submitted from a task go to the lane of that task */
+enum {
+        THREADPOOL_HIGH,
+        THREADPOOL_NORMAL,
+        THREADPOOL_LOW,
+        THREADPOOL_LANES
+};
+
+/* zero for defaults */
+typedef struct ThreadpoolConfig {
+        int threads;   /* 0 for one per usable cpu */
+        int pin;       /* pin each worker to a single cpu */
+        int numa;      /* only use cpus of numa_node. deques are first touched there */
+        int numa_node;
+} ThreadpoolConfig;
+
+/* tasks spawned into a group can be waited for together. zero initialize.
+   every task of a group must go to the same pool */
+typedef struct ThreadpoolGroup {
+        int pending;
+        Threadpool *pool;
+} ThreadpoolGroup;
+
+/* result of threadpool_async. lives until threadpool_get returns */
+typedef struct ThreadpoolFuture {
+        ThreadpoolGroup group;
+        threadpool_fn fn;
+        void *ctx;
+        void *result;
+} ThreadpoolFuture;
+
+/* combines per chunk accumulators of size bytes. init writes an identity,
+   range folds [begin, end) into acc and join folds other into acc */
+typedef struct ThreadpoolReduce {
+        size_t size;
+        void (*init)(void *ctx, void *acc);
+        void (*range)(void *ctx, size_t begin, size_t end, void *acc);
+        void (*join)(void *ctx, void *acc, const void *other);
+} ThreadpoolReduce;
 
+/* config may be null */
+THREADPOOL_API Threadpool* threadpool_new(const ThreadpoolConfig *config);
+/* runs what is already queued, then stops and joins the workers */
+THREADPOOL_API void threadpool_destroy(Threadpool *pool);
+/* process wide pool, started on first use */
+THREADPOOL_API Threadpool* threadpool_default(void);
+/* pool may be null for the current worker's pool or else the default pool */
+THREADPOOL_API void threadpool_post(Threadpool *pool, int lane, threadpool_cb, void *ctx);
+THREADPOOL_API void threadpool_spawn_on(Threadpool *pool, int lane, ThreadpoolGroup *group, threadpool_cb, void *ctx);
+/* current pool and lane */
 THREADPOOL_API void threadpool_run(threadpool_cb, void *ctx);
+THREADPOOL_API void threadpool_spawn(ThreadpoolGroup *group, threadpool_cb, void *ctx);
+/* returns when every task in the group finished. workers run queued tasks meanwhile */
+THREADPOOL_API void threadpool_wait(ThreadpoolGroup *group);
+THREADPOOL_API void threadpool_async(ThreadpoolFuture *future, threadpool_fn, void *ctx);
+THREADPOOL_API void* threadpool_get(ThreadpoolFuture *future);
+/* calls fn on chunks of [begin, end) of at least grain indices (0 for 1) and waits */
+THREADPOOL_API void threadpool_for(size_t begin, size_t end, size_t grain, threadpool_range_fn fn, void *ctx);
+/* result is initialized and every chunk is joined into it in index order */
+THREADPOOL_API void threadpool_reduce(size_t begin, size_t end, size_t grain, const ThreadpoolReduce *reduce, void *ctx, void *result);
+
+#ifdef THREADPOOL_STATS
+/* histogram bucket i counts times of [2^i, 2^(i+1)) nanoseconds */
+#define THREADPOOL_HISTOGRAM 32
+
+typedef struct ThreadpoolWorkerStats {
+        uint64_t tasks;     /* executed */
+        uint64_t shared;    /* taken from the shared queue */
+        uint64_t steals;    /* taken from another worker */
+        uint64_t parks;     /* went to sleep for lack of work */
+        uint64_t overflows; /* own deque was full so a submit went to the shared queue */
+        uint64_t busy_ns;   /* running tasks */
+        uint64_t wait[THREADPOOL_HISTOGRAM]; /* submit to start */
+        uint64_t run[THREADPOOL_HISTOGRAM];
+} ThreadpoolWorkerStats;
+
+typedef struct ThreadpoolStats {
+        ThreadpoolWorkerStats total; /* workers plus threads waiting from outside the pool */
+        uint64_t elapsed_ns; /* since threadpool_new */
+        double utilization;  /* worker busy_ns / (elapsed_ns * workers) */
+        size_t queued;       /* tasks waiting now */
+        size_t shared;       /* of which in the shared queues */
+        size_t shared_max;   /* deepest any shared queue got */
+        int workers;
+} ThreadpoolStats;
+
+/* workers keep counting while this reads so totals are approximate.
+   fills up to max per worker entries if workers is not null */
+THREADPOOL_API void threadpool_stats(Threadpool *pool, ThreadpoolStats *stats, ThreadpoolWorkerStats *workers, int max);
+#endif
 
 #ifdef __cplusplus
 }
@@ -25,151 +127,990 @@ THREADPOOL_API void threadpool_run(threadpool_cb, void *ctx);
 #endif
 
 #ifdef THREADPOOL_IMPLEMENTATION
+/*************************************
+ *      Work stealing threadpool
+ *
+ * each worker owns a Chase-Lev deque per lane. tasks submitted by a worker
+ * go to the bottom of its own deque and it pops from there (LIFO). idle
+ * workers steal from the top of other deques. submits from other threads
+ * go to a shared queue per lane that workers drain in batches. workers
+ * with nothing to do sleep on a futex and are woken only when someone is
+ * asleep. threads waiting on a group run queued tasks until it is done.
+ * needs gcc or clang for __atomic builtins.
+ * define THREADPOOL_STATS for counters and latency histograms.
+ * ***********************************/
 #include "thread.h"
+#include "queue.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
-typedef struct sem_t {
-        mtx_t mtx;
-        cnd_t cnd;
-        int count;
-} sem_t;
-int sem_init(sem_t *sem, int unused, int count) {
-    (void)unused;
-    sem->count = count;
-    int res = mtx_init(&sem->mtx, mtx_plain);
-    if(!res) res = cnd_init(&sem->cnd);
-    return res;
+#if defined(THREADPOOL_STATS) && !defined(_WIN32)
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef THREADPOOL_DEQUE
+/* power of 2. tasks beyond this go to the shared queue */
+#define THREADPOOL_DEQUE 4096
+#endif
+/* steal attempts before going to sleep */
+#define THREADPOOL_SPIN 64
+#ifndef THREADPOOL_SHARED
+/* lock free slots per lane for submits from outside the pool */
+#define THREADPOOL_SHARED 1024
+#endif
+/* most tasks moved from the shared queue to a deque at once */
+#define THREADPOOL_BATCH 32
+/* most chunks for threadpool_for and threadpool_reduce */
+#define THREADPOOL_CHUNKS 256
+/* set in ThreadpoolGroup.pending when a waiter went to sleep */
+#define THREADPOOL_WAITER (1 << 30)
+#define THREADPOOL_MAX_CPUS 1024
+
+typedef struct ThreadpoolTask {
+        threadpool_cb cb;
+        void *ctx;
+        ThreadpoolGroup *group;
+#ifdef THREADPOOL_STATS
+        uint64_t submitted;
+#endif
+} ThreadpoolTask;
+
+typedef struct ThreadpoolDeque {
+        int64_t top; /* thieves take from here */
+        char pad0[64];
+        int64_t bottom; /* owner pushes and pops here */
+        char pad1[64];
+        ThreadpoolTask tasks[THREADPOOL_DEQUE];
+} ThreadpoolDeque;
+
+/* for submits from threads outside the pool. the lock free ring takes them
+   until it fills. the locked overflow grows after that and is drained first */
+typedef struct ThreadpoolQueue {
+        QueueMpmc ring;
+        mtx_t lock;
+        ThreadpoolTask *tasks;
+        size_t head, count, cap;
+#ifdef THREADPOOL_STATS
+        size_t max;
+#endif
+} ThreadpoolQueue;
+
+typedef struct ThreadpoolWorker {
+        ThreadpoolDeque lanes[THREADPOOL_LANES];
+        Threadpool *pool;
+        thrd_t thread;
+        int index;
+#ifdef THREADPOOL_STATS
+        ThreadpoolWorkerStats stats; /* written only by this worker */
+#endif
+} ThreadpoolWorker;
+
+struct Threadpool {
+        ThreadpoolWorker **workers;
+        int nworkers;
+        int *cpus; /* cpus workers may run on or null */
+        int ncpus;
+        int pin;
+        ThreadpoolQueue queues[THREADPOOL_LANES];
+        int sleepers;
+        int epoch; /* futex word bumped to wake sleepers */
+        int done; /* futex word bumped when a waited group finishes */
+        int stop;
+#ifdef THREADPOOL_STATS
+        ThreadpoolWorkerStats outside; /* threads waiting from outside the pool */
+        uint64_t started;
+#endif
+#ifndef __linux__
+        mtx_t park_lock;
+        cnd_t park_cond;
+        cnd_t done_cond;
+#endif
+};
+
+static __thread ThreadpoolWorker *threadpool_self;
+static __thread int threadpool_lane = THREADPOOL_NORMAL;
+#ifdef THREADPOOL_STATS
+/* tasks run while waiting inside a task are not busy time twice */
+static __thread int threadpool_depth;
+#endif
+static __thread uint64_t threadpool_seed;
+static once_flag threadpool_once = ONCE_FLAG_INIT;
+static Threadpool *threadpool_global;
+
+#ifdef __linux__
+static void
+threadpool_futex_wait(Threadpool *pool, int *word, int value) {
+        (void)pool;
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, 0, 0, 0);
+}
+static void
+threadpool_futex_wake(Threadpool *pool, int *word, int n) {
+        (void)pool;
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+}
+#else
+static void
+threadpool_futex_wait(Threadpool *pool, int *word, int value) {
+        cnd_t *cond = word == &pool->done ? &pool->done_cond : &pool->park_cond;
+        mtx_lock(&pool->park_lock);
+        if(__atomic_load_n(word, __ATOMIC_SEQ_CST) == value)
+                cnd_wait(cond, &pool->park_lock);
+        mtx_unlock(&pool->park_lock);
+}
+static void
+threadpool_futex_wake(Threadpool *pool, int *word, int n) {
+        cnd_t *cond = word == &pool->done ? &pool->done_cond : &pool->park_cond;
+        mtx_lock(&pool->park_lock);
+        if(n == 1) cnd_signal(cond);
+        else cnd_broadcast(cond);
+        mtx_unlock(&pool->park_lock);
 }
+#endif
 
-void sem_destroy(sem_t *sem) {
-    mtx_destroy(&sem->mtx);
-    cnd_destroy(&sem->cnd);
+#ifdef THREADPOOL_STATS
+static uint64_t
+threadpool_ns(void) {
+#ifdef _WIN32
+        LARGE_INTEGER freq, ticks;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&ticks);
+        return (uint64_t)((double)ticks.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+#endif
 }
 
-void sem_post(sem_t *sem) {
-    mtx_lock(&sem->mtx);
-    ++sem->count;
-    cnd_signal(&sem->cnd);
-    mtx_unlock(&sem->mtx);
+/* worker counters have one writer so skip the locked add */
+static void
+threadpool_count(uint64_t *counter, uint64_t n, int shared) {
+        if(shared) __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+        else __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
 }
 
-void sem_wait(sem_t *sem) {
-    mtx_lock(&sem->mtx);
-    while (sem->count == 0) cnd_wait(&sem->cnd, &sem->mtx);
-    --sem->count;
-    mtx_unlock(&sem->mtx);
+static int
+threadpool_bucket(uint64_t ns) {
+        int b = ns ? 63 - __builtin_clzll(ns) : 0;
+        return b < THREADPOOL_HISTOGRAM ? b : THREADPOOL_HISTOGRAM - 1;
 }
 
-/*************************************
- *      Minimalist threadpool
- * ***********************************/
-#define THREADPOOL_NCALLBACKS 4096
-typedef struct ThreadpoolCallback {
-        threadpool_cb cb;
-        void *ctx;
-} ThreadpoolCallback;
+/* w is null for threads outside the pool */
+#define THREADPOOL_COUNT(pool, w, field, n) \
+        threadpool_count((w) ? &(w)->stats.field : &(pool)->outside.field, n, !(w))
+#else
+#define THREADPOOL_COUNT(pool, w, field, n) ((void)0)
+#endif
+
+static void
+threadpool_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+/* parses a list like 0-3,8,10-11 as found in sysfs. returns the count */
+static int
+threadpool_cpulist(const char *s, int *cpus, int max) {
+        int n = 0;
+        while(*s && n < max) {
+                char *end;
+                long a = strtol(s, &end, 10), b = a;
+                if(end == s) break;
+                s = end;
+                if(*s == '-') b = strtol(s + 1, &end, 10), s = end;
+                for(long i=a;i<=b && n<max;i++) cpus[n++] = (int)i;
+                while(*s == ',' || *s == '\n' || *s == ' ') s++;
+        }
+        return n;
+}
+
+static int
+threadpool_node_cpus(int node, int *cpus, int max) {
+#ifdef __linux__
+        char path[64], buf[4096];
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if(!f) return 0;
+        size_t n = fread(buf, 1, sizeof buf - 1, f);
+        fclose(f);
+        buf[n] = 0;
+        return threadpool_cpulist(buf, cpus, max);
+#else
+        (void)node; (void)cpus; (void)max;
+        return 0;
+#endif
+}
 
-static ThreadpoolCallback threadpool_callbacks[THREADPOOL_NCALLBACKS];
-static int threadpool_callback_head;
-static int threadpool_callback_count;
-static once_flag threadpool_callback_lock_init;
-static sem_t threadpool_callback_sem;
-static cnd_t threadpool_callback_cond;
-static mtx_t threadpool_callback_lock;
-static int threadpool_started;
+static void
+threadpool_affinity(const int *cpus, int n) {
+#ifdef __linux__
+        unsigned long mask[THREADPOOL_MAX_CPUS / (8 * sizeof(unsigned long))];
+        const int bits = 8 * sizeof(unsigned long);
+        memset(mask, 0, sizeof mask);
+        for(int i=0;i<n;i++) mask[cpus[i] / bits] |= 1ul << (cpus[i] % bits);
+        syscall(SYS_sched_setaffinity, 0, sizeof mask, mask);
+#elif defined(_WIN32)
+        DWORD_PTR mask = 0;
+        for(int i=0;i<n;i++) if(cpus[i] < 64) mask |= (DWORD_PTR)1 << cpus[i];
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+#else
+        (void)cpus; (void)n;
+#endif
+}
 
 static int
-threadpool_dequeue(ThreadpoolCallback *func) {
-        int run = threadpool_callback_count > 0;
-        if(run) {
-                *func = threadpool_callbacks[threadpool_callback_head];
-                if(++threadpool_callback_head == THREADPOOL_NCALLBACKS)
-                    threadpool_callback_head = 0;
-                --threadpool_callback_count;
-                sem_post(&threadpool_callback_sem);
+threadpool_online_cpus(void) {
+#ifdef _WIN32
+        SYSTEM_INFO info = {0};
+        GetSystemInfo(&info);
+        int cpus = (int)info.dwNumberOfProcessors;
+#else
+        int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        return cpus < 1 ? 1 : cpus;
+}
+
+static void
+threadpool_slot_store(ThreadpoolTask *slot, const ThreadpoolTask *task) {
+        __atomic_store_n(&slot->cb, task->cb, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->ctx, task->ctx, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->group, task->group, __ATOMIC_RELAXED);
+#ifdef THREADPOOL_STATS
+        __atomic_store_n(&slot->submitted, task->submitted, __ATOMIC_RELAXED);
+#endif
+}
+
+/* may race with the owner reusing the slot. the top CAS decides if it counts */
+static void
+threadpool_slot_load(ThreadpoolTask *slot, ThreadpoolTask *task) {
+        task->cb = __atomic_load_n(&slot->cb, __ATOMIC_RELAXED);
+        task->ctx = __atomic_load_n(&slot->ctx, __ATOMIC_RELAXED);
+        task->group = __atomic_load_n(&slot->group, __ATOMIC_RELAXED);
+#ifdef THREADPOOL_STATS
+        task->submitted = __atomic_load_n(&slot->submitted, __ATOMIC_RELAXED);
+#endif
+}
+
+/* owner only. returns 0 if the deque is full */
+static int
+threadpool_push(ThreadpoolDeque *d, const ThreadpoolTask *task) {
+        int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+        int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+        if(b - t >= THREADPOOL_DEQUE) return 0;
+        threadpool_slot_store(&d->tasks[b & (THREADPOOL_DEQUE - 1)], task);
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+        return 1;
+}
+
+/* owner only */
+static int
+threadpool_pop(ThreadpoolDeque *d, ThreadpoolTask *task) {
+        int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+        if(t > b) {
+                __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+                return 0;
+        }
+        threadpool_slot_load(&d->tasks[b & (THREADPOOL_DEQUE - 1)], task);
+        if(t == b) {
+                /* last task. race thieves for it */
+                int won = __atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+                __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+                return won;
         }
-        return run;
+        return 1;
 }
 
+/* any thread. returns 0 if empty or another thief won */
 static int
-threadpool_thread_run(void *ctx) {
-        (void) ctx;
-        ThreadpoolCallback cb;
-        int ready;
-        for(;;) {
-                mtx_lock(&threadpool_callback_lock);
-                ready = threadpool_dequeue(&cb);
-                while(!ready) {
-                        cnd_wait(&threadpool_callback_cond, &threadpool_callback_lock);
-                        ready = threadpool_dequeue(&cb);
+threadpool_steal(ThreadpoolDeque *d, ThreadpoolTask *task) {
+        int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+        if(t >= b) return 0;
+        threadpool_slot_load(&d->tasks[t & (THREADPOOL_DEQUE - 1)], task);
+        return __atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* w is null for threads outside the pool */
+static int
+threadpool_steal_any(Threadpool *pool, ThreadpoolWorker *w, int lane, ThreadpoolTask *task) {
+        /* xorshift to spread thieves over victims */
+        uint64_t x = threadpool_seed;
+        if(!x) x = (uintptr_t)&x | 1;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        threadpool_seed = x;
+        int n = pool->nworkers;
+        int start = (int)(x % n);
+        for(int i=0;i<n;i++) {
+                ThreadpoolWorker *v = pool->workers[(start + i) % n];
+                if(v != w && threadpool_steal(&v->lanes[lane], task)) return 1;
+        }
+        return 0;
+}
+
+static void
+threadpool_queue_push(ThreadpoolQueue *q, const ThreadpoolTask *task) {
+        if(!__atomic_load_n(&q->count, __ATOMIC_ACQUIRE) && queue_mpmc_push(&q->ring, task)) {
+#ifdef THREADPOOL_STATS
+                size_t n = queue_mpmc_count(&q->ring);
+                if(n > __atomic_load_n(&q->max, __ATOMIC_RELAXED)) __atomic_store_n(&q->max, n, __ATOMIC_RELAXED);
+#endif
+                return;
+        }
+        mtx_lock(&q->lock);
+        if(q->count == q->cap) {
+                size_t cap = q->cap ? q->cap * 2 : 1024;
+                ThreadpoolTask *tasks = (ThreadpoolTask*)malloc(cap * sizeof *tasks);
+                for(size_t i=0;i<q->count;i++)
+                        tasks[i] = q->tasks[(q->head + i) & (q->cap - 1)];
+                free(q->tasks);
+                q->tasks = tasks;
+                q->cap = cap;
+                q->head = 0;
+        }
+        q->tasks[(q->head + q->count) & (q->cap - 1)] = *task;
+        __atomic_store_n(&q->count, q->count + 1, __ATOMIC_RELEASE);
+#ifdef THREADPOOL_STATS
+        size_t n = q->count + queue_mpmc_count(&q->ring);
+        if(n > __atomic_load_n(&q->max, __ATOMIC_RELAXED)) __atomic_store_n(&q->max, n, __ATOMIC_RELAXED);
+#endif
+        mtx_unlock(&q->lock);
+}
+
+/* take one task from the overflow and move a share of the rest to d if any.
+   returns how many tasks left the queue */
+static int
+threadpool_overflow_take(ThreadpoolQueue *q, int nworkers, ThreadpoolDeque *d, ThreadpoolTask *task) {
+        if(!__atomic_load_n(&q->count, __ATOMIC_ACQUIRE)) return 0;
+        mtx_lock(&q->lock);
+        size_t n = q->count, moved = 0;
+        if(n) {
+                size_t mask = q->cap - 1;
+                size_t batch = (n - 1) / nworkers;
+                if(batch > THREADPOOL_BATCH) batch = THREADPOOL_BATCH;
+                *task = q->tasks[q->head];
+                q->head = (q->head + 1) & mask;
+                while(d && moved < batch && threadpool_push(d, &q->tasks[q->head])) {
+                        q->head = (q->head + 1) & mask;
+                        moved++;
+                }
+                __atomic_store_n(&q->count, n - 1 - moved, __ATOMIC_RELEASE);
+        }
+        mtx_unlock(&q->lock);
+        return n ? (int)moved + 1 : 0;
+}
+
+/* same for the whole shared queue. the overflow holds the older tasks */
+static int
+threadpool_queue_take(ThreadpoolQueue *q, int nworkers, ThreadpoolDeque *d, ThreadpoolTask *task) {
+        int taken = threadpool_overflow_take(q, nworkers, d, task);
+        if(taken || !queue_mpmc_pop(&q->ring, task)) return taken;
+        if(!d) return 1;
+        /* only the owner pushes so the room can only grow meanwhile */
+        int64_t room = THREADPOOL_DEQUE - (__atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE));
+        size_t batch = queue_mpmc_count(&q->ring) / nworkers;
+        if(batch > THREADPOOL_BATCH) batch = THREADPOOL_BATCH;
+        if((int64_t)batch > room) batch = (size_t)room;
+        ThreadpoolTask next;
+        for(taken=1;(size_t)taken<=batch && queue_mpmc_pop(&q->ring, &next);taken++)
+                threadpool_push(d, &next);
+        return taken;
+}
+
+/* work is queued somewhere or the pool is stopping */
+static int
+threadpool_pending(Threadpool *pool) {
+        if(__atomic_load_n(&pool->stop, __ATOMIC_SEQ_CST)) return 1;
+        for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                if(__atomic_load_n(&pool->queues[lane].count, __ATOMIC_SEQ_CST) ||
+                        queue_mpmc_count(&pool->queues[lane].ring))
+                        return 1;
+                for(int i=0;i<pool->nworkers;i++) {
+                        ThreadpoolDeque *d = &pool->workers[i]->lanes[lane];
+                        if(__atomic_load_n(&d->top, __ATOMIC_SEQ_CST) < __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST))
+                                return 1;
                 }
-                mtx_unlock(&threadpool_callback_lock);
-                if(ready) cb.cb(cb.ctx);
         }
         return 0;
 }
 
-static void threadpool_lock_init(void) {
-        mtx_init(&threadpool_callback_lock, mtx_plain);
+/* wake a sleeping worker after queueing a task. the fence pairs with the
+   one in threadpool_park so either the sleeper sees the task or we see it */
+static void
+threadpool_notify(Threadpool *pool) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST)) return;
+        __atomic_fetch_add(&pool->epoch, 1, __ATOMIC_SEQ_CST);
+        threadpool_futex_wake(pool, &pool->epoch, 1);
 }
 
-/* safe to call multiple times */
 static void
-threadpool_start() {
-        if(threadpool_started) return;
-        call_once(&threadpool_callback_lock_init, threadpool_lock_init);
-        mtx_lock(&threadpool_callback_lock);
-        if(!threadpool_started) {
-            cnd_init(&threadpool_callback_cond);
-            sem_init(&threadpool_callback_sem, 0, THREADPOOL_NCALLBACKS);
-#ifdef _WIN32
-            SYSTEM_INFO info = {0};
-            GetSystemInfo(&info);
-            int cpus = (int)info.dwNumberOfProcessors;
+threadpool_park(Threadpool *pool, ThreadpoolWorker *w) {
+        __atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        int epoch = __atomic_load_n(&pool->epoch, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(!threadpool_pending(pool)) {
+                THREADPOOL_COUNT(pool, w, parks, 1);
+                threadpool_futex_wait(pool, &pool->epoch, epoch);
+        }
+        __atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+/* one look at every queue, highest lane first. w is null for threads
+   outside the pool. returns the lane + 1 of the task found or 0 */
+static int
+threadpool_help(Threadpool *pool, ThreadpoolWorker *w, ThreadpoolTask *task) {
+        for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                ThreadpoolDeque *d = w ? &w->lanes[lane] : 0;
+                if(d && threadpool_pop(d, task)) return lane + 1;
+                int taken = threadpool_queue_take(&pool->queues[lane], pool->nworkers, d, task);
+                if(taken) {
+                        THREADPOOL_COUNT(pool, w, shared, taken);
+                        return lane + 1;
+                }
+                if(threadpool_steal_any(pool, w, lane, task)) {
+                        THREADPOOL_COUNT(pool, w, steals, 1);
+                        return lane + 1;
+                }
+        }
+        return 0;
+}
+
+static int
+threadpool_find(Threadpool *pool, ThreadpoolWorker *w, ThreadpoolTask *task) {
+        for(int i=0;i<THREADPOOL_SPIN;i++) {
+                int lane = threadpool_help(pool, w, task);
+                if(lane) return lane;
+                threadpool_pause();
+        }
+        return 0;
+}
+
+static void
+threadpool_exec(Threadpool *pool, ThreadpoolWorker *w, const ThreadpoolTask *task, int lane) {
+        ThreadpoolGroup *g = task->group;
+        int prev = threadpool_lane;
+        threadpool_lane = lane;
+#ifdef THREADPOOL_STATS
+        uint64_t start = threadpool_ns();
+        THREADPOOL_COUNT(pool, w, wait[threadpool_bucket(start - task->submitted)], 1);
+        threadpool_depth++;
 #else
-            int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        (void)w;
+#endif
+        task->cb(task->ctx);
+#ifdef THREADPOOL_STATS
+        uint64_t ns = threadpool_ns() - start;
+        THREADPOOL_COUNT(pool, w, run[threadpool_bucket(ns)], 1);
+        if(!--threadpool_depth) THREADPOOL_COUNT(pool, w, busy_ns, ns);
+        THREADPOOL_COUNT(pool, w, tasks, 1);
 #endif
-            if(cpus < 1) cpus = 1;
-            while(cpus--) {
-                    thrd_t t;
-                    thrd_create(&t, threadpool_thread_run, 0);
-            }
-            threadpool_started = 1;
+        threadpool_lane = prev;
+        if(!g) return;
+        /* g may be gone as soon as the count drops so only the old value is used */
+        int old = __atomic_fetch_sub(&g->pending, 1, __ATOMIC_ACQ_REL);
+        if(old == (THREADPOOL_WAITER | 1)) {
+                __atomic_fetch_add(&pool->epoch, 1, __ATOMIC_SEQ_CST);
+                threadpool_futex_wake(pool, &pool->epoch, INT_MAX);
+                __atomic_fetch_add(&pool->done, 1, __ATOMIC_SEQ_CST);
+                threadpool_futex_wake(pool, &pool->done, INT_MAX);
         }
-        mtx_unlock(&threadpool_callback_lock);
+}
+
+static int
+threadpool_thread_run(void *ctx) {
+        ThreadpoolWorker *w = (ThreadpoolWorker*)ctx;
+        Threadpool *pool = w->pool;
+        ThreadpoolTask task;
+        threadpool_self = w;
+        if(pool->cpus) {
+                if(pool->pin) threadpool_affinity(&pool->cpus[w->index % pool->ncpus], 1);
+                else threadpool_affinity(pool->cpus, pool->ncpus);
+        }
+        /* first touch from the pinned thread puts the deques on its node */
+        for(int lane=0;lane<THREADPOOL_LANES;lane++)
+                memset(w->lanes[lane].tasks, 0, sizeof w->lanes[lane].tasks);
+        for(;;) {
+                int lane = threadpool_find(pool, w, &task);
+                if(lane) threadpool_exec(pool, w, &task, lane - 1);
+                else if(__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) break;
+                else threadpool_park(pool, w);
+        }
+        threadpool_self = 0;
+        return 0;
+}
+
+THREADPOOL_API Threadpool*
+threadpool_new(const ThreadpoolConfig *config) {
+        ThreadpoolConfig defaults;
+        memset(&defaults, 0, sizeof defaults);
+        if(!config) config = &defaults;
+        Threadpool *pool = (Threadpool*)calloc(1, sizeof *pool);
+        if(!pool) return 0;
+        int ncpus = 0;
+        if(config->numa || config->pin) {
+                pool->cpus = (int*)malloc(THREADPOOL_MAX_CPUS * sizeof *pool->cpus);
+                if(config->numa)
+                        ncpus = threadpool_node_cpus(config->numa_node, pool->cpus, THREADPOOL_MAX_CPUS);
+                else
+                        for(int n=threadpool_online_cpus();ncpus<n && ncpus<THREADPOOL_MAX_CPUS;ncpus++)
+                                pool->cpus[ncpus] = ncpus;
+                if(!ncpus) {
+                        /* no such node */
+                        free(pool->cpus);
+                        pool->cpus = 0;
+                }
+        }
+        pool->ncpus = ncpus;
+        pool->pin = config->pin;
+#ifdef THREADPOOL_STATS
+        pool->started = threadpool_ns();
+#endif
+        pool->nworkers = config->threads > 0 ? config->threads : ncpus ? ncpus : threadpool_online_cpus();
+        for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                queue_mpmc_init(&pool->queues[lane].ring, THREADPOOL_SHARED, sizeof(ThreadpoolTask));
+                mtx_init(&pool->queues[lane].lock, mtx_plain);
+        }
+#ifndef __linux__
+        mtx_init(&pool->park_lock, mtx_plain);
+        cnd_init(&pool->park_cond);
+        cnd_init(&pool->done_cond);
+#endif
+        /* separate allocations so each worker's deques can live on its node */
+        pool->workers = (ThreadpoolWorker**)calloc(pool->nworkers, sizeof *pool->workers);
+        for(int i=0;i<pool->nworkers;i++) {
+                pool->workers[i] = (ThreadpoolWorker*)calloc(1, sizeof **pool->workers);
+                pool->workers[i]->pool = pool;
+                pool->workers[i]->index = i;
+        }
+        for(int i=0;i<pool->nworkers;i++)
+                thrd_create(&pool->workers[i]->thread, threadpool_thread_run, pool->workers[i]);
+        return pool;
+}
+
+THREADPOOL_API void
+threadpool_destroy(Threadpool *pool) {
+        if(!pool) return;
+        __atomic_store_n(&pool->stop, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&pool->epoch, 1, __ATOMIC_SEQ_CST);
+        threadpool_futex_wake(pool, &pool->epoch, INT_MAX);
+        for(int i=0;i<pool->nworkers;i++) thrd_join(pool->workers[i]->thread, 0);
+        for(int i=0;i<pool->nworkers;i++) free(pool->workers[i]);
+        for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                queue_mpmc_free(&pool->queues[lane].ring);
+                mtx_destroy(&pool->queues[lane].lock);
+                free(pool->queues[lane].tasks);
+        }
+#ifndef __linux__
+        mtx_destroy(&pool->park_lock);
+        cnd_destroy(&pool->park_cond);
+        cnd_destroy(&pool->done_cond);
+#endif
+        free(pool->workers);
+        free(pool->cpus);
+        free(pool);
+}
+
+static void
+threadpool_init(void) {
+        threadpool_global = threadpool_new(0);
+}
+
+THREADPOOL_API Threadpool*
+threadpool_default(void) {
+        call_once(&threadpool_once, threadpool_init);
+        return threadpool_global;
+}
+
+/* the pool of the calling worker or the default pool */
+static Threadpool*
+threadpool_current(void) {
+        return threadpool_self ? threadpool_self->pool : threadpool_default();
+}
+
+static void
+threadpool_submit(Threadpool *pool, int lane, threadpool_cb cb, void *ctx, ThreadpoolGroup *group) {
+        ThreadpoolTask task;
+        task.cb = cb;
+        task.ctx = ctx;
+        task.group = group;
+#ifdef THREADPOOL_STATS
+        task.submitted = threadpool_ns();
+#endif
+        /* tasks spawned by tasks stay on this worker unless stolen */
+        ThreadpoolWorker *w = threadpool_self;
+        if(w && w->pool == pool) {
+                if(threadpool_push(&w->lanes[lane], &task)) {
+                        threadpool_notify(pool);
+                        return;
+                }
+                THREADPOOL_COUNT(pool, w, overflows, 1);
+        }
+        threadpool_queue_push(&pool->queues[lane], &task);
+        threadpool_notify(pool);
+}
+
+THREADPOOL_API void
+threadpool_post(Threadpool *pool, int lane, threadpool_cb cb, void *ctx) {
+        threadpool_submit(pool ? pool : threadpool_current(), lane, cb, ctx, 0);
 }
 
 THREADPOOL_API void
 threadpool_run(threadpool_cb cb, void *ctx) {
-        if(!threadpool_started) threadpool_start();
+        threadpool_submit(threadpool_current(), threadpool_lane, cb, ctx, 0);
+}
+
+THREADPOOL_API void
+threadpool_spawn_on(Threadpool *pool, int lane, ThreadpoolGroup *group, threadpool_cb cb, void *ctx) {
+        if(!pool) pool = group->pool ? group->pool : threadpool_current();
+        group->pool = pool;
+        __atomic_fetch_add(&group->pending, 1, __ATOMIC_RELAXED);
+        threadpool_submit(pool, lane, cb, ctx, group);
+}
+
+THREADPOOL_API void
+threadpool_spawn(ThreadpoolGroup *group, threadpool_cb cb, void *ctx) {
+        threadpool_spawn_on(0, threadpool_lane, group, cb, ctx);
+}
+
+THREADPOOL_API void
+threadpool_wait(ThreadpoolGroup *group) {
+        Threadpool *pool = group->pool;
+        /* only workers of this pool help. other threads have no deque so
+           they would run the oldest shared task and could nest without bound */
+        ThreadpoolWorker *w = threadpool_self && threadpool_self->pool == pool ? threadpool_self : 0;
+        ThreadpoolTask task;
+        int idle = 0;
+        while(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) & ~THREADPOOL_WAITER) {
+                int lane = w ? threadpool_help(pool, w, &task) : 0;
+                if(lane) {
+                        threadpool_exec(pool, w, &task, lane - 1);
+                        idle = 0;
+                        continue;
+                }
+                if(++idle < THREADPOOL_SPIN) {
+                        threadpool_pause();
+                        continue;
+                }
+                /* the last task of the group wakes everyone if it sees the flag.
+                   a worker counts as a sleeper and parks on the epoch so new
+                   tasks wake it as well. other threads park on their own word
+                   since the one wakeup a post sends must reach a worker */
+                __atomic_fetch_or(&group->pending, THREADPOOL_WAITER, __ATOMIC_SEQ_CST);
+                if(w) __atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+                int *word = w ? &pool->epoch : &pool->done;
+                int epoch = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if(__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) & ~THREADPOOL_WAITER && !(w && threadpool_pending(pool))) {
+                        THREADPOOL_COUNT(pool, w, parks, 1);
+                        threadpool_futex_wait(pool, word, epoch);
+                }
+                if(w) __atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+                idle = 0;
+        }
+        /* ready for reuse */
+        __atomic_store_n(&group->pending, 0, __ATOMIC_RELAXED);
+}
 
-        ThreadpoolCallback callback;
-        int i;
-        callback.cb = cb;
-        callback.ctx = ctx;
+#ifdef THREADPOOL_STATS
+static void
+threadpool_stats_add(ThreadpoolWorkerStats *total, ThreadpoolWorkerStats *s, ThreadpoolWorkerStats *copy) {
+        uint64_t *from = (uint64_t*)s, *to = (uint64_t*)total, *out = (uint64_t*)copy;
+        for(size_t i=0;i<sizeof *s / sizeof(uint64_t);i++) {
+                uint64_t v = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+                to[i] += v;
+                if(out) out[i] = v;
+        }
+}
 
-        sem_wait(&threadpool_callback_sem);
-        mtx_lock(&threadpool_callback_lock);
-        i = (threadpool_callback_head + threadpool_callback_count++) % THREADPOOL_NCALLBACKS;
-        threadpool_callbacks[i] = callback;
-        cnd_signal(&threadpool_callback_cond);
-        mtx_unlock(&threadpool_callback_lock);
+THREADPOOL_API void
+threadpool_stats(Threadpool *pool, ThreadpoolStats *stats, ThreadpoolWorkerStats *workers, int max) {
+        memset(stats, 0, sizeof *stats);
+        stats->workers = pool->nworkers;
+        stats->elapsed_ns = threadpool_ns() - pool->started;
+        for(int i=0;i<pool->nworkers;i++) {
+                ThreadpoolWorker *w = pool->workers[i];
+                threadpool_stats_add(&stats->total, &w->stats, workers && i < max ? &workers[i] : 0);
+                for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                        int64_t n = __atomic_load_n(&w->lanes[lane].bottom, __ATOMIC_RELAXED) -
+                                __atomic_load_n(&w->lanes[lane].top, __ATOMIC_RELAXED);
+                        if(n > 0) stats->queued += (size_t)n;
+                }
+        }
+        if(stats->elapsed_ns)
+                stats->utilization = (double)stats->total.busy_ns / ((double)stats->elapsed_ns * pool->nworkers);
+        threadpool_stats_add(&stats->total, &pool->outside, 0);
+        for(int lane=0;lane<THREADPOOL_LANES;lane++) {
+                ThreadpoolQueue *q = &pool->queues[lane];
+                size_t max = __atomic_load_n(&q->max, __ATOMIC_RELAXED);
+                stats->shared += __atomic_load_n(&q->count, __ATOMIC_RELAXED) + queue_mpmc_count(&q->ring);
+                if(max > stats->shared_max) stats->shared_max = max;
+        }
+        stats->queued += stats->shared;
+}
+#endif
+
+static void
+threadpool_future_run(void *ctx) {
+        ThreadpoolFuture *f = (ThreadpoolFuture*)ctx;
+        f->result = f->fn(f->ctx);
+}
+
+THREADPOOL_API void
+threadpool_async(ThreadpoolFuture *future, threadpool_fn fn, void *ctx) {
+        future->group.pending = 0;
+        future->group.pool = 0;
+        future->fn = fn;
+        future->ctx = ctx;
+        future->result = 0;
+        threadpool_spawn(&future->group, threadpool_future_run, future);
+}
+
+THREADPOOL_API void*
+threadpool_get(ThreadpoolFuture *future) {
+        threadpool_wait(&future->group);
+        return future->result;
+}
+
+typedef struct ThreadpoolChunk {
+        threadpool_range_fn fn;
+        const ThreadpoolReduce *reduce;
+        void *ctx;
+        void *acc;
+        size_t begin, end;
+} ThreadpoolChunk;
+
+static void
+threadpool_chunk_run(void *arg) {
+        ThreadpoolChunk *c = (ThreadpoolChunk*)arg;
+        if(c->reduce) c->reduce->range(c->ctx, c->begin, c->end, c->acc);
+        else c->fn(c->ctx, c->begin, c->end);
+}
+
+/* a few chunks per worker so stealing evens out uneven chunks */
+static size_t
+threadpool_nchunks(size_t n, size_t grain) {
+        size_t chunks = (size_t)threadpool_current()->nworkers * 4;
+        if(!grain) grain = 1;
+        if(chunks > n / grain) chunks = n / grain;
+        if(chunks > THREADPOOL_CHUNKS) chunks = THREADPOOL_CHUNKS;
+        return chunks ? chunks : 1;
+}
+
+/* runs chunk 0 on this thread and the rest as tasks */
+static void
+threadpool_chunks(ThreadpoolChunk *c, size_t nchunks) {
+        ThreadpoolGroup group = {0};
+        for(size_t i=1;i<nchunks;i++) threadpool_spawn(&group, threadpool_chunk_run, &c[i]);
+        threadpool_chunk_run(&c[0]);
+        threadpool_wait(&group);
+}
+
+THREADPOOL_API void
+threadpool_for(size_t begin, size_t end, size_t grain, threadpool_range_fn fn, void *ctx) {
+        if(begin >= end) return;
+        ThreadpoolChunk c[THREADPOOL_CHUNKS];
+        size_t n = end - begin;
+        size_t nchunks = threadpool_nchunks(n, grain);
+        for(size_t i=0;i<nchunks;i++) {
+                c[i].fn = fn;
+                c[i].reduce = 0;
+                c[i].ctx = ctx;
+                c[i].acc = 0;
+                c[i].begin = begin + n / nchunks * i + (i < n % nchunks ? i : n % nchunks);
+                c[i].end = c[i].begin + n / nchunks + (i < n % nchunks);
+        }
+        threadpool_chunks(c, nchunks);
+}
+
+THREADPOOL_API void
+threadpool_reduce(size_t begin, size_t end, size_t grain, const ThreadpoolReduce *reduce, void *ctx, void *result) {
+        reduce->init(ctx, result);
+        if(begin >= end) return;
+        ThreadpoolChunk c[THREADPOOL_CHUNKS];
+        size_t n = end - begin;
+        size_t nchunks = threadpool_nchunks(n, grain);
+        size_t stride = (reduce->size + 15) & ~(size_t)15;
+        char *accs = (char*)malloc(stride * nchunks);
+        for(size_t i=0;i<nchunks;i++) {
+                c[i].fn = 0;
+                c[i].reduce = reduce;
+                c[i].ctx = ctx;
+                c[i].acc = accs + stride * i;
+                c[i].begin = begin + n / nchunks * i + (i < n % nchunks ? i : n % nchunks);
+                c[i].end = c[i].begin + n / nchunks + (i < n % nchunks);
+                reduce->init(ctx, c[i].acc);
+        }
+        threadpool_chunks(c, nchunks);
+        for(size_t i=0;i<nchunks;i++) reduce->join(ctx, result, c[i].acc);
+        free(accs);
 }
 
 #endif
 #ifdef THREADPOOL_EXAMPLE
 #include <stdio.h>
+#include <assert.h>
+#include "now.h"
 static void run(void *ctx) {
 	fprintf(stderr, "running\n");
     int *i = (int*)ctx;
     *i = 1;
 }
+
+/* 1-10us tasks dominated by scheduling cost before */
+#define NTASKS 1000000
+static int example_done;
+static void tiny(void *ctx) {
+    (void)ctx;
+    __atomic_fetch_add(&example_done, 1, __ATOMIC_RELAXED);
+}
+static void spawner(void *ctx) {
+    /* submits from inside a task go to this worker's deque */
+    ThreadpoolGroup group = {0};
+    int n = *(int*)ctx;
+    for(int i=0;i<n;i++) threadpool_spawn(&group, tiny, 0);
+    threadpool_wait(&group);
+}
+
+/* nested futures. waiting threads run other tasks instead of blocking */
+static void* fib(void *ctx) {
+    size_t n = (size_t)ctx;
+    if(n < 2) return ctx;
+    ThreadpoolFuture f;
+    threadpool_async(&f, fib, (void*)(n - 1));
+    size_t b = (size_t)fib((void*)(n - 2));
+    return (void*)((size_t)threadpool_get(&f) + b);
+}
+
+/* a long task posts work and spins until it runs. an outside thread
+   parked in threadpool_wait must not swallow the wakeup meant for the
+   idle worker or the posted task would sit in the deque until timeout */
+static Threadpool *example_pool;
+static int example_ran;
+static void mark(void *ctx) { (void)ctx; __atomic_store_n(&example_ran, 1, __ATOMIC_RELEASE); }
+static void busy(void *ctx) {
+    double end = now() + *(double*)ctx;
+    while(now() < end) thrd_yield();
+}
+static void poster(void *ctx) {
+    double t = now() + 0.1;
+    while(now() < t) thrd_yield();
+    threadpool_post(example_pool, THREADPOOL_NORMAL, mark, 0);
+    t = now() + 2;
+    while(!__atomic_load_n(&example_ran, __ATOMIC_ACQUIRE) && now() < t) thrd_yield();
+    *(double*)ctx = now() < t;
+}
+
+static void fill(void *ctx, size_t begin, size_t end) {
+    double *x = (double*)ctx;
+    for(size_t i=begin;i<end;i++) x[i] = (double)i;
+}
+static void sum_init(void *ctx, void *acc) { (void)ctx; *(double*)acc = 0; }
+static void sum_range(void *ctx, size_t begin, size_t end, void *acc) {
+    const double *x = (const double*)ctx;
+    double sum = 0;
+    for(size_t i=begin;i<end;i++) sum += x[i];
+    *(double*)acc += sum;
+}
+static void sum_join(void *ctx, void *acc, const void *other) {
+    (void)ctx;
+    *(double*)acc += *(const double*)other;
+}
+
 int main(int argc, char **argv) {
     int i=0;
-	threadpool_start();
-    threadpool_run(run, &i);
-    while(i != 1) {}
+    ThreadpoolGroup group = {0};
+    threadpool_spawn(&group, run, &i);
+    threadpool_wait(&group);
+    assert(i == 1);
+
+    double t = now();
+    for(int k=0;k<NTASKS;k++) threadpool_spawn(&group, tiny, 0);
+    threadpool_wait(&group);
+    printf("external submit: %.0f tasks/s\n", NTASKS / (now() - t));
+
+    int per = NTASKS / 100;
+    t = now();
+    for(int k=0;k<100;k++) threadpool_spawn(&group, spawner, &per);
+    threadpool_wait(&group);
+    printf("submit from tasks: %.0f tasks/s\n", NTASKS / (now() - t));
+    assert(example_done == 2 * NTASKS);
+
+    t = now();
+    size_t f = (size_t)fib((void*)25);
+    printf("fib(25) = %zu with futures in %.3fs\n", f, now() - t);
+    assert(f == 75025);
+
+    size_t n = 10000000;
+    double *x = (double*)malloc(n * sizeof *x);
+    ThreadpoolReduce sum = {sizeof(double), sum_init, sum_range, sum_join};
+    double total;
+    t = now();
+    threadpool_for(0, n, 0, fill, x);
+    threadpool_reduce(0, n, 4096, &sum, x, &total);
+    printf("parallel for and reduce over %zu: %.3fs\n", n, now() - t);
+    assert(total == (double)n * (n - 1) / 2);
+    free(x);
+
+    /* a second pool with its own threads. urgent work jumps the queue */
+    ThreadpoolConfig config = {0};
+    config.threads = 2;
+    config.pin = 1;
+    Threadpool *pool = threadpool_new(&config);
+    ThreadpoolGroup lanes = {0};
+    example_done = 0;
+    for(int k=0;k<1000;k++) threadpool_spawn_on(pool, THREADPOOL_LOW, &lanes, tiny, 0);
+    threadpool_spawn_on(pool, THREADPOOL_HIGH, &lanes, run, &i);
+    threadpool_wait(&lanes);
+    assert(example_done == 1000);
+    /* queued tasks still run before the workers are joined */
+    for(int k=0;k<1000;k++) threadpool_post(pool, THREADPOOL_NORMAL, tiny, 0);
+    threadpool_destroy(pool);
+    assert(example_done == 2000);
+
+    /* the other worker finishes its short task and parks after main */
+    config.pin = 0;
+    example_pool = threadpool_new(&config);
+    double shortly = 0.05, ok = 0;
+    ThreadpoolGroup outside = {0};
+    threadpool_post(example_pool, THREADPOOL_NORMAL, busy, &shortly);
+    threadpool_spawn_on(example_pool, THREADPOOL_NORMAL, &outside, poster, &ok);
+    threadpool_wait(&outside);
+    assert(ok);
+    threadpool_destroy(example_pool);
+
+#ifdef THREADPOOL_STATS
+    ThreadpoolStats stats;
+    ThreadpoolWorkerStats workers[64];
+    threadpool_stats(threadpool_default(), &stats, workers, 64);
+    printf("%d workers %.0f%% busy, %llu tasks, %llu from the shared queue (max depth %zu), %llu steals, %llu parks, %llu overflows\n",
+        stats.workers, stats.utilization * 100, (unsigned long long)stats.total.tasks,
+        (unsigned long long)stats.total.shared, stats.shared_max, (unsigned long long)stats.total.steals,
+        (unsigned long long)stats.total.parks, (unsigned long long)stats.total.overflows);
+    for(int k=0;k<stats.workers && k<64;k++)
+        printf("  worker %d: %llu tasks, %.3fs busy\n", k, (unsigned long long)workers[k].tasks, workers[k].busy_ns / 1e9);
+    printf("  ns     wait      run\n");
+    for(int b=0;b<THREADPOOL_HISTOGRAM;b++)
+        if(stats.total.wait[b] || stats.total.run[b])
+            printf("  2^%-2d %8llu %8llu\n", b, (unsigned long long)stats.total.wait[b], (unsigned long long)stats.total.run[b]);
+#endif
     return 0;
 }
 #endif
@@ -9,6 +9,8 @@
 #define WEBSOCKET_API extern
 #endif
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -22,15 +24,93 @@ typedef struct WsStats {
 	double send_time, recv_time;
 } WsStats;
 
+enum {
+	WS_CONTINUATION = 0,
+	WS_TEXT = 1,
+	WS_BINARY = 2,
+	WS_CLOSE = 8,
+	WS_PING = 9,
+	WS_PONG = 10,
+	WS_WRITABLE = 16 /* not a frame. see ws_message_fn */
+};
+
+/* receive buffer reused between messages. fragments of a message are joined
+   in place and consumed bytes are dropped by moving the rest to the front */
+typedef struct WsBuf {
+	char *buf;
+	size_t cap;
+	size_t start, end; /* unparsed bytes */
+	size_t msg, nmsg;  /* fragments of the current message joined so far */
+	int partial;       /* opcode of the fragmented message in progress or 0 */
+	int deflated;      /* the partial message is compressed */
+	char *z;           /* inflated messages */
+	size_t zcap;
+} WsBuf;
+
+/* view of a received message. data is valid until the next wsrecvmsg() with the same buffer */
+typedef struct WsMsg {
+	const char *data;
+	size_t n;
+	int op; /* WS_TEXT, WS_BINARY or a control frame */
+} WsMsg;
+
+/* permessage-deflate (RFC 7692) settings. the server may lower them, but
+   the handshake fails if it asks for a client window under 9 bits */
+typedef struct WsDeflate {
+	int client_max_window_bits; /* 9-15 or 0 for 15 */
+	int server_max_window_bits; /* 8-15 or 0 to let the server choose */
+	int client_no_context_takeover; /* compress each message on its own */
+	int server_no_context_takeover;
+	int level; /* zlib level or 0 for the default */
+} WsDeflate;
+
 WEBSOCKET_API struct WsConn* wsconnect(int fd, const char *host);
+/* offers permessage-deflate. messages are then compressed and inflated by
+   wssend, wsqueue and wsrecvmsg. deflate may be null to not offer it */
+WEBSOCKET_API struct WsConn* wsconnect_deflate(int fd, const char *host, const WsDeflate *deflate);
 WEBSOCKET_API struct WsConn* wsconnect1(const char *host, int port, const char *socks_host, int socks_port);
 WEBSOCKET_API char* wsrecv(struct WsConn*, size_t *n);
 WEBSOCKET_API char* wsrecvzlib(struct WsConn*, size_t *n);
 WEBSOCKET_API int wssend(struct WsConn*, const void *data, size_t n, int binary);
 WEBSOCKET_API int wssendtext(struct WsConn*, const void *data, size_t n);
 WEBSOCKET_API int wssendzlib(struct WsConn*, const void *data, size_t n);
+/* send several messages with one write. op of each is WS_TEXT, WS_BINARY or a control frame */
+WEBSOCKET_API int wssendv(struct WsConn*, const WsMsg *msgs, size_t n);
 WEBSOCKET_API void wsstats(struct WsConn *, WsStats *);
 WEBSOCKET_API void wsclose(struct WsConn *conn);
+/* cap is the initial size and grows to fit the largest message. 0 for a default */
+WEBSOCKET_API void wsbuf_init(WsBuf *b, size_t cap);
+WEBSOCKET_API void wsbuf_free(WsBuf *b);
+/* receive the next message or control frame without copying. b may be null to use
+   a buffer owned by the connection. returns 0 on success or -1 on error */
+WEBSOCKET_API int wsrecvmsg(struct WsConn*, WsBuf *b, WsMsg *msg);
+
+#ifdef __linux__
+/* runs many connections on one thread with epoll. not thread safe: call
+   everything for a loop and its connections from the thread running it */
+typedef struct WsLoop WsLoop;
+/* called for data messages and pongs. pings are answered by the loop.
+   op is WS_CLOSE when the server closed or the connection failed and the
+   connection is freed after the callback returns. op is WS_WRITABLE when
+   wsqueue() refused a frame and the queue has drained to half its limit */
+typedef void (*ws_message_fn)(void *ctx, struct WsConn *conn, const WsMsg *msg);
+WEBSOCKET_API WsLoop* wsloop_new(void);
+/* closes connections still in the loop */
+WEBSOCKET_API void wsloop_destroy(WsLoop *loop);
+/* makes conn non blocking and services it from wsloop_run().
+   max_pending limits queued bytes for wsqueue(). 0 for no limit */
+WEBSOCKET_API int wsloop_add(WsLoop *loop, struct WsConn *conn, ws_message_fn fn, void *ctx, size_t max_pending);
+/* conn is left non blocking. unsent frames are dropped */
+WEBSOCKET_API void wsloop_remove(WsLoop *loop, struct WsConn *conn);
+/* waits up to timeout_ms (-1 forever), runs callbacks and then writes all
+   frames queued during the pass. returns number of events or -1 */
+WEBSOCKET_API int wsloop_run(WsLoop *loop, int timeout_ms);
+/* queue a frame of type op to be written by the loop. returns -1 when the
+   queue is over its limit. control frames are always queued */
+WEBSOCKET_API int wsqueue(struct WsConn *conn, const void *data, size_t n, int op);
+/* bytes queued and not yet written */
+WEBSOCKET_API size_t wspending(struct WsConn *conn);
+#endif
 
 #ifdef __cplusplus
 }
@@ -40,20 +120,66 @@ WEBSOCKET_API void wsclose(struct WsConn *conn);
 
 #ifdef WEBSOCKET_IMPLEMENTATION
 #include <tls.h>
-#ifdef WEBSOCKET_STATIC
+#if defined(WEBSOCKET_STATIC) || defined(WEBSOCKET_EXAMPLE)
     #define GZIP_STATIC
     #define SB_STATIC
 #endif
+#ifdef WEBSOCKET_EXAMPLE
+#define SOCKS5_STATIC
+#include "socks5.h"
+#endif
 #include "sb.h"
 #include "gzip.h"
 #include "now.h"
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define WEBSOCKET_BUFSIZE (64*1024)
+#ifndef WEBSOCKET_FRAGMENT
+/* larger messages are sent as several frames */
+#define WEBSOCKET_FRAGMENT (1024*1024)
+#endif
+#ifndef WEBSOCKET_MAX_MESSAGE
+/* bigger received messages, joined or inflated, fail the connection */
+#define WEBSOCKET_MAX_MESSAGE ((size_t)1 << 30)
+#endif
+#define WEBSOCKET_RSV1 (1 << 6)
+#define WEBSOCKET_EVENTS 64
 
 struct WsConn {
-    struct tls *tls;
+    struct tls *tls; /* null to use fd as a plain socket */
     int fd;
     size_t send, send_uncompressed;
     size_t recv, recv_uncompressed;
 	double send_time, recv_time;
+	WsBuf rb; /* used by wsrecv and for bytes read past the handshake */
+	int deflate; /* permessage-deflate was negotiated */
+	int deflate_reset, inflate_reset; /* no context takeover */
+	z_stream zout, zin;
+	WsBuf zb; /* compressed message being sent */
+	WsBuf fb; /* frames built by wssend */
+	uint64_t seed; /* for mask keys */
+#ifdef __linux__
+	WsBuf wb; /* frames queued by wsqueue */
+	struct WsLoop *loop;
+	struct WsConn *prev, *next, *next_dirty;
+	ws_message_fn fn;
+	void *ctx;
+	size_t max_pending;
+	unsigned events; /* registered with epoll */
+	int dirty, blocked, unread, read_wants_out, in_callback, closed;
+#endif
 };
 
 static struct tls_config *websocket_config;
@@ -78,18 +204,42 @@ wsstats(WsConn *conn, WsStats *stats) {
 	stats->recv_time = conn->recv_time;
 }
 
+/* tls_read and tls_write or the plain socket when tls is null. would
+   block comes back as TLS_WANT_POLLIN or TLS_WANT_POLLOUT either way */
+static ssize_t
+wsio_read(struct tls *tls, int fd, void *buf, size_t n) {
+	if(tls) return tls_read(tls, buf, n);
+	for(;;) {
+		ssize_t rc = recv(fd, (char*)buf, n, 0);
+		if(rc >= 0) return rc;
+		if(errno == EAGAIN || errno == EWOULDBLOCK) return TLS_WANT_POLLIN;
+		if(errno != EINTR) return -1;
+	}
+}
+
+static ssize_t
+wsio_write(struct tls *tls, int fd, const void *buf, size_t n) {
+	if(tls) return tls_write(tls, buf, n);
+	for(;;) {
+		ssize_t rc = send(fd, (const char*)buf, n, MSG_NOSIGNAL);
+		if(rc >= 0) return rc;
+		if(errno == EAGAIN || errno == EWOULDBLOCK) return TLS_WANT_POLLOUT;
+		if(errno != EINTR) return -1;
+	}
+}
+
 static int
-wstlssend(struct tls *tls, const void *data, size_t n) {
-	const char *p = data;
+wstlssend(struct tls *tls, int fd, const void *data, size_t n) {
+	const char *p = (const char*)data;
 	while(n) {
-		ssize_t rc = tls_write(tls, p, n);
+		ssize_t rc = wsio_write(tls, fd, p, n);
 		if(!rc) {
 			printf("connection closed by remote\n");
 			return -1;
 		}
 		if(rc == TLS_WANT_POLLIN || rc == TLS_WANT_POLLOUT) continue;
 		if(rc == -1) {
-			printf("send failed: %s\n", tls_error(tls));
+			printf("send failed: %s\n", tls ? tls_error(tls) : strerror(errno));
 			return -1;
 		}
 		n -= rc;
@@ -98,21 +248,113 @@ wstlssend(struct tls *tls, const void *data, size_t n) {
 	return 0;
 }
 
+WEBSOCKET_API void
+wsbuf_init(WsBuf *b, size_t cap) {
+	memset(b, 0, sizeof *b);
+	b->cap = cap ? cap : WEBSOCKET_BUFSIZE;
+	b->buf = (char*)malloc(b->cap);
+	if(!b->buf) b->cap = 0;
+}
+
+WEBSOCKET_API void
+wsbuf_free(WsBuf *b) {
+	free(b->buf);
+	free(b->z);
+	memset(b, 0, sizeof *b);
+}
+
+/* make room for n more bytes keeping the partial message and unparsed bytes */
 static int
-wstlsreadn(struct tls *tls, void *buf, size_t n) {
-	char *data = buf;
-	while(n > 0) {
-		ssize_t rc = tls_read(tls, data, n);
-		if(rc == -1) return -1;
+wsbuf_reserve(WsBuf *b, size_t n) {
+	size_t keep = b->partial ? b->msg : b->start;
+	if(keep) {
+		memmove(b->buf, b->buf + keep, b->end - keep);
+		b->end -= keep;
+		b->start -= keep;
+		if(b->partial) b->msg -= keep;
+	}
+	if(b->cap - b->end < n) {
+		size_t cap = b->cap * 2;
+		if(cap < b->end + n) cap = b->end + n;
+		char *p = (char*)realloc(b->buf, cap);
+		if(!p) return -1;
+		b->buf = p;
+		b->cap = cap;
+	}
+	return 0;
+}
+
+/* read as much as fits. returns bytes read or -1 */
+static ssize_t
+wsbuf_read(struct tls *tls, int fd, WsBuf *b) {
+	for(;;) {
+		ssize_t rc = wsio_read(tls, fd, b->buf + b->end, b->cap - b->end);
 		if(rc == TLS_WANT_POLLIN || rc == TLS_WANT_POLLOUT) continue;
-		data += rc;
-		n -= rc;
+		if(rc <= 0) return -1;
+		b->end += rc;
+		return rc;
 	}
+}
+
+static int
+wstoken(const char *tok, size_t ntok, const char *s) {
+	size_t n = strlen(s);
+	return ntok >= n && !strncasecmp(tok, s, n);
+}
+
+/* applies the server's answer to the permessage-deflate offer */
+static int
+wsextensions(WsConn *c, const char *resp, size_t n, const WsDeflate *opt) {
+	static const char name[] = "sec-websocket-extensions:";
+	const char *end = resp + n;
+	int found = 0;
+	int client_bits = opt && opt->client_max_window_bits ? opt->client_max_window_bits : 15;
+	int server_bits = 15;
+	for(const char *line = resp; line < end;) {
+		const char *eol = (const char*)memchr(line, '\n', end - line);
+		if(!eol) eol = end;
+		if((size_t)(eol - line) > sizeof name - 1 && !strncasecmp(line, name, sizeof name - 1)) {
+			const char *p = line + sizeof name - 1;
+			while(p < eol) {
+				while(p < eol && strchr(" \t\r;,", *p)) p++;
+				const char *tok = p;
+				while(p < eol && !strchr(" \t\r;,", *p)) p++;
+				size_t ntok = p - tok;
+				if(wstoken(tok, ntok, "permessage-deflate")) found = 1;
+				else if(wstoken(tok, ntok, "server_no_context_takeover")) c->inflate_reset = 1;
+				else if(wstoken(tok, ntok, "client_no_context_takeover")) c->deflate_reset = 1;
+				else if(wstoken(tok, ntok, "server_max_window_bits=")) server_bits = atoi(tok + 23);
+				else if(wstoken(tok, ntok, "client_max_window_bits=")) {
+					int bits = atoi(tok + 23);
+					if(bits < client_bits) client_bits = bits;
+				}
+			}
+		}
+		line = eol + 1;
+	}
+	if(!found) return 0;
+	if(!opt || server_bits < 8 || server_bits > 15) return -1;
+	/* zlib cannot write raw deflate with a 256 byte window, and a bigger
+	   one than agreed would send back references the server cannot reach */
+	if(client_bits < 9 || client_bits > 15) return -1;
+	if(opt->client_no_context_takeover) c->deflate_reset = 1;
+	if(deflateInit2(&c->zout, opt->level ? opt->level : Z_DEFAULT_COMPRESSION,
+		Z_DEFLATED, -client_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+	if(inflateInit2(&c->zin, -server_bits) != Z_OK) {
+		deflateEnd(&c->zout);
+		return -1;
+	}
+	c->deflate = 1;
 	return 0;
 }
 
 WEBSOCKET_API WsConn*
 wsconnect(int fd, const char *host) {
+	return wsconnect_deflate(fd, host, 0);
+}
+
+WEBSOCKET_API WsConn*
+wsconnect_deflate(int fd, const char *host, const WsDeflate *deflate) {
     websocket_init();
     struct tls *conn = tls_client();
     tls_configure(conn, websocket_config);
@@ -123,7 +365,8 @@ wsconnect(int fd, const char *host) {
 		if(rc == TLS_WANT_POLLIN || rc == TLS_WANT_POLLOUT) continue;
 		if(rc == -1) {
 			printf("handshake failed: %s\n", tls_error(conn));
-			goto error;
+			tls_free(conn);
+			return 0;
 		}
 	}
 
@@ -136,27 +379,65 @@ wsconnect(int fd, const char *host) {
 		"Sec-WebSocket-Protocol: chat, superchat\r\n"
 		"Sec-WebSocket-Version: 13\r\n"
 		"Origin: http://%s\r\n"
+		"%s"
 		"\r\n";
 
+	char ext[256] = "";
+	if(deflate) {
+		size_t n = snprintf(ext, sizeof ext, "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits");
+		if(deflate->client_max_window_bits)
+			n += snprintf(ext + n, sizeof ext - n, "=%d", deflate->client_max_window_bits);
+		if(deflate->server_max_window_bits)
+			n += snprintf(ext + n, sizeof ext - n, "; server_max_window_bits=%d", deflate->server_max_window_bits);
+		if(deflate->client_no_context_takeover)
+			n += snprintf(ext + n, sizeof ext - n, "; client_no_context_takeover");
+		if(deflate->server_no_context_takeover)
+			n += snprintf(ext + n, sizeof ext - n, "; server_no_context_takeover");
+		snprintf(ext + n, sizeof ext - n, "\r\n");
+	}
+
     char buf[1024];
-    size_t nbuf = snprintf(buf, sizeof buf, query, host, host);
+    size_t nbuf = snprintf(buf, sizeof buf, query, host, host, ext);
 
-    if(wstlssend(conn, buf, nbuf)) {
+    if(wstlssend(conn, fd, buf, nbuf)) {
         printf("http send failed: %s\n", tls_error(conn));
-        goto error;
+        tls_free(conn);
+        return 0;
     }
 
-    ssize_t rc = tls_read(conn, buf, sizeof buf);
-	if(rc == -1) {
-        printf("http recv failed: %s\n", tls_error(conn));
-		goto error;
-	}
-
-    WsConn *c = calloc(1, sizeof *c);
+    WsConn *c = (WsConn*)calloc(1, sizeof *c);
     if(!c) goto error;
     c->tls = conn;
     c->fd = fd;
+	c->seed = ((uint64_t)(now() * 1e9) ^ (uintptr_t)c) | 1;
+
+	/* frames may follow the response in the same read. they stay in rb */
+	wsbuf_init(&c->rb, 0);
+	for(;;) {
+		char *end = 0;
+		for(size_t i=3;i<c->rb.end && !end;i++)
+			if(!memcmp(c->rb.buf + i - 3, "\r\n\r\n", 4)) end = c->rb.buf + i + 1;
+		if(end) {
+			if(c->rb.end < 12 || memcmp(c->rb.buf + 8, " 101", 4)) {
+				printf("http upgrade failed: %.*s\n", (int)(end - c->rb.buf), c->rb.buf);
+				goto error_conn;
+			}
+			c->rb.start = end - c->rb.buf;
+			if(wsextensions(c, c->rb.buf, c->rb.start, deflate)) {
+				printf("bad permessage-deflate response\n");
+				goto error_conn;
+			}
+			break;
+		}
+		if(c->rb.end == c->rb.cap || wsbuf_read(conn, fd, &c->rb) < 0) {
+			printf("http recv failed: %s\n", tls_error(conn));
+			goto error_conn;
+		}
+	}
     return c;
+error_conn:
+	wsbuf_free(&c->rb);
+	free(c);
 error:
     tls_free(conn);
     return 0;
@@ -183,6 +464,15 @@ wsconnect1(const char *host, int port, const char *socks_host, int socks_port) {
 WEBSOCKET_API void
 wsclose(WsConn *conn) {
 	if(!conn) return;
+#ifdef __linux__
+	if(conn->loop) wsloop_remove(conn->loop, conn);
+	if(conn->in_callback) {
+		/* freed by the loop once the callback returns */
+		conn->closed = 1;
+		return;
+	}
+	wsbuf_free(&conn->wb);
+#endif
 	if(conn->tls) {
 		tls_close(conn->tls);
 		tls_free(conn->tls);
@@ -191,15 +481,21 @@ wsclose(WsConn *conn) {
 		shutdown(conn->fd, SHUT_RDWR);
 		close(conn->fd);
 	}
+	wsbuf_free(&conn->rb);
+	wsbuf_free(&conn->zb);
+	wsbuf_free(&conn->fb);
+	if(conn->deflate) {
+		deflateEnd(&conn->zout);
+		inflateEnd(&conn->zin);
+	}
     free(conn);
 }
 
-WEBSOCKET_API int
-wssend(WsConn *conn, const void *data, size_t n, int binary) {
-    conn->send += n;
-	uint8_t header[14];
+/* writes a frame header with mask key into header[14]. returns length */
+static size_t
+wsheader(uint8_t *header, int b0, size_t n, uint32_t key) {
 	size_t i=0;
-	header[i++] = (1 << 7) | (binary ? 2 : 1); /* single frame */
+	header[i++] = b0;
 	header[i] = (1 << 7);
 	if(n < 126) header[i++] |= n;
 	else if(n <= UINT16_MAX) {
@@ -208,39 +504,148 @@ wssend(WsConn *conn, const void *data, size_t n, int binary) {
 		header[i++] = n;
 	} else {
 		header[i++] |= 127;
-		header[i++] = n >> 56;
-		header[i++] = n >> 48;
-		header[i++] = n >> 40;
-		header[i++] = n >> 32;
+		header[i++] = (uint64_t)n >> 56;
+		header[i++] = (uint64_t)n >> 48;
+		header[i++] = (uint64_t)n >> 40;
+		header[i++] = (uint64_t)n >> 32;
 		header[i++] = n >> 24;
 		header[i++] = n >> 16;
 		header[i++] = n >> 8;
 		header[i++] = n;
 	}
 
-	/* mask */
-	header[i++] = 0;
-	header[i++] = 0;
-	header[i++] = 0;
-	header[i++] = 0;
+	/* mask bytes in memory order so payload can be xored a word at a time */
+	memcpy(header + i, &key, 4);
+	return i + 4;
+}
+
+static uint32_t
+wsrand(WsConn *conn) {
+	/* xorshift64* */
+	uint64_t x = conn->seed;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	conn->seed = x;
+	return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/* dst = src ^ key repeated. every step is a multiple of 4 bytes so the key stays aligned */
+static void
+wsmask(char *dst, const char *src, size_t n, uint32_t key) {
+	size_t i = 0;
+#ifdef __AVX2__
+	__m256i k32 = _mm256_set1_epi32((int)key);
+	for(;i+32<=n;i+=32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(v, k32));
+	}
+#endif
+#ifdef __SSE2__
+	__m128i k16 = _mm_set1_epi32((int)key);
+	for(;i+16<=n;i+=16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(v, k16));
+	}
+#endif
+	uint64_t k8 = (uint64_t)key << 32 | key;
+	for(;i+8<=n;i+=8) {
+		uint64_t v;
+		memcpy(&v, src + i, 8);
+		v ^= k8;
+		memcpy(dst + i, &v, 8);
+	}
+	const uint8_t *k = (const uint8_t*)&key;
+	for(;i<n;i++) dst[i] = src[i] ^ k[i & 3];
+}
+
+/* compress a message into conn->zb without the 00 00 ff ff tail */
+static int
+wsdeflate(WsConn *conn, const void *data, size_t n) {
+	WsBuf *out = &conn->zb;
+	z_stream *z = &conn->zout;
+	if(n > UINT_MAX) return -1;
+	out->start = out->end = 0;
+	z->next_in = (Bytef*)data;
+	z->avail_in = n;
+	do {
+		if(out->cap - out->end < 1024 && wsbuf_reserve(out, out->cap + 1024)) return -1;
+		z->next_out = (Bytef*)out->buf + out->end;
+		z->avail_out = out->cap - out->end;
+		if(deflate(z, Z_SYNC_FLUSH) == Z_STREAM_ERROR) return -1;
+		out->end = (char*)z->next_out - out->buf;
+	} while(!z->avail_out);
+	if(out->end < 4) return -1;
+	out->end -= 4;
+	if(conn->deflate_reset) deflateReset(z);
+	conn->send_uncompressed += n;
+	return 0;
+}
 
+/* append a message to out as masked frames of at most WEBSOCKET_FRAGMENT
+   bytes. with flush set every full fragment is written as soon as it is
+   built so a huge message is never copied whole */
+static int
+wsappend(WsConn *conn, WsBuf *out, const void *data, size_t n, int op, int flush) {
+	int rsv = 0;
+	if(op < WS_CLOSE && conn->deflate) {
+		if(wsdeflate(conn, data, n)) return -1;
+		data = conn->zb.buf;
+		n = conn->zb.end;
+		rsv = WEBSOCKET_RSV1;
+	}
+	conn->send += n;
+	const char *p = (const char*)data;
+	do {
+		size_t len = n < WEBSOCKET_FRAGMENT ? n : WEBSOCKET_FRAGMENT;
+		n -= len;
+		if(out->cap - out->end < len + 14 && wsbuf_reserve(out, len + 14)) return -1;
+		uint32_t key = wsrand(conn);
+		out->end += wsheader((uint8_t*)out->buf + out->end, (n ? 0 : 1 << 7) | rsv | op, len, key);
+		wsmask(out->buf + out->end, p, len, key);
+		out->end += len;
+		p += len;
+		op = WS_CONTINUATION;
+		rsv = 0;
+		if(flush && n) {
+			if(wstlssend(conn->tls, conn->fd, out->buf + out->start, out->end - out->start)) return -1;
+			out->start = out->end = 0;
+		}
+	} while(n);
+	return 0;
+}
+
+WEBSOCKET_API int
+wssendv(WsConn *conn, const WsMsg *msgs, size_t n) {
+	WsBuf *out = &conn->fb;
 	double t = now();
-	if(wstlssend(conn->tls, header, i)) return -1;
-	int rc = wstlssend(conn->tls, data, n);
+	out->start = out->end = 0;
+	for(size_t i=0;i<n;i++)
+		if(wsappend(conn, out, msgs[i].data, msgs[i].n, msgs[i].op, 1)) return -1;
+	int rc = wstlssend(conn->tls, conn->fd, out->buf, out->end);
 	conn->send_time += now() - t;
 	return rc;
 }
 
+WEBSOCKET_API int
+wssend(WsConn *conn, const void *data, size_t n, int binary) {
+	WsMsg msg;
+	msg.data = (const char*)data;
+	msg.n = n;
+	msg.op = binary ? WS_BINARY : WS_TEXT;
+	return wssendv(conn, &msg, 1);
+}
+
 WEBSOCKET_API int
 wssendtext(WsConn *conn, const void *data, size_t n) {
-    conn->send_uncompressed = n;
+	if(!conn->deflate) conn->send_uncompressed += n;
 	return wssend(conn, data, n, 0);
 }
 
 WEBSOCKET_API int
 wssendzlib(WsConn *conn, const void *data, size_t n) {
 	size_t ntmp = gzip_bound(GZIP_ZLIB, n);
-	char *tmp = malloc(ntmp);
+	char *tmp = (char*)malloc(ntmp);
 	ssize_t sz = gzip_compress(GZIP_ZLIB, tmp, ntmp, data, n);
 	if(sz <= 0) return -1;
 	//printf("sending %zu compressed bytes from %zu original\n", sz, n);
@@ -250,92 +655,199 @@ wssendzlib(WsConn *conn, const void *data, size_t n) {
 	return rc;
 }
 
-WEBSOCKET_API char*
-wsrecv(WsConn *conn, size_t *n) {
-	SB sb;
-	sb_init(&sb);
-	*n = 0;
-	int first = 1;
-	double t = now();
-	for(;;) {
-		uint8_t buf[125];
-		if(wstlsreadn(conn->tls, buf, 2)) {
-			fprintf(stderr, "%s:%d ws read failed\n", __FILE__, __LINE__);
-			goto error;
-		}
+/* inflate a whole message into b->z */
+static int
+wsinflate(WsConn *conn, WsBuf *b, WsMsg *msg) {
+	static const unsigned char tail[4] = {0, 0, 0xff, 0xff};
+	z_stream *z = &conn->zin;
+	size_t n = 0;
+	int rc = Z_OK;
+	if(msg->n > UINT_MAX) return -1;
+	for(int i=0;i<2 && rc != Z_STREAM_END;i++) {
+		z->next_in = (Bytef*)(i ? (const char*)tail : msg->data);
+		z->avail_in = i ? sizeof tail : msg->n;
+		do {
+			if(b->zcap - n < 1024) {
+				size_t cap = b->zcap ? b->zcap * 2 : WEBSOCKET_BUFSIZE;
+				char *p = (char*)realloc(b->z, cap);
+				if(!p) return -1;
+				b->z = p;
+				b->zcap = cap;
+			}
+			z->next_out = (Bytef*)b->z + n;
+			z->avail_out = b->zcap - n;
+			rc = inflate(z, Z_SYNC_FLUSH);
+			n = (char*)z->next_out - b->z;
+			if(n > WEBSOCKET_MAX_MESSAGE) return -1;
+			if(rc == Z_STREAM_END) break; /* sender set BFINAL */
+			if(rc != Z_OK && rc != Z_BUF_ERROR) return -1;
+		} while(z->avail_in || !z->avail_out);
+	}
+	if(conn->inflate_reset || rc == Z_STREAM_END) inflateReset(z);
+	msg->data = b->z;
+	msg->n = n;
+	conn->recv_uncompressed += n;
+	return 0;
+}
 
-		int fin = buf[0] & (1 << 7);
-		int op = buf[0] & 15;
-		int mask = buf[1] & (1 << 7);
-		if(mask) {
+/* parse the next frame in b. returns 1 with msg set, 0 when *need more bytes
+   must be read first or -1 on a protocol error */
+static int
+wsparse(WsConn *conn, WsBuf *b, WsMsg *msg, size_t *need) {
+	for(;;) {
+		size_t avail = b->end - b->start;
+		uint8_t *p = (uint8_t*)b->buf + b->start;
+		*need = 2;
+		if(avail < 2) break;
+		size_t len = p[1] & 127;
+		size_t header = 2 + (len == 126 ? 2 : len == 127 ? 8 : 0);
+		*need = header;
+		if(p[1] & (1 << 7)) {
 			fprintf(stderr, "Websocket expected unmasked data from server\n");
-			goto error;
+			return -1;
 		}
-		size_t len = buf[1] & 127;
-		if(len == 126) {
-			if(wstlsreadn(conn->tls, buf, 2)) {
-				fprintf(stderr, "%s:%d ws read len failed\n", __FILE__, __LINE__);
-				goto error;
-			}
-			len = (size_t)buf[0] << 8;
-			len += (size_t)buf[1];
-		} else if(len == 127) {
-			if(wstlsreadn(conn->tls, buf, 8)) {
-				fprintf(stderr, "%s:%d ws read long len\n", __FILE__, __LINE__);
-				goto error;
+		if(avail < header) break;
+		if(len == 126)
+			len = (size_t)p[2] << 8 | p[3];
+		else if(len == 127) {
+			uint64_t n = 0;
+			for(int i=0;i<8;i++) n = n << 8 | p[2 + i];
+			/* checked before header + len can wrap */
+			if(n > WEBSOCKET_MAX_MESSAGE) {
+				fprintf(stderr, "%s:%d ws frame too big\n", __FILE__, __LINE__);
+				return -1;
 			}
-			len = (size_t)buf[0] << 56;
-			len += (size_t)buf[1] << 48;
-			len += (size_t)buf[2] << 40;
-			len += (size_t)buf[3] << 32;
-			len += (size_t)buf[4] << 24;
-			len += (size_t)buf[5] << 16;
-			len += (size_t)buf[6] << 8;
-			len += (size_t)buf[7];
+			len = (size_t)n;
+		}
+		if((p[0] & 15) == WS_CONTINUATION && len > WEBSOCKET_MAX_MESSAGE - b->nmsg) {
+			fprintf(stderr, "%s:%d ws message too big\n", __FILE__, __LINE__);
+			return -1;
 		}
+		*need = header + len;
+		if(avail < *need) break;
 
-		if(op > 2) {
-			if(len > 125) {
-				fprintf(stderr, "%s:%d ws read op failed\n", __FILE__, __LINE__);
-				goto error;
+		int fin = p[0] & (1 << 7);
+		int op = p[0] & 15;
+		int deflated = p[0] & WEBSOCKET_RSV1;
+		char *payload = b->buf + b->start + header;
+		b->start += header + len;
+		if(deflated && ((op != WS_TEXT && op != WS_BINARY) || !conn->deflate)) {
+			fprintf(stderr, "%s:%d ws unexpected compressed frame\n", __FILE__, __LINE__);
+			return -1;
+		}
+		if(op >= WS_CLOSE) {
+			/* control frames may come between fragments of a message */
+			if(!fin || len > 125) {
+				fprintf(stderr, "%s:%d ws bad control frame\n", __FILE__, __LINE__);
+				return -1;
 			}
-			if(wstlsreadn(conn->tls, buf, len)) {
-				fprintf(stderr, "%s:%d ws read op failed\n", __FILE__, __LINE__);
-				goto error;
+			msg->data = payload;
+			msg->n = len;
+			msg->op = op;
+			return 1;
+		}
+		if(op == WS_CONTINUATION ? !b->partial : b->partial) {
+			fprintf(stderr, "%s:%d ws unexpected fragment\n", __FILE__, __LINE__);
+			return -1;
+		}
+		if(fin && !b->partial) {
+			msg->data = payload;
+			msg->n = len;
+			msg->op = op;
+		} else {
+			if(!b->partial) {
+				b->partial = op;
+				b->deflated = deflated;
+				b->msg = payload - b->buf;
+				b->nmsg = 0;
 			}
-			continue;
+			memmove(b->buf + b->msg + b->nmsg, payload, len);
+			b->nmsg += len;
+			if(!fin) continue;
+			msg->data = b->buf + b->msg;
+			msg->n = b->nmsg;
+			msg->op = b->partial;
+			deflated = b->deflated;
+			b->partial = 0;
+		}
+		conn->recv += msg->n;
+		if(deflated && wsinflate(conn, b, msg)) {
+			fprintf(stderr, "%s:%d ws inflate failed\n", __FILE__, __LINE__);
+			return -1;
 		}
-		if(first) {
-			first = 0;
-			t = now();
+		return 1;
+	}
+	*need -= b->end - b->start;
+	if(!b->partial && b->start == b->end) b->start = b->end = 0;
+	return 0;
+}
+
+/* make room to read at least need bytes without reading in tiny pieces */
+static int
+wsbuf_space(WsBuf *b, size_t need) {
+	if(!b->buf) wsbuf_init(b, 0);
+	if(b->cap - b->end < need || b->cap - b->end < b->cap / 4)
+		return wsbuf_reserve(b, need);
+	return 0;
+}
+
+WEBSOCKET_API int
+wsrecvmsg(WsConn *conn, WsBuf *b, WsMsg *msg) {
+	WsBuf *rb = &conn->rb;
+	double t = 0;
+	if(!b) b = rb;
+	else if(rb->end > rb->start) {
+		/* bytes read with the handshake or by wsrecv */
+		size_t n = rb->end - rb->start;
+		if(wsbuf_space(b, n)) return -1;
+		memcpy(b->buf + b->end, rb->buf + rb->start, n);
+		b->end += n;
+		rb->start = rb->end;
+	}
+	if(b->start < b->end) t = now();
+
+	for(;;) {
+		size_t need;
+		int rc = wsparse(conn, b, msg, &need);
+		if(rc < 0) return -1;
+		if(rc) {
+			if(t && msg->op < WS_CLOSE) conn->recv_time += now() - t;
+			return 0;
 		}
-		sb_reserve(&sb, len + 1);
-		if(wstlsreadn(conn->tls, sb.str + sb.n, len)) {
-			fprintf(stderr, "%s:%d ws read body failed\n", __FILE__, __LINE__);
-			goto error;
+		if(wsbuf_space(b, need)) return -1;
+		if(wsbuf_read(conn->tls, conn->fd, b) < 0) {
+			fprintf(stderr, "%s:%d ws read failed\n", __FILE__, __LINE__);
+			return -1;
 		}
-		sb.n += len;
-		sb.str[sb.n] = 0;
-		if(fin) break;
+		if(!t) t = now();
 	}
-	*n = sb.n;
-	conn->recv += *n;
-	conn->recv_time += now() - t;
+}
+
+WEBSOCKET_API char*
+wsrecv(WsConn *conn, size_t *n) {
+	WsMsg msg;
+	*n = 0;
+	do {
+		if(wsrecvmsg(conn, 0, &msg) || msg.op == WS_CLOSE) return 0;
+	} while(msg.op >= WS_CLOSE); /* skip ping and pong */
+	char *data = (char*)malloc(msg.n + 1);
+	if(!data) return 0;
+	memcpy(data, msg.data, msg.n);
+	data[msg.n] = 0;
+	*n = msg.n;
 	//fprintf(stderr, "ws read received %zu bytes\n", *n);
-	return sb.str;
-error:
-	sb_free(&sb);
-	return 0;
+	return data;
 }
 
 WEBSOCKET_API char*
 wsrecvzlib(WsConn *conn, size_t *n) {
-	size_t ndata;
+	WsMsg msg;
 	*n = 0;
-	char *data = wsrecv(conn, &ndata);
-	if(!data) return 0;
-	char *uncomp = gzip_uncompress(GZIP_ZLIB, data, ndata, n);
-	free(data);
+	do {
+		if(wsrecvmsg(conn, 0, &msg) || msg.op == WS_CLOSE) return 0;
+	} while(msg.op >= WS_CLOSE);
+	/* inflate straight from the receive buffer */
+	char *uncomp = (char*)gzip_uncompress(GZIP_ZLIB, msg.data, msg.n, n);
 	//fprintf(stderr, "decompressed %zu into %zu\n", ndata, *n);
 	//uncomp = realloc(uncomp, *n + 1);
 	//uncomp[*n] = 0;
@@ -343,4 +855,577 @@ wsrecvzlib(WsConn *conn, size_t *n) {
 	return uncomp;
 }
 
+#ifdef __linux__
+struct WsLoop {
+	int epfd;
+	WsConn *conns;
+	WsConn *dirty; /* queued frames or buffered input to handle this pass */
+	struct epoll_event events[WEBSOCKET_EVENTS];
+	int nevents;
+};
+
+WEBSOCKET_API WsLoop*
+wsloop_new(void) {
+	WsLoop *loop = (WsLoop*)calloc(1, sizeof *loop);
+	if(!loop) return 0;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(loop->epfd < 0) {
+		free(loop);
+		return 0;
+	}
+	return loop;
+}
+
+WEBSOCKET_API void
+wsloop_destroy(WsLoop *loop) {
+	if(!loop) return;
+	while(loop->conns) wsclose(loop->conns);
+	close(loop->epfd);
+	free(loop);
+}
+
+static void
+wsloop_dirty(WsLoop *loop, WsConn *c) {
+	if(c->dirty) return;
+	c->dirty = 1;
+	c->next_dirty = loop->dirty;
+	loop->dirty = c;
+}
+
+WEBSOCKET_API int
+wsloop_add(WsLoop *loop, WsConn *c, ws_message_fn fn, void *ctx, size_t max_pending) {
+	int flags = fcntl(c->fd, F_GETFL);
+	if(flags < 0 || fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, c->fd, &ev)) return -1;
+	c->events = EPOLLIN;
+	c->loop = loop;
+	c->fn = fn;
+	c->ctx = ctx;
+	c->max_pending = max_pending;
+	c->prev = 0;
+	c->next = loop->conns;
+	if(c->next) c->next->prev = c;
+	loop->conns = c;
+	/* frames read with the handshake or queued before adding */
+	c->unread = c->rb.start < c->rb.end;
+	if(c->unread || wspending(c)) wsloop_dirty(loop, c);
+	return 0;
+}
+
+WEBSOCKET_API void
+wsloop_remove(WsLoop *loop, WsConn *c) {
+	if(c->loop != loop) return;
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, c->fd, 0);
+	if(c->prev) c->prev->next = c->next;
+	else loop->conns = c->next;
+	if(c->next) c->next->prev = c->prev;
+	if(c->dirty) {
+		WsConn **p = &loop->dirty;
+		while(*p != c) p = &(*p)->next_dirty;
+		*p = c->next_dirty;
+		c->dirty = 0;
+	}
+	/* the connection may still be waiting in this pass */
+	for(int i=0;i<loop->nevents;i++)
+		if(loop->events[i].data.ptr == c) loop->events[i].data.ptr = 0;
+	c->loop = 0;
+	c->wb.start = c->wb.end = 0;
+}
+
+WEBSOCKET_API size_t
+wspending(WsConn *c) {
+	return c->wb.end - c->wb.start;
+}
+
+WEBSOCKET_API int
+wsqueue(WsConn *c, const void *data, size_t n, int op) {
+	if(op < WS_CLOSE && c->max_pending && wspending(c) + n > c->max_pending) {
+		c->blocked = 1;
+		return -1;
+	}
+	if(wsappend(c, &c->wb, data, n, op, 0)) return -1;
+	if(c->loop) wsloop_dirty(c->loop, c);
+	return 0;
+}
+
+/* returns -1 if the connection was closed or removed by the callback */
+static int
+wsloop_call(WsLoop *loop, WsConn *c, const WsMsg *msg) {
+	c->in_callback = 1;
+	c->fn(c->ctx, c, msg);
+	c->in_callback = 0;
+	if(c->closed) {
+		c->closed = 0;
+		wsclose(c);
+		return -1;
+	}
+	return c->loop == loop ? 0 : -1;
+}
+
+static void
+wsloop_fail(WsLoop *loop, WsConn *c, const WsMsg *msg) {
+	WsMsg m;
+	if(!msg) {
+		memset(&m, 0, sizeof m);
+		m.op = WS_CLOSE;
+		msg = &m;
+	}
+	if(!wsloop_call(loop, c, msg)) wsclose(c);
+}
+
+/* write queued frames until the socket is full. returns -1 on error */
+static int
+wsloop_flush(WsLoop *loop, WsConn *c) {
+	WsBuf *w = &c->wb;
+	while(w->start < w->end) {
+		ssize_t rc = wsio_write(c->tls, c->fd, w->buf + w->start, w->end - w->start);
+		if(rc == TLS_WANT_POLLIN || rc == TLS_WANT_POLLOUT) break;
+		if(rc <= 0) return -1;
+		w->start += rc;
+	}
+	if(w->start == w->end) w->start = w->end = 0;
+	unsigned events = EPOLLIN | (w->end || c->read_wants_out ? EPOLLOUT : 0);
+	if(events != c->events) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof ev);
+		ev.events = events;
+		ev.data.ptr = c;
+		if(epoll_ctl(loop->epfd, EPOLL_CTL_MOD, c->fd, &ev)) return -1;
+		c->events = events;
+	}
+	return 0;
+}
+
+/* read and dispatch everything available. returns -1 if the connection is gone */
+static int
+wsloop_read(WsLoop *loop, WsConn *c) {
+	WsBuf *b = &c->rb;
+	c->read_wants_out = 0;
+	c->unread = 0;
+	for(;;) {
+		WsMsg msg;
+		size_t need;
+		int rc;
+		while((rc = wsparse(c, b, &msg, &need)) > 0) {
+			if(msg.op == WS_PING) {
+				wsqueue(c, msg.data, msg.n, WS_PONG);
+				continue;
+			}
+			if(msg.op == WS_CLOSE) {
+				/* echo the status code and try to get it out before closing */
+				wsqueue(c, msg.data, msg.n < 2 ? msg.n : 2, WS_CLOSE);
+				wsloop_flush(loop, c);
+				wsloop_fail(loop, c, &msg);
+				return -1;
+			}
+			if(msg.op >= WS_CLOSE && msg.op != WS_PONG) continue;
+			if(wsloop_call(loop, c, &msg)) return -1;
+		}
+		if(rc < 0) {
+			/* 1002 protocol error, sent if the socket takes it now */
+			wsqueue(c, "\x03\xea", 2, WS_CLOSE);
+			wsloop_flush(loop, c);
+		}
+		if(rc < 0 || wsbuf_space(b, need)) {
+			wsloop_fail(loop, c, 0);
+			return -1;
+		}
+		ssize_t n = wsio_read(c->tls, c->fd, b->buf + b->end, b->cap - b->end);
+		if(n == TLS_WANT_POLLIN) return 0;
+		if(n == TLS_WANT_POLLOUT) {
+			c->read_wants_out = 1;
+			wsloop_dirty(loop, c);
+			return 0;
+		}
+		if(n <= 0) {
+			wsloop_fail(loop, c, 0);
+			return -1;
+		}
+		b->end += n;
+	}
+}
+
+/* flush every connection that queued frames. all frames queued for a
+   connection during a pass go out in one write */
+static void
+wsloop_drain(WsLoop *loop) {
+	WsConn *c;
+	while((c = loop->dirty)) {
+		loop->dirty = c->next_dirty;
+		c->dirty = 0;
+		if(c->unread && wsloop_read(loop, c)) continue;
+		if(wsloop_flush(loop, c)) {
+			wsloop_fail(loop, c, 0);
+			continue;
+		}
+		if(c->blocked && (!c->max_pending || wspending(c) <= c->max_pending / 2)) {
+			WsMsg msg;
+			memset(&msg, 0, sizeof msg);
+			msg.op = WS_WRITABLE;
+			c->blocked = 0;
+			wsloop_call(loop, c, &msg);
+		}
+	}
+}
+
+WEBSOCKET_API int
+wsloop_run(WsLoop *loop, int timeout_ms) {
+	wsloop_drain(loop);
+	int n = epoll_wait(loop->epfd, loop->events, WEBSOCKET_EVENTS, loop->dirty ? 0 : timeout_ms);
+	if(n < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	loop->nevents = n;
+	for(int i=0;i<n;i++) {
+		WsConn *c = (WsConn*)loop->events[i].data.ptr;
+		if(!c) continue; /* removed by an earlier callback */
+		unsigned ev = loop->events[i].events;
+		if(ev & EPOLLOUT) wsloop_dirty(loop, c);
+		if(ev & (EPOLLIN | EPOLLERR | EPOLLHUP) || c->read_wants_out) wsloop_read(loop, c);
+	}
+	loop->nevents = 0;
+	wsloop_drain(loop);
+	return n;
+}
+#endif
+
+#endif
+
+#ifdef WEBSOCKET_EXAMPLE
+#include <assert.h>
+#include <stdio.h>
+
+/* unmasked server frame appended to b */
+static void
+example_frame(WsBuf *b, int b0, const void *data, size_t n) {
+	uint8_t *p;
+	size_t i = 0;
+	assert(!wsbuf_space(b, n + 10));
+	p = (uint8_t*)b->buf + b->end;
+	p[i++] = b0;
+	if(n < 126) p[i++] = n;
+	else if(n <= UINT16_MAX) {
+		p[i++] = 126;
+		p[i++] = n >> 8;
+		p[i++] = n;
+	} else {
+		p[i++] = 127;
+		for(int k=7;k>=0;k--) p[i++] = (uint64_t)n >> (8 * k);
+	}
+	memcpy(p + i, data, n);
+	b->end += i + n;
+}
+
+/* raw deflate of a server message without the 00 00 ff ff tail */
+static size_t
+example_deflate(z_stream *z, char *out, size_t cap, const char *data, size_t n) {
+	z->next_in = (Bytef*)data;
+	z->avail_in = n;
+	z->next_out = (Bytef*)out;
+	z->avail_out = cap;
+	assert(deflate(z, Z_SYNC_FLUSH) == Z_OK && z->avail_out);
+	return cap - z->avail_out - 4;
+}
+
+/* checks a client frame at p and unmasks its payload into out. returns frame size */
+static size_t
+example_client_frame(const uint8_t *p, int *b0, char *out, size_t *n) {
+	size_t len = p[1] & 127, i = 2;
+	assert(p[1] & (1 << 7));
+	if(len == 126) {
+		len = (size_t)p[2] << 8 | p[3];
+		i = 4;
+	} else if(len == 127) {
+		len = 0;
+		for(i=2;i<10;i++) len = len << 8 | p[i];
+	}
+	*b0 = p[0];
+	*n = len;
+	for(size_t k=0;k<len;k++) out[k] = p[i + 4 + k] ^ p[i + (k & 3)];
+	return i + 4 + len;
+}
+
+#ifdef __linux__
+typedef struct ExampleLoop {
+	int texts, pongs, writable, closes;
+	char close[8];
+	size_t nclose;
+} ExampleLoop;
+
+static void
+example_message(void *ctx, WsConn *conn, const WsMsg *msg) {
+	ExampleLoop *e = (ExampleLoop*)ctx;
+	if(msg->op == WS_TEXT) {
+		/* written with the pong at the end of the pass */
+		e->texts++;
+		assert(!wsqueue(conn, msg->data, msg->n, WS_TEXT));
+	} else if(msg->op == WS_PONG) e->pongs++;
+	else if(msg->op == WS_WRITABLE) e->writable++;
+	else if(msg->op == WS_CLOSE) {
+		e->closes++;
+		e->nclose = msg->n < sizeof e->close ? msg->n : sizeof e->close;
+		if(e->nclose) memcpy(e->close, msg->data, e->nclose);
+	}
+}
+
+/* server end of the socketpair */
+static void
+example_send(int fd, WsBuf *b) {
+	for(size_t i=b->start;i<b->end;) {
+		ssize_t rc = send(fd, b->buf + i, b->end - i, 0);
+		assert(rc > 0);
+		i += rc;
+	}
+	b->start = b->end = 0;
+}
+
+static void
+example_recv(int fd, char *buf, size_t n) {
+	while(n) {
+		ssize_t rc = recv(fd, buf, n, 0);
+		assert(rc > 0);
+		buf += rc;
+		n -= rc;
+	}
+}
+
+/* a plain socket connection with no tls handshake */
+static WsConn*
+example_conn(int fd) {
+	WsConn *c = (WsConn*)calloc(1, sizeof *c);
+	c->fd = fd;
+	c->seed = 1;
+	return c;
+}
+
+/* wsloop over socketpairs: pings answered, echoes queued from the callback,
+   backpressure with WS_WRITABLE, close echo and protocol errors */
+static void
+example_loop(void) {
+	static char chunk[16384], payload[sizeof chunk], all[128 * (sizeof chunk + 8)];
+	char frame[16];
+	int sv[2], sv2[2], b0, small = 32 * 1024;
+	size_t n, queued = 0, got = 0;
+	ExampleLoop e;
+	WsBuf b;
+	WsLoop *loop = wsloop_new();
+	memset(&e, 0, sizeof e);
+	wsbuf_init(&b, 0);
+	for(size_t i=0;i<sizeof chunk;i++) chunk[i] = (char)(i * 13);
+	assert(loop && !socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	assert(!setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof small));
+	WsConn *c = example_conn(sv[0]);
+	assert(!wsloop_add(loop, c, example_message, &e, 1 << 20));
+
+	example_frame(&b, 0x80 | WS_TEXT, "hi", 2);
+	example_frame(&b, 0x80 | WS_PING, "x", 1);
+	example_frame(&b, 0x80 | WS_PONG, "y", 1);
+	example_send(sv[1], &b);
+	while(!e.texts || !e.pongs) assert(wsloop_run(loop, 1000) >= 0);
+	example_recv(sv[1], all, 8 + 7);
+	example_client_frame((const uint8_t*)all, &b0, frame, &n);
+	assert(b0 == (0x80 | WS_TEXT) && n == 2 && !memcmp(frame, "hi", 2));
+	example_client_frame((const uint8_t*)all + 8, &b0, frame, &n);
+	assert(b0 == (0x80 | WS_PONG) && n == 1 && *frame == 'x');
+
+	/* nobody reads so the socket fills and the rest waits in the queue.
+	   WS_WRITABLE comes once reading lets it drain to half the limit */
+	while(!wsqueue(c, chunk, sizeof chunk, WS_BINARY)) queued++;
+	assert(queued && queued <= 128);
+	assert(wsloop_run(loop, 0) >= 0 && wspending(c) > (1 << 19) && !e.writable);
+	while(got < queued * (sizeof chunk + 8)) {
+		ssize_t rc = recv(sv[1], all + got, queued * (sizeof chunk + 8) - got, MSG_DONTWAIT);
+		if(rc > 0) got += rc;
+		assert(wsloop_run(loop, 10) >= 0);
+	}
+	assert(e.writable == 1 && !wspending(c));
+	for(size_t i=0;i<queued;i++) {
+		example_client_frame((const uint8_t*)all + i * (sizeof chunk + 8), &b0, payload, &n);
+		assert(b0 == (0x80 | WS_BINARY) && n == sizeof chunk && !memcmp(payload, chunk, n));
+	}
+
+	/* the status code is echoed before the connection is freed */
+	example_frame(&b, 0x80 | WS_CLOSE, "\x03\xe8" "bye", 5);
+	example_send(sv[1], &b);
+	while(!e.closes) assert(wsloop_run(loop, 1000) >= 0);
+	assert(e.nclose == 5 && !memcmp(e.close, "\x03\xe8" "bye", 5));
+	example_recv(sv[1], frame, 8);
+	example_client_frame((const uint8_t*)frame, &b0, frame, &n);
+	assert(b0 == (0x80 | WS_CLOSE) && n == 2 && !memcmp(frame, "\x03\xe8", 2));
+	assert(recv(sv[1], frame, 1, 0) == 0);
+
+	/* a masked frame from the server gets a 1002 close */
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv2));
+	assert(!wsloop_add(loop, example_conn(sv2[0]), example_message, &e, 0));
+	assert(send(sv2[1], "\x81\x81\0\0\0\0x", 7, 0) == 7);
+	while(e.closes < 2) assert(wsloop_run(loop, 1000) >= 0);
+	assert(e.nclose == 0);
+	example_recv(sv2[1], frame, 8);
+	example_client_frame((const uint8_t*)frame, &b0, frame, &n);
+	assert(b0 == (0x80 | WS_CLOSE) && n == 2 && !memcmp(frame, "\x03\xea", 2));
+
+	wsloop_destroy(loop);
+	wsbuf_free(&b);
+	close(sv[1]);
+	close(sv2[1]);
+}
+#endif
+
+int main(int argc, char **argv) {
+	static char src[3 * WEBSOCKET_FRAGMENT], dst[3 * WEBSOCKET_FRAGMENT], ref[256];
+	WsConn *c = (WsConn*)calloc(1, sizeof *c);
+	WsBuf b;
+	WsMsg msg;
+	size_t need, n;
+	int b0;
+	c->fd = -1;
+	c->seed = 1;
+	for(size_t i=0;i<sizeof src;i++) src[i] = (char)(i * 7 + i / 251);
+
+	/* simd mask matches a byte at a time at every length and alignment */
+	for(size_t off=0;off<4;off++)
+		for(size_t len=0;len<200;len++) {
+			uint32_t key = wsrand(c);
+			const uint8_t *k = (const uint8_t*)&key;
+			for(size_t i=0;i<len;i++) ref[i] = src[off + i] ^ k[i & 3];
+			wsmask(dst + off, src + off, len, key);
+			assert(!memcmp(dst + off, ref, len));
+			wsmask(dst + off, dst + off, len, key); /* in place */
+			assert(!memcmp(dst + off, src + off, len));
+		}
+
+	/* client frames are masked with the short, 16 and 64 bit lengths and
+	   messages over WEBSOCKET_FRAGMENT are split */
+	WsMsg out[4] = {{src, 5, WS_TEXT}, {src, 300, WS_BINARY}, {src, 70000, WS_BINARY}, {src, 4, WS_PING}};
+	for(int i=0;i<4;i++) assert(!wsappend(c, &c->fb, out[i].data, out[i].n, out[i].op, 0));
+	const uint8_t *p = (const uint8_t*)c->fb.buf;
+	for(int i=0;i<4;i++) {
+		p += example_client_frame(p, &b0, dst, &n);
+		assert(b0 == (0x80 | out[i].op) && n == out[i].n && !memcmp(dst, src, n));
+	}
+	assert((const char*)p == c->fb.buf + c->fb.end);
+	c->fb.start = c->fb.end = 0;
+	assert(!wsappend(c, &c->fb, src, WEBSOCKET_FRAGMENT + 10, WS_BINARY, 0));
+	p = (const uint8_t*)c->fb.buf;
+	p += example_client_frame(p, &b0, dst, &n);
+	assert(b0 == WS_BINARY && n == WEBSOCKET_FRAGMENT && !memcmp(dst, src, n));
+	p += example_client_frame(p, &b0, dst, &n);
+	assert(b0 == (0x80 | WS_CONTINUATION) && n == 10 && !memcmp(dst, src + WEBSOCKET_FRAGMENT, n));
+	c->fb.start = c->fb.end = 0;
+
+	/* a fragmented message with a ping between the fragments. the ping comes
+	   first and the fragments are joined in place */
+	wsbuf_init(&b, 16);
+	example_frame(&b, WS_TEXT, "hello", 5);
+	example_frame(&b, 0x80 | WS_PING, "p", 1);
+	example_frame(&b, WS_CONTINUATION, " web", 4);
+	example_frame(&b, 0x80 | WS_CONTINUATION, "socket", 6);
+	example_frame(&b, 0x80 | WS_BINARY, src, 70000);
+	example_frame(&b, 0x80 | WS_CLOSE, "\x03\xe8", 2);
+	assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_PING && msg.n == 1 && *msg.data == 'p');
+	assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_TEXT && msg.n == 15 && !memcmp(msg.data, "hello websocket", 15));
+	assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_BINARY && msg.n == 70000 && !memcmp(msg.data, src, 70000));
+	assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_CLOSE && msg.n == 2);
+	assert(!wsparse(c, &b, &msg, &need) && need == 2);
+
+	/* bytes arriving one at a time. need says how many more a frame wants */
+	WsBuf whole;
+	wsbuf_init(&whole, 0);
+	example_frame(&whole, 0x80 | WS_BINARY, src, 300);
+	for(size_t i=0;i<whole.end;i++) {
+		assert(!wsparse(c, &b, &msg, &need));
+		assert(need == (i < 2 ? 2 - i : i < 4 ? 4 - i : whole.end - i));
+		assert(!wsbuf_space(&b, 1));
+		b.buf[b.end++] = whole.buf[i];
+	}
+	assert(wsparse(c, &b, &msg, &need) == 1 && msg.n == 300 && !memcmp(msg.data, src, 300));
+	wsbuf_free(&whole);
+
+	/* permessage-deflate from a canned handshake response */
+	static const char response[] =
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=12\r\n"
+		"\r\n";
+	static const char response8[] =
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=8\r\n"
+		"\r\n";
+	WsDeflate opt;
+	memset(&opt, 0, sizeof opt);
+	assert(wsextensions(c, response8, sizeof response8 - 1, &opt) < 0 && !c->deflate);
+	assert(!wsextensions(c, response, sizeof response - 1, &opt) && c->deflate);
+
+	/* compressed server messages, one of them fragmented, sharing a window */
+	z_stream zs, zc;
+	static char z[1 << 16];
+	memset(&zs, 0, sizeof zs);
+	memset(&zc, 0, sizeof zc);
+	assert(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+	assert(inflateInit2(&zc, -12) == Z_OK);
+	for(int round=0;round<2;round++) {
+		n = example_deflate(&zs, z, sizeof z, src, 20000);
+		example_frame(&b, WEBSOCKET_RSV1 | WS_BINARY, z, n / 2);
+		example_frame(&b, 0x80 | WS_CONTINUATION, z + n / 2, n - n / 2);
+		n = example_deflate(&zs, z, sizeof z, "compressed", 10);
+		example_frame(&b, 0x80 | WEBSOCKET_RSV1 | WS_TEXT, z, n);
+		example_frame(&b, 0x80 | WS_TEXT, "plain", 5);
+		assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_BINARY && msg.n == 20000 && !memcmp(msg.data, src, 20000));
+		assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_TEXT && msg.n == 10 && !memcmp(msg.data, "compressed", 10));
+		assert(wsparse(c, &b, &msg, &need) == 1 && msg.op == WS_TEXT && msg.n == 5 && !memcmp(msg.data, "plain", 5));
+
+		/* client messages are compressed with RSV1 and control frames are not */
+		assert(!wsappend(c, &c->fb, src, 20000, WS_BINARY, 0));
+		assert(!wsappend(c, &c->fb, "p", 1, WS_PING, 0));
+		p = (const uint8_t*)c->fb.buf;
+		p += example_client_frame(p, &b0, dst, &n);
+		assert(b0 == (0x80 | WEBSOCKET_RSV1 | WS_BINARY) && n < 20000);
+		memcpy(dst + n, "\0\0\xff\xff", 4);
+		zc.next_in = (Bytef*)dst;
+		zc.avail_in = n + 4;
+		zc.next_out = (Bytef*)z;
+		zc.avail_out = sizeof z;
+		assert(inflate(&zc, Z_SYNC_FLUSH) == Z_OK && sizeof z - zc.avail_out == 20000 && !memcmp(z, src, 20000));
+		p += example_client_frame(p, &b0, dst, &n);
+		assert(b0 == (0x80 | WS_PING) && n == 1 && *dst == 'p');
+		c->fb.start = c->fb.end = 0;
+	}
+	deflateEnd(&zs);
+	inflateEnd(&zc);
+	wsbuf_free(&b);
+
+	/* protocol errors: masked server frame, long or fragmented control frame,
+	   continuation with nothing to continue, compressed control frame and
+	   64 bit lengths that would wrap the buffer offsets or are just too big */
+	static const unsigned char bad[][10] = {
+		{0x81, 0x81},
+		{0x89, 126, 0, 126},
+		{0x09},
+		{0x80},
+		{0xc9},
+		{0x82, 127, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0},
+		{0x82, 127, 0, 0, 0, 0, 0x40, 0, 0, 1},
+	};
+	for(size_t i=0;i<sizeof bad / sizeof *bad;i++) {
+		wsbuf_init(&b, 0);
+		memcpy(b.buf, bad[i], 10);
+		b.end = 10;
+		if(i == 1) {
+			memset(b.buf + 4, 0, 126);
+			b.end += 126;
+		}
+		assert(wsparse(c, &b, &msg, &need) == -1);
+		wsbuf_free(&b);
+	}
+	wsclose(c);
+#ifdef __linux__
+	example_loop();
+#endif
+	printf("websocket frames ok\n");
+	return 0;
+}
 #endif